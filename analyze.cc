@@ -0,0 +1,116 @@
+#include "job_pool.h"
+#include "module_analysis.h"
+#include "module_files.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int usage()
+{
+    fprintf(stderr,
+        "usage: analyze [options] <module.it|directory>...\n"
+        "  --json <file>       write a line of JSON stats per module to file\n"
+        "                      (default: standard output)\n"
+        "  --dump <dir>        write the patterns of each module to <dir>/<name>.txt\n"
+        "  --threads <n>       worker threads (default: one per core)\n"
+        "Lines of JSON come in the order modules finish, not the order given.\n");
+    return 2;
+}
+
+static bool write_file(const std::string& path, const TextBuffer& text)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    const bool written = fwrite(text.data(), 1, text.size(), f) == text.size();
+    return fclose(f) == 0 && written;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t threads = hardware_threads();
+    std::string json_path;
+    std::string dump_dir;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_dir = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = static_cast<size_t>(atoi(argv[++i]));
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    const auto modules = find_modules(inputs);
+    if (modules.empty() || threads == 0) {
+        return usage();
+    }
+    FILE* json = stdout;
+    if (!json_path.empty()) {
+        json = fopen(json_path.c_str(), "w");
+        if (!json) {
+            fprintf(stderr, "analyze: can't create %s\n", json_path.c_str());
+            return 1;
+        }
+    }
+
+    size_t analyzed = 0;
+    size_t failed = 0;
+    std::mutex output_mutex;
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    {
+        WorkStealingPool pool(threads);
+        for (const auto& path : modules) {
+            pool.submit([&, path] {
+                // Each worker keeps its buffers from one module to the next
+                thread_local TextBuffer stats_text;
+                thread_local TextBuffer dump_text;
+                stats_text.clear();
+                dump_text.clear();
+                std::string error;
+                try {
+                    const Module mod = load_module(path);
+                    format_stats_json(analyze_module(mod), path, stats_text);
+                    if (!dump_dir.empty()) {
+                        dump_patterns(mod, dump_text);
+                        const std::string dump_path = dump_dir + "/" + module_basename(path) + ".txt";
+                        if (!write_file(dump_path, dump_text)) {
+                            error = "can't write " + dump_path;
+                        }
+                    }
+                } catch (const std::runtime_error& e) {
+                    error = e.what();
+                }
+                std::lock_guard<std::mutex> lock(output_mutex);
+                if (error.empty()) {
+                    fwrite(stats_text.data(), 1, stats_text.size(), json);
+                    analyzed++;
+                } else {
+                    fprintf(stderr, "analyze: %s\n", error.c_str());
+                    failed++;
+                }
+            });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    if (json != stdout && fclose(json) != 0) {
+        fprintf(stderr, "analyze: can't write %s\n", json_path.c_str());
+        return 1;
+    }
+    fprintf(stderr, "%zu threads: %zu modules (%zu failed) in %.3f s: %.1f modules/s\n", threads, analyzed, failed,
+        elapsed.count(), static_cast<double>(analyzed) / elapsed.count());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,85 @@
+#include "audio_file.h"
+#include <stdexcept>
+
+static void write_le(std::ofstream& f, uint32_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++) {
+        f.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+FileType file_type_for_path(const std::string& path)
+{
+    const std::string extension = ".wav";
+    if (path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0) {
+        return FileType::wav;
+    }
+    return FileType::raw;
+}
+
+AudioFileWriter::AudioFileWriter(const std::string& path, FileType t, SampleFormat f, int rate)
+    : file(path, std::ios::binary)
+    , type(t)
+    , format(f)
+    , sample_rate(rate)
+    , _frames_written(0)
+    , bus(f)
+{
+    if (!file) {
+        throw std::runtime_error("can't create " + path);
+    }
+    if (type == FileType::wav) {
+        write_wav_header();
+    }
+}
+
+AudioFileWriter::~AudioFileWriter()
+{
+    close();
+}
+
+void AudioFileWriter::write_wav_header()
+{
+    const uint32_t channels = 2;
+    const auto sample_bytes = static_cast<uint32_t>(sample_format_bytes(format));
+    const auto data_bytes = static_cast<uint32_t>(_frames_written * channels * sample_bytes);
+    const uint32_t wave_format_pcm = 1;
+    const uint32_t wave_format_ieee_float = 3;
+
+    file.write("RIFF", 4);
+    write_le(file, 36 + data_bytes, 4);
+    file.write("WAVE", 4);
+    file.write("fmt ", 4);
+    write_le(file, 16, 4);
+    write_le(file, format == SampleFormat::float32 ? wave_format_ieee_float : wave_format_pcm, 2);
+    write_le(file, channels, 2);
+    write_le(file, static_cast<uint32_t>(sample_rate), 4);
+    write_le(file, static_cast<uint32_t>(sample_rate) * channels * sample_bytes, 4);
+    write_le(file, channels * sample_bytes, 2);
+    write_le(file, sample_bytes * 8, 2);
+    file.write("data", 4);
+    write_le(file, data_bytes, 4);
+}
+
+// Sample data is written in host byte order, which is the little-endian
+// order WAV expects on every machine we build for.
+void AudioFileWriter::write(const StereoSample* frames, size_t count)
+{
+    conversion_buffer.resize(count * bus.frame_bytes());
+    bus.process(frames, count, conversion_buffer.data());
+    file.write(conversion_buffer.data(), static_cast<std::streamsize>(conversion_buffer.size()));
+    _frames_written += count;
+}
+
+void AudioFileWriter::close()
+{
+    if (!file.is_open()) {
+        return;
+    }
+    if (type == FileType::wav) {
+        file.seekp(0);
+        write_wav_header();
+    }
+    file.close();
+}
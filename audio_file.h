@@ -0,0 +1,46 @@
+#ifndef _AUDIO_FILE_H_
+#define _AUDIO_FILE_H_
+#include "master_bus.h"
+#include "mixer.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class FileType {
+    wav,
+    raw,
+};
+
+// Writes interleaved stereo frames to a WAV or headerless raw PCM file. The
+// WAV header is filled in with the final sizes when the file is closed.
+// Frames pass through a master bus on the way, which converts them to the
+// file's format.
+class AudioFileWriter {
+public:
+    // Throws std::runtime_error if the file can't be created.
+    AudioFileWriter(const std::string& path, FileType type, SampleFormat format, int sample_rate);
+    ~AudioFileWriter();
+    AudioFileWriter(const AudioFileWriter&) = delete;
+    AudioFileWriter& operator=(const AudioFileWriter&) = delete;
+
+    void write(const StereoSample* frames, size_t count);
+    void close();
+    size_t frames_written() const { return _frames_written; }
+    // Set its gain, clipping and dither before writing
+    MasterBus& master_bus() { return bus; }
+
+private:
+    void write_wav_header();
+
+    std::ofstream file;
+    FileType type;
+    SampleFormat format;
+    int sample_rate;
+    size_t _frames_written;
+    MasterBus bus;
+    std::vector<char> conversion_buffer;
+};
+
+// Picks the file type from the extension: ".wav" is WAV, anything else raw.
+FileType file_type_for_path(const std::string& path);
+#endif
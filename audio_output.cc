@@ -0,0 +1,173 @@
+#include "audio_output.h"
+#include "audio_file.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+MasterBus OutputOptions::master_bus(SampleFormat format) const
+{
+    MasterBus bus(format);
+    bus.gain = gain;
+    bus.clipping = clipping;
+    return bus;
+}
+
+namespace {
+// An output that calls render from a thread of its own. Subclasses say how
+// often and what becomes of the audio; they must call stop() in their
+// destructor, while the thread can still use them.
+class ThreadOutput : public AudioOutput {
+public:
+    void start(Render render) override
+    {
+        stop();
+        stopping = false;
+        ended = false;
+        thread = std::thread([this, render] {
+            play(render);
+            std::lock_guard<std::mutex> lock(mutex);
+            ended = true;
+            ended_changed.notify_all();
+        });
+    }
+    void stop() override
+    {
+        if (thread.joinable()) {
+            stopping = true;
+            thread.join();
+        }
+    }
+    bool wait(double seconds) override
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (seconds <= 0) {
+            ended_changed.wait(lock, [this] { return ended; });
+        } else {
+            ended_changed.wait_for(lock, std::chrono::duration<double>(seconds), [this] { return ended; });
+        }
+        return ended;
+    }
+
+protected:
+    explicit ThreadOutput(const OutputOptions& o)
+        : options(o)
+        , buffer(o.frames_per_buffer)
+        , bus(o.master_bus(SampleFormat::float32))
+        , stopping(false)
+        , ended(false)
+    {
+    }
+    // Calls render until it returns false or stopping is set.
+    virtual void play(const Render& render) = 0;
+
+    const OutputOptions options;
+    std::vector<StereoSample> buffer;
+    // Applied to buffer in place, by outputs that play floats
+    MasterBus bus;
+    std::atomic<bool> stopping;
+
+private:
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ended_changed;
+    bool ended; // play() has returned; guarded by mutex
+};
+
+class NullOutput : public ThreadOutput {
+public:
+    explicit NullOutput(const OutputOptions& o)
+        : ThreadOutput(o)
+    {
+    }
+    ~NullOutput() override { stop(); }
+    const char* name() const override { return "null"; }
+
+private:
+    void play(const Render& render) override
+    {
+        while (!stopping.load(std::memory_order_relaxed) && render(&buffer[0], buffer.size(), false)) {
+            bus.process(&buffer[0], buffer.size(), &buffer[0]);
+        }
+    }
+};
+
+class FileOutput : public ThreadOutput {
+public:
+    FileOutput(const std::string& path, const OutputOptions& o)
+        : ThreadOutput(o)
+        , writer(path, file_type_for_path(path), SampleFormat::int16, o.sample_rate)
+    {
+        // The writer's bus converts too, so the whole stage is done there
+        writer.master_bus() = o.master_bus(SampleFormat::int16);
+    }
+    ~FileOutput() override
+    {
+        stop();
+        writer.close();
+    }
+    const char* name() const override { return "file"; }
+
+private:
+    void play(const Render& render) override
+    {
+        while (!stopping.load(std::memory_order_relaxed) && render(&buffer[0], buffer.size(), false)) {
+            writer.write(&buffer[0], buffer.size());
+        }
+    }
+
+    AudioFileWriter writer;
+};
+
+class PacedOutput : public ThreadOutput {
+public:
+    explicit PacedOutput(const OutputOptions& o)
+        : ThreadOutput(o)
+    {
+    }
+    ~PacedOutput() override { stop(); }
+    const char* name() const override { return "paced"; }
+
+private:
+    void play(const Render& render) override
+    {
+        using clock = std::chrono::steady_clock;
+        const auto period = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(buffer.size()) / options.sample_rate));
+        // Double buffered: each buffer is asked for as the one before starts
+        // playing, and has to be ready when that one ends.
+        auto deadline = clock::now() + period;
+        bool underflow = false;
+        while (!stopping.load(std::memory_order_relaxed) && render(&buffer[0], buffer.size(), underflow)) {
+            bus.process(&buffer[0], buffer.size(), &buffer[0]);
+            const auto now = clock::now();
+            underflow = now > deadline;
+            if (underflow) {
+                // A device that ran dry starts again from now, rather than
+                // trying to catch up on buffers it has already missed
+                deadline = now + period;
+            } else {
+                std::this_thread::sleep_until(deadline);
+                deadline += period;
+            }
+        }
+    }
+};
+}
+
+std::unique_ptr<AudioOutput> make_null_output(const OutputOptions& options)
+{
+    return std::unique_ptr<AudioOutput>(new NullOutput(options));
+}
+
+std::unique_ptr<AudioOutput> make_file_output(const std::string& path, const OutputOptions& options)
+{
+    return std::unique_ptr<AudioOutput>(new FileOutput(path, options));
+}
+
+std::unique_ptr<AudioOutput> make_paced_output(const OutputOptions& options)
+{
+    return std::unique_ptr<AudioOutput>(new PacedOutput(options));
+}
@@ -0,0 +1,57 @@
+#ifndef _AUDIO_OUTPUT_H_
+#define _AUDIO_OUTPUT_H_
+#include "master_bus.h"
+#include "mixer.h"
+#include <functional>
+#include <memory>
+#include <string>
+
+// Where rendered audio goes. An output pulls audio a buffer at a time from a
+// thread of its own, the way a sound card's callback does, so the same
+// rendering code can play through a device, run flat out for throughput
+// tests, write a file or be soak-tested against simulated deadlines on a
+// machine with no sound card.
+// Every output passes what's rendered through a master bus on its way out.
+class AudioOutput {
+public:
+    // Fills out with frames of audio. underflow says whether the output ran
+    // dry before this buffer. Returns false once there's nothing more to
+    // play, which stops the output. Runs on the output's thread, which for a
+    // device is a real-time callback: it must not block or allocate.
+    using Render = std::function<bool(StereoSample* out, size_t frames, bool underflow)>;
+
+    virtual ~AudioOutput() {}
+    // Starts calling render. Throws std::runtime_error if the output can't start.
+    virtual void start(Render render) = 0;
+    // Stops calling render; safe to call when stopped.
+    virtual void stop() = 0;
+    // Waits up to seconds (or for ever, if not positive) for render to end
+    // the stream. Returns true if it has.
+    virtual bool wait(double seconds) = 0;
+    virtual const char* name() const = 0;
+};
+
+struct OutputOptions {
+    int sample_rate = 44100;
+    size_t frames_per_buffer = 1024;
+    // What the master bus does to rendered audio before it goes out
+    float gain = 1;
+    Clipping clipping = Clipping::hard;
+
+    MasterBus master_bus(SampleFormat format) const;
+};
+
+// Calls render as fast as it will go; for throughput tests.
+std::unique_ptr<AudioOutput> make_null_output(const OutputOptions& options);
+// Writes everything rendered to a WAV (by extension) or raw file, as fast as
+// rendering goes. Throws std::runtime_error if the file can't be created.
+std::unique_ptr<AudioOutput> make_file_output(const std::string& path, const OutputOptions& options);
+// Behaves like a device: asks for each buffer when the one before would
+// have finished playing, on a timer. A buffer rendered after the moment it
+// should have started playing counts as an underflow, as it would have made
+// the device run dry.
+std::unique_ptr<AudioOutput> make_paced_output(const OutputOptions& options);
+// The default PortAudio device. Only in builds with PortAudio, which define
+// SONIC_HAVE_PORTAUDIO.
+std::unique_ptr<AudioOutput> make_portaudio_output(const OutputOptions& options);
+#endif
@@ -0,0 +1,168 @@
+#include "job_pool.h"
+#include "module_files.h"
+#include "offline_render.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int usage()
+{
+    fprintf(stderr,
+        "usage: batch [options] <module.it|directory>...\n"
+        "  --threads <n>       worker threads (default: one per core)\n"
+        "  --scaling           render the batch at 1, 2, 4, 8 and one-per-core threads\n"
+        "                      and compare throughput; no files are written\n"
+        "  --out <dir>         write <dir>/<name>.wav for every module (default: discard)\n"
+        "  --rate <hz>         output sample rate (default 44100)\n"
+        "  --format <fmt>      s16, s24 or f32 (default s16)\n"
+        "  --clip <mode>       none, hard or soft: what happens past full scale\n"
+        "                      (default hard; none only matters for f32)\n"
+        "  --dither            add triangular dither when writing s16 or s24\n"
+        "  --interp <mode>     nearest, linear, cubic, sinc8 or sinc16 (default nearest)\n"
+        "  --voices <n>        most voices sounding at once, 1 to 256 (default 256)\n"
+        "  --seconds <n>       stop each song after n seconds\n"
+        "  --quiet             don't print a line per file\n");
+    return 2;
+}
+
+struct BatchStats {
+    size_t rendered = 0;
+    size_t failed = 0;
+    double audio_seconds = 0;
+    double elapsed_seconds = 0;
+};
+
+static BatchStats run_batch(const std::vector<std::string>& modules, size_t threads,
+    const RenderOptions& options, const std::string& out_dir, bool verbose)
+{
+    // Start the biggest files first so the longest songs don't end up
+    // running alone at the end of the batch.
+    std::vector<std::pair<size_t, std::string>> jobs;
+    for (const auto& path : modules) {
+        jobs.emplace_back(file_size(path), path);
+    }
+    std::sort(jobs.begin(), jobs.end(),
+        [](const std::pair<size_t, std::string>& a, const std::pair<size_t, std::string>& b) { return a.first > b.first; });
+
+    BatchStats stats;
+    std::mutex stats_mutex;
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    {
+        WorkStealingPool pool(threads);
+        for (const auto& job : jobs) {
+            const std::string path = job.second;
+            pool.submit([&, path] {
+                const std::string output = out_dir.empty() ? "" : out_dir + "/" + module_basename(path) + ".wav";
+                try {
+                    RenderResult result = render_module(path, output, options);
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    stats.rendered++;
+                    stats.audio_seconds += result.audio_seconds;
+                    if (verbose) {
+                        printf("%s: %.1f s of audio in %.3f s (%.1fx realtime)\n",
+                            path.c_str(), result.audio_seconds, result.elapsed_seconds, result.realtime_factor());
+                    }
+                } catch (const std::runtime_error& e) {
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    stats.failed++;
+                    fprintf(stderr, "batch: %s\n", e.what());
+                }
+            });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    stats.elapsed_seconds = elapsed.count();
+    return stats;
+}
+
+static void print_total(const BatchStats& stats, size_t threads)
+{
+    printf("%zu threads: %zu files (%zu failed), %.1f s of audio in %.3f s: %.1f files/s, %.1fx realtime\n",
+        threads, stats.rendered, stats.failed, stats.audio_seconds, stats.elapsed_seconds,
+        static_cast<double>(stats.rendered) / stats.elapsed_seconds,
+        stats.audio_seconds / stats.elapsed_seconds);
+}
+
+int main(int argc, char* argv[])
+{
+    RenderOptions options;
+    size_t threads = hardware_threads();
+    bool scaling = false;
+    bool verbose = true;
+    std::string out_dir;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--scaling") == 0) {
+            scaling = true;
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            options.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!sample_format_from_name(argv[++i], options.format)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--clip") == 0 && i + 1 < argc) {
+            if (!clipping_from_name(argv[++i], options.clipping)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--dither") == 0) {
+            options.dither = true;
+        } else if (strcmp(argv[i], "--interp") == 0 && i + 1 < argc) {
+            if (!interpolation_from_name(argv[++i], options.interpolation)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            const int voices = atoi(argv[++i]);
+            if (voices < 1 || voices > 256) {
+                return usage();
+            }
+            options.voice_limit = static_cast<size_t>(voices);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            options.max_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            verbose = false;
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    const auto modules = find_modules(inputs);
+    if (modules.empty() || threads == 0 || options.sample_rate <= 0) {
+        return usage();
+    }
+
+    if (!scaling) {
+        BatchStats stats = run_batch(modules, threads, options, out_dir, verbose);
+        print_total(stats, threads);
+        return stats.failed ? 1 : 0;
+    }
+
+    std::vector<size_t> thread_counts = { 1, 2, 4, 8, hardware_threads() };
+    std::sort(thread_counts.begin(), thread_counts.end());
+    thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+    double single_thread_rate = 0;
+    for (size_t n : thread_counts) {
+        BatchStats stats = run_batch(modules, n, options, "", false);
+        print_total(stats, n);
+        const double rate = stats.audio_seconds / stats.elapsed_seconds;
+        if (n == 1) {
+            single_thread_rate = rate;
+        } else if (single_thread_rate > 0) {
+            printf("    speedup over 1 thread: %.2fx\n", rate / single_thread_rate);
+        }
+    }
+    return 0;
+}
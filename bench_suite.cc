@@ -0,0 +1,523 @@
+#include "module_analysis.h"
+#include "offline_render.h"
+#include "player.h"
+#include "stem_render.h"
+#include "synth_module.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#ifndef SONIC_BUILD_TYPE
+#define SONIC_BUILD_TYPE "unknown"
+#endif
+
+#define SAMPLE_RATE (44100)
+#define FRAMES_PER_BUFFER (1024)
+
+// The benchmarks to watch for regressions: small ones timing one hot
+// function each, and whole-song ones over modules generated on the spot.
+// Every benchmark is timed in several batches and reported as the median
+// (and fastest) time per item, so results from different runs and machines
+// can be lined up by name. `make bench` runs this from a Release build.
+
+static int usage()
+{
+    fprintf(stderr,
+        "usage: bench_suite [options]\n"
+        "  --json <file>        write the results as JSON\n"
+        "  --baseline <file>    compare with results written earlier by --json\n"
+        "  --threshold <pct>    slowdown against the baseline that counts as a\n"
+        "                       regression (default 10)\n"
+        "  --filter <text>      only run benchmarks whose name contains text\n"
+        "  --batches <n>        timed batches per benchmark (default 7)\n"
+        "  --batch-ms <n>       shortest time one batch should take (default 20)\n");
+    return 2;
+}
+
+using clock_type = std::chrono::steady_clock;
+
+struct BenchResult {
+    std::string name;
+    std::string unit; // what one item is
+    size_t items = 0; // per batch
+    double ns_median = 0; // per item
+    double ns_min = 0;
+};
+
+struct BenchOptions {
+    std::string filter;
+    size_t batches = 7;
+    double batch_seconds = 0.02;
+};
+
+// Results end up in the checksum so the compiler can't drop the work
+static volatile double sink;
+
+// Times run(), which does some work and returns how many items it did.
+template <typename Body>
+static bool bench(std::vector<BenchResult>& results, const BenchOptions& options, const std::string& name,
+    const char* unit, Body run)
+{
+    if (name.find(options.filter) == std::string::npos) {
+        return false;
+    }
+    auto batch = [&](size_t repeats, size_t& items) {
+        items = 0;
+        auto start = clock_type::now();
+        for (size_t i = 0; i < repeats; i++) {
+            items += run();
+        }
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+    };
+
+    // Warm up, then find how many repeats fill a batch
+    size_t items;
+    size_t repeats = 1;
+    for (double t = batch(repeats, items); t < options.batch_seconds && repeats < (size_t(1) << 30);) {
+        repeats = t > 0 ? std::max(repeats * 2, static_cast<size_t>(static_cast<double>(repeats) * options.batch_seconds / t * 1.2))
+                        : repeats * 16;
+        t = batch(repeats, items);
+    }
+    std::vector<double> per_item(options.batches);
+    for (auto& ns : per_item) {
+        ns = batch(repeats, items) * 1e9 / static_cast<double>(std::max<size_t>(items, 1));
+    }
+    std::sort(per_item.begin(), per_item.end());
+
+    BenchResult r;
+    r.name = name;
+    r.unit = unit;
+    r.items = items;
+    r.ns_median = per_item[per_item.size() / 2];
+    r.ns_min = per_item[0];
+    printf("%-34s %12.2f %12.2f %14.0f  %s\n", r.name.c_str(), r.ns_median, r.ns_min, 1e9 / r.ns_median, unit);
+    fflush(stdout);
+    results.push_back(r);
+    return true;
+}
+
+static Sample make_bench_sample()
+{
+    Sample s;
+    s.wavetable.resize(SAMPLE_RATE);
+    for (size_t i = 0; i < s.wavetable.size(); i++) {
+        s.wavetable[i] = std::sin(static_cast<float>(i) * 0.05f) * 0.5f;
+    }
+    const auto size = static_cast<uint32_t>(s.wavetable.size());
+    s.loop = LoopParams(LoopType::forward, size / 2, size);
+    s.prepare();
+    return s;
+}
+
+static double checksum(const std::vector<StereoSample>& out)
+{
+    return static_cast<double>(out[0].left + out[out.size() - 1].right);
+}
+
+static void micro_benchmarks(std::vector<BenchResult>& results, const BenchOptions& options)
+{
+    const Sample sample = make_bench_sample();
+    std::vector<StereoSample> out(FRAMES_PER_BUFFER);
+
+    const Interpolation modes[] = { Interpolation::nearest, Interpolation::linear, Interpolation::sinc16 };
+    for (auto mode : modes) {
+        AudioChannel channel(SAMPLE_RATE);
+        channel.play(&sample);
+        channel.set_playback_rate(22050.0f * 1.01f);
+        channel.interpolation = mode;
+        bench(results, options, std::string("render_audio/") + interpolation_name(mode), "frame", [&] {
+            render_audio(&channel, &out[0], out.size());
+            sink = checksum(out);
+            return out.size();
+        });
+    }
+
+    // The same wave kept at 16 and 8 bits, converted as it's mixed
+    std::vector<int16_t> wave16(sample.length());
+    std::vector<int8_t> wave8(sample.length());
+    const auto* frames = static_cast<const float*>(sample.frames());
+    for (size_t i = 0; i < sample.length(); i++) {
+        wave16[i] = static_cast<int16_t>(frames[i] * 32767.0f);
+        wave8[i] = static_cast<int8_t>(frames[i] * 127.0f);
+    }
+    Sample native_samples[2];
+    native_samples[0].set_pcm(wave16, false);
+    native_samples[1].set_pcm(wave8, false);
+    for (auto& native : native_samples) {
+        native.loop = sample.loop;
+        native.prepare();
+        AudioChannel channel(SAMPLE_RATE);
+        channel.play(&native);
+        channel.set_playback_rate(22050.0f * 1.01f);
+        channel.interpolation = Interpolation::linear;
+        bench(results, options, std::string("render_audio/linear_") + sample_storage_name(native.storage()), "frame",
+            [&] {
+                render_audio(&channel, &out[0], out.size());
+                sink = checksum(out);
+                return out.size();
+            });
+    }
+
+    const size_t voice_counts[] = { 8, 64, 256 };
+    for (size_t voices : voice_counts) {
+        Mixer mix(256, SAMPLE_RATE);
+        for (size_t i = 0; i < voices; i++) {
+            auto& channel = mix.channel(i * 256 / voices);
+            channel.play(&sample);
+            channel.set_volume(AudioChannel::volume_max / static_cast<float>(voices));
+            channel.set_panning(static_cast<float>(i % 9) / 4.0f - 1.0f);
+            channel.set_playback_rate(22050.0f * (1.0f + static_cast<float>(i) * 0.01f));
+        }
+        bench(results, options, "mixer_render/" + std::to_string(voices) + "_voices", "frame", [&] {
+            mix.render(&out[0], out.size());
+            sink = checksum(out);
+            return out.size();
+        });
+    }
+
+    // The master bus over the last mix, to each format, and with the
+    // costlier settings on
+    struct BusCase {
+        const char* name;
+        SampleFormat format;
+        MixKernel kernel;
+        Clipping clipping;
+        bool dither;
+    };
+    const BusCase bus_cases[] = {
+        { "master_bus/s16", SampleFormat::int16, best_mix_kernel(), Clipping::hard, false },
+        { "master_bus/s16_scalar", SampleFormat::int16, MixKernel::scalar, Clipping::hard, false },
+        { "master_bus/s16_soft_dither", SampleFormat::int16, best_mix_kernel(), Clipping::soft, true },
+        { "master_bus/s24", SampleFormat::int24, best_mix_kernel(), Clipping::hard, false },
+        { "master_bus/s24_dither", SampleFormat::int24, best_mix_kernel(), Clipping::hard, true },
+        { "master_bus/f32", SampleFormat::float32, best_mix_kernel(), Clipping::hard, false },
+    };
+    std::vector<char> converted(out.size() * 2 * sizeof(float));
+    for (const auto& c : bus_cases) {
+        MasterBus bus(c.format, c.kernel);
+        bus.gain = 0.375f;
+        bus.clipping = c.clipping;
+        bus.dither = c.dither;
+        bench(results, options, c.name, "frame", [&] {
+            bus.process(&out[0], out.size(), converted.data());
+            sink = static_cast<double>(converted[0]);
+            return out.size();
+        });
+    }
+
+    SynthModuleParams params;
+    params.patterns = 16;
+    params.channels = 16;
+    params.note_density = 0.5;
+    const auto bytes = make_synth_module(params);
+    const ByteView file(bytes.data(), bytes.size());
+
+    // Straight from the file's table of pattern offsets
+    const auto header = file.read<it_file::header>(0);
+    const size_t offset_table = sizeof header + header.order_num + 4u * (header.instrument_num + header.sample_num);
+    std::vector<uint32_t> pattern_offsets = file.read_vector<uint32_t>(offset_table, header.pattern_num);
+    pattern_offsets.erase(std::remove(pattern_offsets.begin(), pattern_offsets.end(), 0u), pattern_offsets.end());
+    bench(results, options, "unpack_pattern", "pattern", [&] {
+        for (uint32_t offset : pattern_offsets) {
+            sink = static_cast<double>(unpack_pattern(file, offset).row_count());
+        }
+        return pattern_offsets.size();
+    });
+
+    const Module mod = load_module(file);
+    mod.load_all_patterns();
+    PlayerContext player(&mod);
+    bench(results, options, "process_tick", "tick", [&] {
+        const size_t ticks = 1000;
+        for (size_t i = 0; i < ticks; i++) {
+            player.process_tick();
+        }
+        sink = player.current_row;
+        return ticks;
+    });
+
+    // Every channel busy with slides, vibrato, arpeggio and the like
+    SynthModuleParams effect_params;
+    effect_params.patterns = 4;
+    effect_params.channels = 64;
+    effect_params.note_density = 0.3;
+    effect_params.effect_density = 0.9;
+    const auto effect_bytes = make_synth_module(effect_params);
+    const Module effect_mod = load_module(ByteView(effect_bytes.data(), effect_bytes.size()));
+    effect_mod.load_all_patterns();
+    PlayerContext effect_player(&effect_mod);
+    bench(results, options, "process_tick/64ch_effects", "tick", [&] {
+        const size_t ticks = 1000;
+        for (size_t i = 0; i < ticks; i++) {
+            effect_player.process_tick();
+            effect_player.updated_channels = 0;
+        }
+        sink = effect_player.current_row;
+        return ticks;
+    });
+
+    std::vector<PatternEntry> entries;
+    for (size_t p = 0; p < mod.pattern_count(); p++) {
+        const auto pattern = mod.pattern(p);
+        for (size_t r = 0; r < pattern->row_count(); r++) {
+            const auto row = pattern->row(r);
+            for (size_t c = 0; c < row.size(); c++) {
+                entries.push_back(row[c]);
+            }
+        }
+    }
+    bench(results, options, "pattern_entry_to_string", "entry", [&] {
+        size_t length = 0;
+        for (const auto& entry : entries) {
+            // Every character counts, or the compiler builds only the ones used
+            for (char c : entry.to_string()) {
+                length += static_cast<unsigned char>(c);
+            }
+        }
+        sink = static_cast<double>(length);
+        return entries.size();
+    });
+    TextBuffer text;
+    bench(results, options, "pattern_entry_format", "entry", [&] {
+        text.clear();
+        for (const auto& entry : entries) {
+            text.commit(entry.format(text.reserve(PatternEntry::text_length)));
+        }
+        sink = static_cast<double>(text.size());
+        return entries.size();
+    });
+    bench(results, options, "analyze_module", "module", [&] {
+        text.clear();
+        dump_patterns(mod, text);
+        format_stats_json(analyze_module(mod), "song.it", text);
+        sink = static_cast<double>(text.size());
+        return size_t(1);
+    });
+}
+
+static void macro_benchmarks(std::vector<BenchResult>& results, const BenchOptions& options,
+    const std::string& directory)
+{
+    struct Song {
+        const char* name;
+        size_t patterns;
+        size_t channels;
+        Interpolation interpolation;
+        double effect_density;
+    };
+    const Song songs[] = {
+        { "song_render/4ch", 8, 4, Interpolation::nearest, 0 },
+        { "song_render/16ch", 8, 16, Interpolation::nearest, 0 },
+        { "song_render/32ch_linear", 8, 32, Interpolation::linear, 0 },
+        { "song_render/32ch_sinc16", 8, 32, Interpolation::sinc16, 0 },
+        { "song_render/64ch_effects", 4, 64, Interpolation::linear, 0.9 },
+    };
+    for (const auto& song : songs) {
+        SynthModuleParams params;
+        params.patterns = song.patterns;
+        params.channels = song.channels;
+        params.note_density = 0.5;
+        params.effect_density = song.effect_density;
+        const std::string path = directory + "/song.it";
+        write_synth_module(path, params);
+        RenderOptions render;
+        render.interpolation = song.interpolation;
+        // The whole offline path: load, sequence, mix and convert, minus disk writes
+        bench(results, options, song.name, "frame", [&] { return render_module(path, "", render).frames; });
+        unlink(path.c_str());
+    }
+
+    // Every channel of a song to its own stem, in one pass and split in four
+    // as the stems tool would across threads; the split costs a sequencer
+    // and the skipped voices for each extra pass.
+    SynthModuleParams stem_params;
+    stem_params.patterns = 8;
+    stem_params.channels = 16;
+    stem_params.note_density = 0.5;
+    const auto stem_bytes = make_synth_module(stem_params);
+    const Module stem_mod = load_module(ByteView(stem_bytes.data(), stem_bytes.size()));
+    stem_mod.load_all_patterns();
+    const auto stems = find_stems(stem_mod, SongPlayer::StemKey::channel);
+    const std::vector<std::string> no_paths;
+    bench(results, options, "stem_render/16ch", "frame", [&] {
+        return render_stems(stem_mod, stems, no_paths, RenderOptions(), SongPlayer::StemKey::channel).frames;
+    });
+    bench(results, options, "stem_render/16ch_in_4", "frame", [&] {
+        size_t frames = 0;
+        for (size_t first = 0; first < stems.size(); first += 4) {
+            const std::vector<size_t> group(stems.begin() + static_cast<std::ptrdiff_t>(first),
+                stems.begin() + static_cast<std::ptrdiff_t>(std::min(first + 4, stems.size())));
+            frames = render_stems(stem_mod, group, no_paths, RenderOptions(), SongPlayer::StemKey::channel).frames;
+        }
+        return frames;
+    });
+
+    SynthModuleParams params;
+    params.patterns = 64;
+    params.channels = 32;
+    params.samples = 16;
+    params.sixteen_bit = true;
+    params.compressed = true;
+    const std::string path = directory + "/load.it";
+    write_synth_module(path, params);
+    bench(results, options, "module_load", "module", [&] {
+        Module mod = load_module(path);
+        mod.load_all_patterns();
+        sink = static_cast<double>(mod.samples.size());
+        return size_t(1);
+    });
+    unlink(path.c_str());
+}
+
+static std::string json_escape(const std::string& s)
+{
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+// One result per line, which is what read_results() relies on.
+static void write_results(const std::string& path, const std::vector<BenchResult>& results)
+{
+    std::ofstream f(path);
+    if (!f) {
+        throw std::runtime_error("can't write " + path);
+    }
+    char timestamp[32];
+    const time_t now = time(nullptr);
+    strftime(timestamp, sizeof timestamp, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    f << "{\n";
+    f << "  \"timestamp\": \"" << timestamp << "\",\n";
+    f << "  \"build_type\": \"" << SONIC_BUILD_TYPE << "\",\n";
+    f << "  \"compiler\": \"" << json_escape(__VERSION__) << "\",\n";
+    f << "  \"mix_kernel\": \"" << mix_kernel_name(best_mix_kernel()) << "\",\n";
+    f << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        char line[512];
+        snprintf(line, sizeof line,
+            "    {\"name\": \"%s\", \"unit\": \"%s\", \"items_per_batch\": %zu, \"ns_per_item\": %.4f, "
+            "\"ns_per_item_min\": %.4f, \"items_per_second\": %.1f}%s\n",
+            json_escape(r.name).c_str(), r.unit.c_str(), r.items, r.ns_median, r.ns_min, 1e9 / r.ns_median,
+            i + 1 < results.size() ? "," : "");
+        f << line;
+    }
+    f << "  ]\n}\n";
+    if (!f) {
+        throw std::runtime_error("can't write " + path);
+    }
+}
+
+// Reads back the name and median of each result from a file write_results() wrote.
+static std::vector<BenchResult> read_results(const std::string& path)
+{
+    std::ifstream f(path);
+    if (!f) {
+        throw std::runtime_error("can't read " + path);
+    }
+    std::vector<BenchResult> results;
+    std::string line;
+    while (std::getline(f, line)) {
+        const char* name = strstr(line.c_str(), "\"name\": \"");
+        const char* ns = strstr(line.c_str(), "\"ns_per_item\": ");
+        if (!name || !ns) {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        BenchResult r;
+        r.name.assign(name, strcspn(name, "\""));
+        r.ns_median = atof(ns + strlen("\"ns_per_item\": "));
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Returns how many benchmarks got slower by more than threshold percent
+static size_t compare_results(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& results,
+    double threshold)
+{
+    size_t regressions = 0;
+    printf("\n%-34s %12s %12s %9s\n", "vs baseline", "was ns", "now ns", "change");
+    for (const auto& r : results) {
+        auto old = std::find_if(baseline.begin(), baseline.end(),
+            [&](const BenchResult& b) { return b.name == r.name; });
+        if (old == baseline.end() || old->ns_median <= 0) {
+            printf("%-34s %12s %12.2f %9s\n", r.name.c_str(), "-", r.ns_median, "new");
+            continue;
+        }
+        const double change = (r.ns_median / old->ns_median - 1) * 100;
+        const bool regressed = change > threshold;
+        regressions += regressed;
+        printf("%-34s %12.2f %12.2f %+8.1f%%%s\n", r.name.c_str(), old->ns_median, r.ns_median, change,
+            regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    std::string json_path;
+    std::string baseline_path;
+    double threshold = 10;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && has_value) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--batches") == 0 && has_value) {
+            options.batches = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "--batch-ms") == 0 && has_value) {
+            options.batch_seconds = atof(argv[++i]) / 1000;
+        } else {
+            return usage();
+        }
+    }
+
+#ifndef NDEBUG
+    fprintf(stderr, "bench_suite: built without NDEBUG (%s); numbers won't be representative\n", SONIC_BUILD_TYPE);
+#endif
+    char dir_template[] = "/tmp/bench_suite.XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        fprintf(stderr, "bench_suite: can't create a directory for the test modules\n");
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    try {
+        printf("%-34s %12s %12s %14s\n", "benchmark", "median ns", "min ns", "items/s");
+        micro_benchmarks(results, options);
+        macro_benchmarks(results, options, dir_template);
+        rmdir(dir_template);
+        if (!json_path.empty()) {
+            write_results(json_path, results);
+        }
+        if (!baseline_path.empty() && compare_results(read_results(baseline_path), results, threshold)) {
+            return 1;
+        }
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr, "bench_suite: %s\n", e.what());
+        rmdir(dir_template);
+        return 1;
+    }
+    return 0;
+}
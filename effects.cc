@@ -0,0 +1,699 @@
+#include "player.h"
+#include <algorithm>
+
+// Impulse Tracker's effects. Each effect is a pair of handlers in a table
+// indexed by its type: one for the row's first tick, which also fills in
+// remembered parameters, and one for the ticks after, if the effect works on
+// those. Only channels with an effect of the second kind running are visited
+// on the ticks between rows.
+//
+// Pitch is in the Amiga-style periods of PatternEntry::Note::period(), four
+// to a period of the original, as IT counts them without linear slides.
+
+namespace {
+using Type = PatternEntry::Command::Type;
+using HostChannel = PlayerContext::HostChannel;
+
+// Runs on the row's first tick, with param the one in the pattern. Returns
+// true if the effect goes on to the following ticks, setting param to what
+// those should run with.
+using RowEffect = bool (*)(PlayerContext& p, size_t channel, uint8_t& param);
+// Runs on each tick after the first
+using TickEffect = void (*)(PlayerContext& p, size_t channel, uint8_t param);
+
+struct EffectHandlers {
+    RowEffect row;
+    TickEffect tick;
+};
+
+const int lowest_period = 32;
+const int highest_period = 0xFFFF;
+
+int clamp(int value, int low, int high)
+{
+    return value < low ? low : value > high ? high : value;
+}
+
+void touch(PlayerContext& p, size_t c)
+{
+    p.updated_channels |= uint64_t(1) << c;
+}
+
+// Sets value, telling the player if that's a change
+void update(PlayerContext& p, size_t c, int& value, int new_value)
+{
+    if (value != new_value) {
+        value = new_value;
+        touch(p, c);
+    }
+}
+
+// A parameter of 0 means the last one given
+uint8_t remember(uint8_t& memory, uint8_t param)
+{
+    if (param) {
+        memory = param;
+    }
+    return memory;
+}
+
+// The same, but for each half of the parameter on its own (speed and depth)
+uint8_t remember_nybbles(uint8_t& memory, uint8_t param)
+{
+    if (param & 0xF0) {
+        memory = static_cast<uint8_t>((memory & 0x0F) | (param & 0xF0));
+    }
+    if (param & 0x0F) {
+        memory = static_cast<uint8_t>((memory & 0xF0) | (param & 0x0F));
+    }
+    return memory;
+}
+
+// Slides as D takes them: x0 up and 0x down on each tick after the first,
+// xF up and Fx down on the first tick only. Returns the step for this tick.
+int slide_step(uint8_t param, bool first_tick)
+{
+    const int up = param >> 4;
+    const int down = param & 15;
+    if (down == 0xF && up) {
+        return first_tick ? up : 0;
+    }
+    if (up == 0xF && down) {
+        return first_tick ? -down : 0;
+    }
+    if (down == 0) {
+        return first_tick ? 0 : up;
+    }
+    if (up == 0) {
+        return first_tick ? 0 : -down;
+    }
+    return 0;
+}
+
+bool slides_after_first_tick(uint8_t param)
+{
+    return slide_step(param, false) != 0;
+}
+
+// Sine, ramp down, square and (repeatably) random waves, -64 to 64, over
+// positions 0-255.
+int waveform(uint8_t type, uint8_t position)
+{
+    static const int8_t quarter_sine[65] = {
+        0, 2, 3, 5, 6, 8, 9, 11, 12, 14, 16, 17, 19, 20, 22, 23, 24, 26, 27, 29, 30, 32,
+        33, 34, 36, 37, 38, 39, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54,
+        55, 56, 56, 57, 58, 59, 59, 60, 60, 61, 61, 62, 62, 62, 63, 63, 63, 64, 64, 64,
+        64, 64, 64
+    };
+    switch (type & 3) {
+    case 1:
+        return 64 - position / 2;
+    case 2:
+        return position < 128 ? 64 : -64;
+    case 3:
+        return static_cast<int>((position * 2654435761u) >> 24) / 2 - 64;
+    default:
+        if (position < 64) {
+            return quarter_sine[position];
+        }
+        if (position < 128) {
+            return quarter_sine[128 - position];
+        }
+        if (position < 192) {
+            return -quarter_sine[position - 128];
+        }
+        return -quarter_sine[256 - position];
+    }
+}
+
+// Moves an oscillator on by speed (the high half of param) and returns where
+// its wave is, scaled by depth (the low half).
+int oscillate(uint8_t& position, uint8_t waveform_type, uint8_t param)
+{
+    const int value = waveform(waveform_type, position) * (param & 15);
+    position = static_cast<uint8_t>(position + (param >> 4) * 4);
+    return value;
+}
+
+void slide_volume(PlayerContext& p, size_t c, int step)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.volume, clamp(host.volume + step, 0, 64));
+}
+
+void slide_period(PlayerContext& p, size_t c, int step)
+{
+    auto& host = p.host_channels[c];
+    if (host.period > 0) {
+        update(p, c, host.period, clamp(host.period + step, lowest_period, highest_period));
+    }
+}
+
+// None, Z (MIDI macros) and anything unknown
+bool ignore(PlayerContext&, size_t, uint8_t&)
+{
+    return false;
+}
+
+// A
+bool set_speed(PlayerContext& p, size_t, uint8_t& param)
+{
+    if (param) {
+        p.ticks_per_row = param;
+    }
+    return false;
+}
+
+// B
+bool jump_to_order(PlayerContext& p, size_t, uint8_t& param)
+{
+    p.jump_order = param;
+    return false;
+}
+
+// C: the row number is the parameter as it stands, in hex
+bool pattern_break(PlayerContext& p, size_t, uint8_t& param)
+{
+    p.break_row = param;
+    p.loop_back = false;
+    return false;
+}
+
+// D
+bool volume_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember(p.host_channels[c].effects.volume_slide, param);
+    slide_volume(p, c, slide_step(param, true));
+    return slides_after_first_tick(param);
+}
+
+void volume_slide_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    slide_volume(p, c, slide_step(param, false));
+}
+
+// E and F share a memory. Ex* slides on every tick after the first, EFx
+// slides x on the first only, and EEx a quarter of that.
+bool portamento(PlayerContext& p, size_t c, uint8_t& param, int direction)
+{
+    param = remember(p.host_channels[c].effects.portamento, param);
+    if (param >> 4 == 0xF) {
+        slide_period(p, c, direction * 4 * (param & 15));
+        return false;
+    }
+    if (param >> 4 == 0xE) {
+        slide_period(p, c, direction * (param & 15));
+        return false;
+    }
+    return true;
+}
+
+bool portamento_down(PlayerContext& p, size_t c, uint8_t& param)
+{
+    return portamento(p, c, param, 1);
+}
+
+void portamento_down_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    slide_period(p, c, 4 * param);
+}
+
+bool portamento_up(PlayerContext& p, size_t c, uint8_t& param)
+{
+    return portamento(p, c, param, -1);
+}
+
+void portamento_up_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    slide_period(p, c, -4 * param);
+}
+
+// G: slides towards the note given with it, which play_entry() made the
+// target rather than playing.
+bool tone_portamento(PlayerContext& p, size_t c, uint8_t& param)
+{
+    auto& effects = p.host_channels[c].effects;
+    param = remember(effects.tone_portamento, param);
+    return effects.target_period > 0;
+}
+
+void tone_portamento_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    const int target = host.effects.target_period;
+    if (host.period <= 0 || target <= 0) {
+        return;
+    }
+    const int step = 4 * param;
+    update(p, c, host.period, host.period < target ? std::min(host.period + step, target)
+                                                   : std::max(host.period - step, target));
+}
+
+// H and U run every tick, the first included, so held vibrato doesn't snap
+// back to the note at each row.
+void vibrato_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.vibrato, oscillate(host.effects.vibrato_position, host.effects.vibrato_waveform, param) >> 4);
+}
+
+void fine_vibrato_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.vibrato, oscillate(host.effects.vibrato_position, host.effects.vibrato_waveform, param) >> 6);
+}
+
+bool vibrato(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember_nybbles(p.host_channels[c].effects.vibrato, param);
+    vibrato_tick(p, c, param);
+    return true;
+}
+
+bool fine_vibrato(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember_nybbles(p.host_channels[c].effects.vibrato, param);
+    fine_vibrato_tick(p, c, param);
+    return true;
+}
+
+// I: on for x ticks, off for y, counting on from row to row
+void tremor_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    const int on = (param >> 4) ? param >> 4 : 1;
+    const int off = (param & 15) ? param & 15 : 1;
+    auto& ticks = host.effects.tremor_ticks;
+    ticks = static_cast<uint8_t>(ticks + 1 < on + off ? ticks + 1 : 0);
+    const bool muted = ticks >= on;
+    if (host.muted != muted) {
+        host.muted = muted;
+        touch(p, c);
+    }
+}
+
+bool tremor(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember(p.host_channels[c].effects.tremor, param);
+    tremor_tick(p, c, param);
+    return true;
+}
+
+// J: the note, then x semitones up, then y, over and over
+bool arpeggio(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember(p.host_channels[c].effects.arpeggio, param);
+    return true;
+}
+
+void arpeggio_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    const int step = p.row_tick % 3;
+    update(p, c, p.host_channels[c].arpeggio, step == 0 ? 0 : step == 1 ? param >> 4 : param & 15);
+}
+
+// K and L: vibrato and tone portamento as last given, with a volume slide
+bool vibrato_volume_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    vibrato_tick(p, c, p.host_channels[c].effects.vibrato);
+    volume_slide(p, c, param);
+    return true;
+}
+
+void vibrato_volume_slide_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    vibrato_tick(p, c, p.host_channels[c].effects.vibrato);
+    volume_slide_tick(p, c, param);
+}
+
+bool tone_portamento_volume_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    volume_slide(p, c, param);
+    return true;
+}
+
+void tone_portamento_volume_slide_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    tone_portamento_tick(p, c, p.host_channels[c].effects.tone_portamento);
+    volume_slide_tick(p, c, param);
+}
+
+// M and N
+bool set_channel_volume(PlayerContext& p, size_t c, uint8_t& param)
+{
+    if (param <= 64) {
+        update(p, c, p.host_channels[c].channel_volume, param);
+    }
+    return false;
+}
+
+void channel_volume_slide_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.channel_volume, clamp(host.channel_volume + slide_step(param, false), 0, 64));
+}
+
+bool channel_volume_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    auto& host = p.host_channels[c];
+    param = remember(host.effects.channel_volume_slide, param);
+    update(p, c, host.channel_volume, clamp(host.channel_volume + slide_step(param, true), 0, 64));
+    return slides_after_first_tick(param);
+}
+
+// O: only for a note on the same row, in steps of 256 frames
+bool sample_offset(PlayerContext& p, size_t c, uint8_t& param)
+{
+    auto& host = p.host_channels[c];
+    param = remember(host.effects.sample_offset, param);
+    if (host.new_note) {
+        host.sample_offset = param * 256;
+    }
+    return false;
+}
+
+// P: as D, with up meaning left
+int slide_panning_step(const HostChannel& host, int step)
+{
+    const int panning = host.panning > 64 ? 32 : host.panning; // surround slides from the centre
+    return clamp(panning - step, 0, 64);
+}
+
+bool panning_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    auto& host = p.host_channels[c];
+    param = remember(host.effects.panning_slide, param);
+    const int step = slide_step(param, true);
+    if (step) {
+        update(p, c, host.panning, slide_panning_step(host, step));
+    }
+    return slides_after_first_tick(param);
+}
+
+void panning_slide_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.panning, slide_panning_step(host, slide_step(param, false)));
+}
+
+// Q: restarts the note every y ticks, changing its volume by x
+void retrigger_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    const int interval = (param & 15) ? param & 15 : 1;
+    if (++host.effects.retrigger_ticks < interval || host.period <= 0) {
+        return;
+    }
+    host.effects.retrigger_ticks = 0;
+    const int v = host.volume;
+    switch (param >> 4) {
+    case 1: case 2: case 3: case 4: case 5:
+        host.volume = std::max(v - (1 << ((param >> 4) - 1)), 0);
+        break;
+    case 6:
+        host.volume = v * 2 / 3;
+        break;
+    case 7:
+        host.volume = v / 2;
+        break;
+    case 9: case 10: case 11: case 12: case 13:
+        host.volume = std::min(v + (1 << ((param >> 4) - 9)), 64);
+        break;
+    case 14:
+        host.volume = std::min(v * 3 / 2, 64);
+        break;
+    case 15:
+        host.volume = std::min(v * 2, 64);
+        break;
+    default:
+        break;
+    }
+    host.new_note = true;
+    host.retrigger = true;
+    host.sample_offset = 0;
+    touch(p, c);
+}
+
+bool retrigger(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember(p.host_channels[c].effects.retrigger, param);
+    return true;
+}
+
+// R, a vibrato of the volume, and Y, of the panning
+void tremolo_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.tremolo, oscillate(host.effects.tremolo_position, host.effects.tremolo_waveform, param) >> 5);
+}
+
+bool tremolo(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember_nybbles(p.host_channels[c].effects.tremolo, param);
+    tremolo_tick(p, c, param);
+    return true;
+}
+
+void panbrello_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    update(p, c, host.panbrello, oscillate(host.effects.panbrello_position, host.effects.panbrello_waveform, param) >> 5);
+}
+
+bool panbrello(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember_nybbles(p.host_channels[c].effects.panbrello, param);
+    panbrello_tick(p, c, param);
+    return true;
+}
+
+// S: the high half picks what the low half does. Only SCx (note cut) and
+// SDx (note delay) go on after the first tick.
+bool special(PlayerContext& p, size_t c, uint8_t& param)
+{
+    auto& host = p.host_channels[c];
+    auto& effects = host.effects;
+    param = remember(effects.special, param);
+    const uint8_t x = param & 15;
+    switch (param >> 4) {
+    case 0x3:
+        effects.vibrato_waveform = x;
+        break;
+    case 0x4:
+        effects.tremolo_waveform = x;
+        break;
+    case 0x5:
+        effects.panbrello_waveform = x;
+        break;
+    case 0x6:
+        p.tick_delay = static_cast<uint8_t>(p.tick_delay + x);
+        break;
+    case 0x8:
+        update(p, c, host.panning, (x * 64 + 7) / 15);
+        break;
+    case 0x9:
+        if (x == 1) {
+            update(p, c, host.panning, 100);
+        }
+        break;
+    case 0xB: // pattern loop
+        if (x == 0) {
+            effects.loop_row = p.current_row;
+            break;
+        }
+        if (effects.loops_left == 0) {
+            effects.loops_left = x;
+        } else if (--effects.loops_left == 0) {
+            effects.loop_row = static_cast<uint8_t>(p.current_row + 1);
+            break;
+        }
+        p.break_row = effects.loop_row;
+        p.loop_back = true;
+        break;
+    case 0xC:
+        effects.note_cut_tick = x ? x : 1;
+        return true;
+    case 0xD:
+        effects.note_delay_tick = x;
+        return x > 0;
+    case 0xE:
+        if (p.row_delay == 0) {
+            p.row_delay = x;
+        }
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+void special_tick(PlayerContext& p, size_t c, uint8_t param)
+{
+    auto& host = p.host_channels[c];
+    if (param >> 4 == 0xC && p.row_tick == host.effects.note_cut_tick) {
+        host.note_cut = true;
+        touch(p, c);
+    } else if (param >> 4 == 0xD && p.row_tick == host.effects.note_delay_tick) {
+        p.play_entry(c, host.effects.delayed_note, false);
+    }
+}
+
+// T: 0x20 and up sets the tempo; T0x slides it down and T1x up
+bool set_tempo(PlayerContext& p, size_t c, uint8_t& param)
+{
+    if (param >= 0x20) {
+        p.tempo = param;
+        return false;
+    }
+    param = remember(p.host_channels[c].effects.tempo_slide, param);
+    return true;
+}
+
+void tempo_slide_tick(PlayerContext& p, size_t, uint8_t param)
+{
+    const int step = param >> 4 ? param & 15 : -(param & 15);
+    p.tempo = static_cast<uint8_t>(clamp(p.tempo + step, 32, 255));
+}
+
+// V and W change the volume of every channel
+void set_global(PlayerContext& p, int volume)
+{
+    volume = clamp(volume, 0, 128);
+    if (volume != p.global_volume) {
+        p.global_volume = static_cast<uint8_t>(volume);
+        p.updated_channels = ~uint64_t(0);
+    }
+}
+
+bool set_global_volume(PlayerContext& p, size_t, uint8_t& param)
+{
+    if (param <= 128) {
+        set_global(p, param);
+    }
+    return false;
+}
+
+bool global_volume_slide(PlayerContext& p, size_t c, uint8_t& param)
+{
+    param = remember(p.host_channels[c].effects.global_volume_slide, param);
+    set_global(p, p.global_volume + slide_step(param, true));
+    return slides_after_first_tick(param);
+}
+
+void global_volume_slide_tick(PlayerContext& p, size_t, uint8_t param)
+{
+    set_global(p, p.global_volume + slide_step(param, false));
+}
+
+// X and the volume column's panning
+bool set_panning(PlayerContext& p, size_t c, uint8_t& param)
+{
+    update(p, c, p.host_channels[c].panning, param <= 64 ? param : 64);
+    return false;
+}
+
+// The volume column's volume. A note it comes with already has it, from
+// play_entry(); this is for rows without one.
+bool set_volume(PlayerContext& p, size_t c, uint8_t& param)
+{
+    update(p, c, p.host_channels[c].volume, param <= 64 ? param : 64);
+    return false;
+}
+
+const EffectHandlers effect_table[] = {
+    { ignore, nullptr }, // none
+    { set_speed, nullptr },
+    { jump_to_order, nullptr },
+    { pattern_break, nullptr },
+    { volume_slide, volume_slide_tick },
+    { portamento_down, portamento_down_tick },
+    { portamento_up, portamento_up_tick },
+    { tone_portamento, tone_portamento_tick },
+    { vibrato, vibrato_tick },
+    { tremor, tremor_tick },
+    { arpeggio, arpeggio_tick },
+    { vibrato_volume_slide, vibrato_volume_slide_tick },
+    { tone_portamento_volume_slide, tone_portamento_volume_slide_tick },
+    { set_channel_volume, nullptr },
+    { channel_volume_slide, channel_volume_slide_tick },
+    { sample_offset, nullptr },
+    { panning_slide, panning_slide_tick },
+    { retrigger, retrigger_tick },
+    { tremolo, tremolo_tick },
+    { special, special_tick },
+    { set_tempo, tempo_slide_tick },
+    { fine_vibrato, fine_vibrato_tick },
+    { set_global_volume, nullptr },
+    { global_volume_slide, global_volume_slide_tick },
+    { set_panning, nullptr },
+    { panbrello, panbrello_tick },
+    { ignore, nullptr }, // midi_macro
+    { set_volume, nullptr },
+    { ignore, nullptr }, // unknown
+};
+static_assert(sizeof effect_table / sizeof effect_table[0] == static_cast<size_t>(Type::count),
+    "one entry per effect type");
+}
+
+int PlayerContext::HostChannel::final_period() const
+{
+    // 2^(-n/12) in 16.16 fixed point: n semitones up
+    static const int semitone_factors[16] = {
+        65536, 61858, 58386, 55109, 52016, 49097, 46341, 43740,
+        41285, 38968, 36781, 34716, 32768, 30929, 29193, 27554
+    };
+    const int p = arpeggio ? static_cast<int>(static_cast<int64_t>(period) * semitone_factors[arpeggio & 15] >> 16)
+                           : period;
+    return std::max(p + vibrato, 1);
+}
+
+int PlayerContext::HostChannel::final_volume() const
+{
+    return muted ? 0 : clamp(volume + tremolo, 0, 64);
+}
+
+int PlayerContext::HostChannel::final_panning() const
+{
+    return panning > 64 ? panning : clamp(panning + panbrello, 0, 64);
+}
+
+void PlayerContext::start_effect(size_t c, size_t column, const PatternEntry::Command& command)
+{
+    const auto& handlers = effect_table[static_cast<size_t>(command.type())];
+    uint8_t param = command.param();
+    if (handlers.row(*this, c, param) && handlers.tick) {
+        host_channels[c].effects.running[column] = PatternEntry::Command(command.type(), param);
+        running_effects |= uint64_t(1) << c;
+    }
+}
+
+void PlayerContext::stop_effects()
+{
+    for (uint64_t channels = running_effects; channels; channels &= channels - 1) {
+        const auto c = static_cast<size_t>(__builtin_ctzll(channels));
+        auto& host = host_channels[c];
+        host.effects.running.fill(PatternEntry::Command());
+        if (host.vibrato || host.arpeggio || host.tremolo || host.panbrello || host.muted) {
+            host.vibrato = 0;
+            host.arpeggio = 0;
+            host.tremolo = 0;
+            host.panbrello = 0;
+            host.muted = false;
+            touch(*this, c);
+        }
+    }
+    running_effects = 0;
+}
+
+void PlayerContext::run_effects()
+{
+    for (uint64_t channels = running_effects; channels; channels &= channels - 1) {
+        const auto c = static_cast<size_t>(__builtin_ctzll(channels));
+        for (const auto& command : host_channels[c].effects.running) {
+            const auto tick = effect_table[static_cast<size_t>(command.type())].tick;
+            if (tick) {
+                tick(*this, c, command.param());
+            }
+        }
+    }
+}
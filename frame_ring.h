@@ -0,0 +1,82 @@
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+#include "mixer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+// A ring of audio frames between one thread rendering and one thread
+// playing. Like SpscQueue, but sized at run time and moving runs of frames
+// rather than single items: the producer renders straight into the ring,
+// and the consumer copies out as many frames as it needs in one go. Both
+// sides are wait-free.
+class FrameRing {
+public:
+    // Holds at least min_capacity frames.
+    explicit FrameRing(size_t min_capacity)
+        : frames(round_up(min_capacity))
+        , mask(frames.size() - 1)
+        , head(0)
+        , tail(0)
+    {
+    }
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Producer side. The free frames that follow each other in memory from
+    // the next one to write, up to max; returns how many there are.
+    size_t writable(StereoSample*& first, size_t max)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t free_frames = frames.size() - (t - head.load(std::memory_order_acquire));
+        const size_t to_end = frames.size() - (t & mask);
+        first = &frames[t & mask];
+        return std::min(std::min(free_frames, to_end), max);
+    }
+    // Producer side; hands over the first n frames writable() gave.
+    void commit(size_t n)
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Consumer side. Copies up to count frames into out and returns how many.
+    size_t read(StereoSample* out, size_t count)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        const size_t n = std::min(count, tail.load(std::memory_order_acquire) - h);
+        const size_t start = h & mask;
+        const size_t first = std::min(n, frames.size() - start);
+        std::memcpy(out, &frames[start], first * sizeof(StereoSample));
+        std::memcpy(out + first, &frames[0], (n - first) * sizeof(StereoSample));
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // Either side; only a snapshot while the other side is running.
+    size_t fill() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    size_t capacity() const { return frames.size(); }
+
+private:
+    static size_t round_up(size_t n)
+    {
+        size_t capacity = 1;
+        while (capacity < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    static const size_t cache_line = 64;
+
+    std::vector<StereoSample> frames;
+    const size_t mask;
+    // Only ever grow; the frame is the index modulo the capacity. Padded
+    // apart, as each is written by a different thread.
+    char padding[cache_line];
+    std::atomic<size_t> head; // next frame to read, written by the consumer
+    char consumer_padding[cache_line - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail; // next frame to write, written by the producer
+    char producer_padding[cache_line - sizeof(std::atomic<size_t>)];
+};
+#endif
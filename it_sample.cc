@@ -0,0 +1,259 @@
+#include "it_sample.h"
+#include "player.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+static_assert(sizeof(it_file::sample_header) == 0x50, "IT sample headers are 0x50 bytes");
+
+namespace {
+// Reads little-endian bit fields, least significant bit first, keeping up to
+// 64 bits buffered so most reads are a shift and a mask.
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size)
+        : cursor(data)
+        , end(data + size)
+        , buffer(0)
+        , bits(0)
+    {
+    }
+    // Returns false once the data is exhausted.
+    bool read(unsigned width, uint32_t& value)
+    {
+        if (bits < width) {
+            refill();
+            if (bits < width) {
+                return false;
+            }
+        }
+        value = static_cast<uint32_t>(buffer & ((uint64_t(1) << width) - 1));
+        buffer >>= width;
+        bits -= width;
+        return true;
+    }
+
+private:
+    void refill()
+    {
+        if (end - cursor >= 8) {
+            uint64_t word;
+            std::memcpy(&word, cursor, sizeof word);
+            buffer |= word << bits;
+            cursor += (63 - bits) >> 3;
+            bits |= 56;
+            return;
+        }
+        while (bits <= 56 && cursor < end) {
+            buffer |= uint64_t(*cursor++) << bits;
+            bits += 8;
+        }
+    }
+
+    const uint8_t* cursor;
+    const uint8_t* end;
+    uint64_t buffer;
+    unsigned bits;
+};
+
+// The two compressed formats differ only in their sizes, which live here.
+template <typename T>
+struct CompressionTraits;
+
+template <>
+struct CompressionTraits<int8_t> {
+    static const size_t block_samples = 0x8000;
+    static const unsigned max_width = 9; // widths above the sample size are "change width" markers
+    static const unsigned width_change_bits = 3;
+    static const uint32_t border_offset = 4;
+};
+
+template <>
+struct CompressionTraits<int16_t> {
+    static const size_t block_samples = 0x4000;
+    static const unsigned max_width = 17;
+    static const unsigned width_change_bits = 4;
+    static const uint32_t border_offset = 8;
+};
+
+// Decodes one block. Returns false if the bit stream ends early.
+template <typename T>
+bool decompress_block(BitReader& bits, T* out, size_t count, bool it215)
+{
+    using Traits = CompressionTraits<T>;
+    const unsigned sample_bits = Traits::max_width - 1;
+    unsigned width = Traits::max_width;
+    T d1 = 0;
+    T d2 = 0;
+    size_t i = 0;
+    while (i < count) {
+        uint32_t value;
+        if (width == 0 || width > Traits::max_width || !bits.read(width, value)) {
+            return false;
+        }
+        if (width < 7) {
+            // Method 1: a single reserved value, followed by the new width
+            if (value == uint32_t(1) << (width - 1)) {
+                if (!bits.read(Traits::width_change_bits, value)) {
+                    return false;
+                }
+                value += 1;
+                width = value < width ? value : value + 1;
+                continue;
+            }
+        } else if (width < Traits::max_width) {
+            // Method 2: a band of values just below the top of the range
+            const uint32_t border = (((uint32_t(1) << sample_bits) - 1) >> (Traits::max_width - width)) - Traits::border_offset;
+            if (value > border && value <= border + 2 * Traits::border_offset) {
+                value -= border;
+                width = value < width ? value : value + 1;
+                continue;
+            }
+        } else if (value & (uint32_t(1) << sample_bits)) {
+            // Method 3: the top bit set
+            width = (value + 1) & 0xFF;
+            continue;
+        }
+
+        // Sign extend the delta from its width
+        int32_t delta;
+        if (width < sample_bits) {
+            const unsigned shift = 32 - width;
+            delta = static_cast<int32_t>(value << shift) >> shift;
+        } else {
+            delta = static_cast<T>(value);
+        }
+        d1 = static_cast<T>(d1 + delta);
+        d2 = static_cast<T>(d2 + d1);
+        out[i++] = it215 ? d2 : d1;
+    }
+    return true;
+}
+
+template <typename T>
+size_t decompress(const ByteView& data, T* out, size_t count, bool it215)
+{
+    const size_t block_samples = CompressionTraits<T>::block_samples;
+    size_t offset = 0;
+    while (count) {
+        const size_t block = std::min(count, block_samples);
+        bool complete = false;
+        if (data.contains(offset, 2)) {
+            const size_t length = data.read<uint16_t>(offset);
+            offset += 2;
+            const size_t available = std::min(length, data.size() - offset);
+            BitReader bits(data.data() + offset, available);
+            complete = decompress_block(bits, out, block, it215);
+            offset += available;
+        }
+        if (!complete) {
+            std::fill(out, out + count, T(0));
+            return offset;
+        }
+        out += block;
+        count -= block;
+    }
+    return offset;
+}
+
+// Converts one channel of plain PCM to signed integers. Returns bytes read.
+template <typename T>
+size_t read_pcm(const ByteView& data, T* out, size_t count, uint8_t convert)
+{
+    const size_t available = std::min(count, data.size() / sizeof(T));
+    const uint8_t* bytes = data.data();
+    for (size_t i = 0; i < available; i++) {
+        uint32_t raw = bytes[i * sizeof(T)];
+        if (sizeof(T) == 2) {
+            const uint32_t other = bytes[i * sizeof(T) + 1];
+            raw = convert & it_file::sample_convert::big_endian ? (raw << 8) | other : raw | (other << 8);
+        }
+        if (!(convert & it_file::sample_convert::is_signed)) {
+            raw ^= uint32_t(1) << (8 * sizeof(T) - 1);
+        }
+        out[i] = static_cast<T>(raw);
+    }
+    if (convert & it_file::sample_convert::delta) {
+        T accumulator = 0;
+        for (size_t i = 0; i < available; i++) {
+            accumulator = static_cast<T>(accumulator + out[i]);
+            out[i] = accumulator;
+        }
+    }
+    std::fill(out + available, out + count, T(0));
+    return available * sizeof(T);
+}
+
+template <typename T>
+void load_sample_data(const ByteView& data, const it_file::sample_header& header, Sample& sample)
+{
+    const bool stereo = header.flags & it_file::sample_flags::stereo;
+    const size_t length = header.length;
+    std::vector<T> pcm(length * (stereo ? 2 : 1));
+    size_t offset = 0;
+    for (size_t channel = 0; channel < (stereo ? 2u : 1u); channel++) {
+        const ByteView rest = data.subview(std::min(offset, data.size()), data.size() - std::min(offset, data.size()));
+        T* out = &pcm[channel * length];
+        if (header.flags & it_file::sample_flags::compressed) {
+            offset += decompress(rest, out, length, header.convert & it_file::sample_convert::delta);
+        } else {
+            offset += read_pcm(rest, out, length, header.convert);
+        }
+    }
+
+    // Kept at their own width; stereo channels are stored one after the
+    // other in the file and interleaved for the mixer
+    if (stereo) {
+        std::vector<T> frames(pcm.size());
+        for (size_t i = 0; i < length; i++) {
+            frames[2 * i] = pcm[i];
+            frames[2 * i + 1] = pcm[length + i];
+        }
+        pcm.swap(frames);
+    }
+    sample.set_pcm(std::move(pcm), stereo);
+}
+}
+
+size_t decompress_it_sample(const ByteView& data, int8_t* out, size_t count, bool it215)
+{
+    return decompress(data, out, count, it215);
+}
+
+size_t decompress_it_sample(const ByteView& data, int16_t* out, size_t count, bool it215)
+{
+    return decompress(data, out, count, it215);
+}
+
+Sample load_sample(const ByteView& file, size_t header_offset, std::string* name)
+{
+    const auto header = file.read<it_file::sample_header>(header_offset);
+    Sample sample;
+    if (name) {
+        *name = std::string(header.sample_name, strnlen(header.sample_name, sizeof header.sample_name));
+    }
+    sample.default_volume = std::min<uint8_t>(header.default_volume, 64);
+    sample.global_volume = std::min<uint8_t>(header.global_volume, 64);
+    if (header.c5_speed) {
+        sample.c5_speed = static_cast<float>(header.c5_speed);
+    }
+    if (!(header.flags & it_file::sample_flags::present) || header.length == 0
+        || header.sample_pointer >= file.size()) {
+        return sample;
+    }
+
+    const ByteView data = file.subview(header.sample_pointer, file.size() - header.sample_pointer);
+    if (header.flags & it_file::sample_flags::sixteen_bit) {
+        load_sample_data<int16_t>(data, header, sample);
+    } else {
+        load_sample_data<int8_t>(data, header, sample);
+    }
+
+    const uint32_t loop_end = std::min(header.loop_end, header.length);
+    if (header.flags & it_file::sample_flags::loop && header.loop_begin < loop_end) {
+        sample.loop = LoopParams(header.flags & it_file::sample_flags::pingpong_loop ? LoopType::pingpong : LoopType::forward,
+            header.loop_begin, loop_end);
+    }
+    return sample;
+}
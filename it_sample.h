@@ -0,0 +1,21 @@
+#ifndef _IT_SAMPLE_H_
+#define _IT_SAMPLE_H_
+#include "mapped_file.h"
+#include "mixer.h"
+#include <cstdint>
+#include <string>
+
+// Reads the sample whose header is at header_offset in an .it file image:
+// 8 or 16-bit, signed or unsigned, mono or stereo, plain or IT2.14/2.15
+// compressed. Frames keep their width, and stereo samples both channels;
+// the mixer mixes those down to mono as it plays them. Sample data that runs
+// past the end of the file is cut short rather than rejected, as trackers
+// do. Throws std::runtime_error if the header itself is missing.
+Sample load_sample(const ByteView& file, size_t header_offset, std::string* name = nullptr);
+
+// Decompress count samples of one channel of IT2.14 (or, if it215 is set,
+// IT2.15) compressed data into out. Return the number of bytes of data
+// consumed. If the data runs out, the rest of out is filled with silence.
+size_t decompress_it_sample(const ByteView& data, int8_t* out, size_t count, bool it215);
+size_t decompress_it_sample(const ByteView& data, int16_t* out, size_t count, bool it215);
+#endif
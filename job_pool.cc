@@ -0,0 +1,106 @@
+#include "job_pool.h"
+
+size_t hardware_threads()
+{
+    const unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+WorkStealingPool::WorkStealingPool(size_t thread_count)
+    : queued(0)
+    , unfinished(0)
+    , next_worker(0)
+    , stopping(false)
+{
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back(new Worker);
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        threads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Job job)
+{
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        index = next_worker;
+        next_worker = (next_worker + 1) % workers.size();
+        ++unfinished;
+        ++queued;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->jobs.push_back(std::move(job));
+    }
+    work_available.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> lock(state_mutex);
+    all_done.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool WorkStealingPool::take_job(size_t index, Job& job)
+{
+    {
+        auto& own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        auto& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t index)
+{
+    for (;;) {
+        Job job;
+        if (take_job(index, job)) {
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                --queued;
+            }
+            job();
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (--unfinished == 0) {
+                all_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(state_mutex);
+        work_available.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
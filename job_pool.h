@@ -0,0 +1,52 @@
+#ifndef _JOB_POOL_H_
+#define _JOB_POOL_H_
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each with its own queue of jobs. Workers
+// take jobs from the back of their own queue and, once it is empty, steal
+// from the front of the others', so one long job never leaves the rest of
+// the pool idle while work is still queued behind it.
+class WorkStealingPool {
+public:
+    using Job = std::function<void()>;
+
+    explicit WorkStealingPool(size_t thread_count);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Jobs are dealt out to the workers' queues in turn.
+    void submit(Job job);
+    // Blocks until every submitted job has finished.
+    void wait();
+    size_t thread_count() const { return threads.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void run(size_t index);
+    bool take_job(size_t index, Job& job);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    size_t queued;
+    size_t unfinished;
+    size_t next_worker;
+    bool stopping;
+};
+
+// std::thread::hardware_concurrency(), or 1 if that is unknown.
+size_t hardware_threads();
+#endif
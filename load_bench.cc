@@ -0,0 +1,194 @@
+#include "module_files.h"
+#include "player.h"
+#include "synth_module.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// The loader as it used to be: everything read through an ifstream, the
+// packed pattern data one f.get() at a time. Kept as the baseline.
+namespace stream_loader {
+template <typename T>
+std::vector<T> load_vector(std::istream& f, const size_t count)
+{
+    std::vector<T> temp(count);
+    if (count) {
+        f.read(reinterpret_cast<char*>(&temp[0]), static_cast<std::streamsize>(count * sizeof(T)));
+    }
+    return temp;
+}
+
+Pattern unpack_pattern(std::istream& f)
+{
+    it_file::pattern_header pat_header;
+    f.read(reinterpret_cast<char*>(&pat_header), sizeof pat_header);
+    Pattern::Builder p(pat_header.row_num ? pat_header.row_num : Pattern::default_rows);
+    uint16_t row = 0;
+    uint8_t mask_variables[64] = {};
+    PatternEntry entries[64];
+    while (row < pat_header.row_num && f) {
+        auto channel_variable = static_cast<uint8_t>(f.get());
+        if (channel_variable == 0) {
+            row++;
+            continue;
+        }
+        uint8_t channel = (channel_variable - 1) & 63;
+        uint8_t mask_variable = mask_variables[channel];
+        if (channel_variable & 128) {
+            mask_variable = mask_variables[channel] = static_cast<uint8_t>(f.get());
+        }
+        if (mask_variable & 1) {
+            entries[channel].note = PatternEntry::Note(static_cast<uint8_t>(f.get()));
+        }
+        if (mask_variable & 2) {
+            entries[channel].inst = PatternEntry::Inst(static_cast<uint8_t>(f.get()));
+        }
+        if (mask_variable & 4) {
+            auto vol_comm = static_cast<uint8_t>(f.get());
+            if (vol_comm <= 64) {
+                entries[channel].comms[0] = PatternEntry::Command(PatternEntry::Command::Type::set_volume, vol_comm);
+            }
+        }
+        if (mask_variable & 8) {
+            f.get();
+            entries[channel].comms[1] = PatternEntry::Command(PatternEntry::Command::Type::unknown, static_cast<uint8_t>(f.get()));
+        }
+        PatternEntry entry;
+        if (mask_variable & (16 | 1)) {
+            entry.note = entries[channel].note;
+        }
+        if (mask_variable & (32 | 2)) {
+            entry.inst = entries[channel].inst;
+        }
+        if (mask_variable & (64 | 4)) {
+            entry.comms[0] = entries[channel].comms[0];
+        }
+        if (mask_variable & (128 | 8)) {
+            entry.comms[1] = entries[channel].comms[1];
+        }
+        p.set(row, channel, entry);
+    }
+    return p.build();
+}
+
+// Returns the number of patterns decoded
+size_t load_module(const std::string& path)
+{
+    std::ifstream it(path, std::ios::binary);
+    it_file::header it_header;
+    it.read(reinterpret_cast<char*>(&it_header), sizeof it_header);
+    std::vector<Pattern> patterns;
+    auto orders = load_vector<uint8_t>(it, it_header.order_num);
+    auto instrument_offsets = load_vector<uint32_t>(it, it_header.instrument_num);
+    auto sample_offsets = load_vector<uint32_t>(it, it_header.sample_num);
+    auto pattern_offsets = load_vector<uint32_t>(it, it_header.pattern_num);
+    for (const auto& offset : pattern_offsets) {
+        if (offset) {
+            it.seekg(offset);
+            patterns.emplace_back(unpack_pattern(it));
+        } else {
+            patterns.emplace_back(Pattern());
+        }
+    }
+    return patterns.size();
+}
+}
+
+static std::vector<std::string> make_corpus(const std::string& directory)
+{
+    std::vector<std::string> paths;
+    for (uint32_t i = 0; i < 32; i++) {
+        SynthModuleParams params;
+        params.patterns = 16 + 8 * (i % 8);
+        params.rows = 64 + 17 * (i % 9);
+        params.channels = 4 + 4 * (i % 8);
+        params.seed = i + 1;
+        const std::string path = directory + "/synth" + std::to_string(i) + ".it";
+        write_synth_module(path, params);
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+template <typename Loader>
+static void bench_loader(const char* name, const std::vector<std::string>& modules, size_t passes, Loader load)
+{
+    using clock = std::chrono::steady_clock;
+    size_t bytes = 0;
+    size_t loaded = 0;
+    size_t patterns = 0;
+    auto start = clock::now();
+    for (size_t pass = 0; pass < passes; pass++) {
+        for (const auto& path : modules) {
+            try {
+                patterns += load(path);
+                bytes += file_size(path);
+                loaded++;
+            } catch (const std::runtime_error& e) {
+                if (pass == 0) {
+                    fprintf(stderr, "load_bench: %s\n", e.what());
+                }
+            }
+        }
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    printf("%-9s %8zu modules %10zu decoded %10.1f ms %12.1f modules/s %10.1f MB/s\n",
+        name, loaded, patterns, elapsed.count() * 1000, static_cast<double>(loaded) / elapsed.count(),
+        static_cast<double>(bytes) / elapsed.count() / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t passes = 5;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+            passes = static_cast<size_t>(atoi(argv[++i]));
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    // Without a corpus on the command line, time a generated one
+    std::string corpus_dir;
+    std::vector<std::string> modules;
+    if (inputs.empty()) {
+        char dir_template[] = "/tmp/load_bench.XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            fprintf(stderr, "load_bench: can't create a directory for the corpus\n");
+            return 1;
+        }
+        corpus_dir = dir_template;
+        modules = make_corpus(corpus_dir);
+    } else {
+        modules = find_modules(inputs);
+    }
+
+    // Loaders return how many patterns they decoded
+    bench_loader("stream", modules, passes, [](const std::string& path) { return stream_loader::load_module(path); });
+    bench_loader("mmap", modules, passes, [](const std::string& path) {
+        load_module(path);
+        return size_t(0);
+    });
+    bench_loader("mmap+all", modules, passes, [](const std::string& path) {
+        Module mod = load_module(path);
+        for (size_t i = 0; i < mod.pattern_count(); i++) {
+            mod.pattern(i);
+        }
+        return mod.pattern_count();
+    });
+
+    if (!corpus_dir.empty()) {
+        for (const auto& path : modules) {
+            unlink(path.c_str());
+        }
+        rmdir(corpus_dir.c_str());
+    }
+    return 0;
+}
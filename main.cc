@@ -1,119 +1,278 @@
+#include "audio_output.h"
 #include "mixer.h"
-#include "portaudio.h"
+#include "render_ahead.h"
+#include "render_stats.h"
+#include "seek_index.h"
+#include "song.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 #define SAMPLE_RATE (44100)
 #define FRAMES_PER_BUFFER (1024)
+/* How long the demo plays when nobody is there to press enter */
+#define DEMO_SECONDS (10)
 
-/* This routine will be called by the PortAudio engine when audio is needed.
-** It may called at interrupt level on some machines so don't do anything
-** that could mess up the system like calling malloc() or free().
+/* What the output plays, and where it records how it's keeping up. */
+struct Playback {
+    Mixer* mix;
+    SongPlayer* song;
+    RenderAhead* ahead; /* renders for the output when set */
+    RenderStats* stats;
+};
+
+/* These routines are called by the output whenever it needs audio. For a
+** sound card that's at interrupt level on some machines, so don't do
+** anything that could mess up the system like calling malloc() or free().
 */
-static int patestCallback(const void* inputBuffer, void* outputBuffer,
-    unsigned long framesPerBuffer,
-    const PaStreamCallbackTimeInfo* timeInfo,
-    PaStreamCallbackFlags statusFlags,
-    void* userData)
+static bool renderMixer(Playback& playback, StereoSample* out, size_t frames, bool underflow)
 {
-    auto* mix = reinterpret_cast<Mixer*>(userData);
-    StereoSample* out = reinterpret_cast<StereoSample*>(outputBuffer);
+    const auto started = RenderStats::clock::now();
+    playback.mix->render(out, frames);
+    playback.stats->record_callback(started, frames, underflow);
+    playback.stats->record_voices(playback.mix->active_count());
+    return true;
+}
+
+/* Plays a song: the sequencer runs inside the callback, a tick at a time. */
+static bool renderSong(Playback& playback, StereoSample* out, size_t frames, bool underflow)
+{
+    const auto started = RenderStats::clock::now();
+    playback.song->render(out, frames);
+    playback.stats->record_callback(started, frames, underflow);
+    playback.stats->record_voices(playback.song->mixer.active_count());
+    return !playback.song->finished();
+}
 
-    (void)timeInfo; /* Prevent unused variable warnings. */
-    (void)statusFlags;
-    (void)inputBuffer;
+/* Only copies out what the render-ahead thread has rendered. */
+static bool renderAhead(Playback& playback, StereoSample* out, size_t frames, bool underflow)
+{
+    const auto started = RenderStats::clock::now();
+    playback.stats->record_buffered(playback.ahead->fill());
+    const size_t ready = playback.ahead->read(out, frames);
+    const bool ran_dry = ready < frames && !playback.ahead->finished();
+    playback.stats->record_callback(started, frames, ran_dry || underflow);
+    return !playback.ahead->finished();
+}
+
+/* Rewrites path with the latest stats once a second until told to stop.
+** The file is replaced in one go, so a reader never sees half of it. */
+static void write_stats(const RenderStats* stats, const char* path, const std::atomic<bool>* stop)
+{
+    const std::string temp = std::string(path) + ".tmp";
+    for (unsigned naps = 1; !stop->load(); naps++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (naps % 10) {
+            continue;
+        }
+        std::ofstream f(temp);
+        f << format_json(stats->read()) << '\n';
+        f.close();
+        if (f) {
+            std::rename(temp.c_str(), path);
+        }
+    }
+}
+
+/* portaudio, null, paced, or the name of a file to write */
+static std::unique_ptr<AudioOutput> make_output(const std::string& name, const OutputOptions& options)
+{
+    if (name == "portaudio") {
+#ifdef SONIC_HAVE_PORTAUDIO
+        return make_portaudio_output(options);
+#else
+        throw std::runtime_error("built without PortAudio");
+#endif
+    }
+    if (name == "null") {
+        return make_null_output(options);
+    }
+    if (name == "paced") {
+        return make_paced_output(options);
+    }
+    return make_file_output(name, options);
+}
 
-    mix->render(out, framesPerBuffer);
-    return paContinue;
+static int usage()
+{
+    fprintf(stderr,
+        "usage: sonic [options] [module.it [start seconds]]\n"
+        "  --output <name>     portaudio, null (as fast as possible), paced (a simulated\n"
+        "                      device) or a .wav/.raw file (default portaudio if built\n"
+        "                      with it, otherwise paced)\n"
+        "  --buffer <frames>   frames per buffer (default %d)\n"
+        "  --ahead <ms>        render this far ahead on a thread of its own, so the\n"
+        "                      output can use small buffers without glitching\n"
+        "  --seconds <n>       stop after n seconds rather than when the song ends\n"
+        "                      (or enter is pressed)\n"
+        "  --stats <file>      keep file up to date with render stats as JSON\n"
+        "  --clip <mode>       none, hard or soft: what happens past full scale\n"
+        "                      (default hard)\n"
+        "Without a module, plays a demo of untitled.raw.\n",
+        FRAMES_PER_BUFFER);
+    return 2;
 }
 
 /*******************************************************************/
-int main(void);
-int main(void)
+int main(int argc, char* argv[]);
+int main(int argc, char* argv[])
 {
-    PaStreamParameters outputParameters;
-    PaStream* stream;
-    PaError err;
-    Mixer mix(3, SAMPLE_RATE, FRAMES_PER_BUFFER);
+    Mixer mix(3, SAMPLE_RATE);
     Sample atomic;
+    Module mod;
+    std::unique_ptr<SongPlayer> song;
+    RenderStats stats(SAMPLE_RATE);
+    Playback playback = { &mix, nullptr, nullptr, &stats };
+    const char* stats_path = nullptr;
+    std::atomic<bool> stop_stats(false);
+    std::thread stats_writer;
+#ifdef SONIC_HAVE_PORTAUDIO
+    std::string output_name = "portaudio";
+#else
+    std::string output_name = "paced";
+#endif
+    OutputOptions output_options;
+    output_options.sample_rate = SAMPLE_RATE;
+    output_options.frames_per_buffer = FRAMES_PER_BUFFER;
+    double seconds = 0;
+    double ahead_ms = 0;
+    std::unique_ptr<RenderAhead> ahead;
+    std::unique_ptr<AudioOutput> output;
 
-    printf("PortAudio Test: output sine wave. SR = %d, BufSize = %d\n", SAMPLE_RATE, FRAMES_PER_BUFFER);
-
-    std::ifstream rawsample("untitled.raw", std::ios::binary);
-    auto begin = rawsample.tellg();
-    rawsample.seekg(0, std::ios::end);
-    auto end = rawsample.tellg();
-    auto samplesize = end - begin;
-    rawsample.seekg(0, std::ios::beg);
-
-    atomic.wavetable.reserve(static_cast<size_t>(samplesize));
-    for (int i = 0; i < samplesize; i++)
-        atomic.wavetable.push_back(static_cast<char>(rawsample.get()) / 127.0f);
-
-    mix.channel(0).play(&atomic, LoopParams(LoopType::pingpong, 12000, samplesize));
-    mix.channel(0).set_volume(AudioChannel::volume_max);
-    mix.channel(0).set_panning(AudioChannel::panning_full_left * 0.75f);
-    mix.channel(0).set_playback_rate(11025);
-
-    mix.channel(1).play(&atomic, LoopParams(LoopType::pingpong, 12000, samplesize));
-    mix.channel(1).set_volume(AudioChannel::volume_max);
-    mix.channel(1).set_panning(AudioChannel::panning_full_right * 0.75f);
-    mix.channel(1).set_playback_rate(11025 * 1.10f); // 10% faster than the other channel
-
-    mix.channel(2).play(&atomic, LoopParams(LoopType::pingpong, 12000, samplesize));
-    mix.channel(2).set_volume(AudioChannel::volume_max);
-    mix.channel(2).set_panning(AudioChannel::panning_center);
-    mix.channel(2).set_playback_rate(11025 * .95f);
-
-    err = Pa_Initialize();
-    if (err != paNoError)
-        goto error;
-
-    outputParameters.device = Pa_GetDefaultOutputDevice(); /* default output device */
-    if (outputParameters.device == paNoDevice) {
-        fprintf(stderr, "Error: No default output device.\n");
-        goto error;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (argc < 3) {
+            return usage();
+        }
+        if (strcmp(argv[1], "--stats") == 0) {
+            stats_path = argv[2];
+        } else if (strcmp(argv[1], "--output") == 0) {
+            output_name = argv[2];
+        } else if (strcmp(argv[1], "--buffer") == 0) {
+            output_options.frames_per_buffer = strtoul(argv[2], nullptr, 10);
+        } else if (strcmp(argv[1], "--ahead") == 0) {
+            ahead_ms = atof(argv[2]);
+        } else if (strcmp(argv[1], "--seconds") == 0) {
+            seconds = atof(argv[2]);
+        } else if (strcmp(argv[1], "--clip") == 0) {
+            if (!clipping_from_name(argv[2], output_options.clipping)) {
+                return usage();
+            }
+        } else {
+            return usage();
+        }
+        argc -= 2;
+        argv += 2;
     }
-    outputParameters.channelCount = 2; /* stereo output */
-    outputParameters.sampleFormat = paFloat32; /* 32 bit floating point output */
-    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-    outputParameters.hostApiSpecificStreamInfo = NULL;
-
-    err = Pa_OpenStream(
-        &stream,
-        NULL, /* no input */
-        &outputParameters,
-        SAMPLE_RATE,
-        FRAMES_PER_BUFFER,
-        paClipOff, /* we won't output out of range samples so don't bother clipping them */
-        patestCallback,
-        &mix);
-    if (err != paNoError)
-        goto error;
-
-    err = Pa_StartStream(stream);
-    if (err != paNoError)
-        goto error;
-
-    printf("Press enter to exit...\n");
-    getchar();
-
-    err = Pa_StopStream(stream);
-    if (err != paNoError)
-        goto error;
-
-    err = Pa_CloseStream(stream);
-    if (err != paNoError)
-        goto error;
-
-    Pa_Terminate();
-    printf("Test finished.\n");
+    if (output_options.frames_per_buffer == 0) {
+        return usage();
+    }
+
+    if (argc > 1) {
+        try {
+            mod = load_module(argv[1]);
+        } catch (const std::runtime_error& e) {
+            fprintf(stderr, "sonic: %s\n", e.what());
+            return 1;
+        }
+        // Nothing may be decoded on the audio thread once playback starts
+        mod.load_all_patterns();
+        song.reset(new SongPlayer(&mod, SAMPLE_RATE));
+        output_options.gain = mod.mix_gain();
+        song->stats = &stats;
+        playback.song = song.get();
+        if (argc > 2) { // start this many seconds in
+            const SeekIndex index(mod, SAMPLE_RATE);
+            index.seek(*song, static_cast<uint64_t>(atof(argv[2]) * SAMPLE_RATE));
+        }
+        printf("Playing %s\n", mod.song_name.c_str());
+    } else {
+        printf("Demo: output sine wave. SR = %d, BufSize = %zu\n", SAMPLE_RATE, output_options.frames_per_buffer);
+
+        std::ifstream rawsample("untitled.raw", std::ios::binary);
+        auto begin = rawsample.tellg();
+        rawsample.seekg(0, std::ios::end);
+        auto end = rawsample.tellg();
+        auto samplesize = end - begin;
+        rawsample.seekg(0, std::ios::beg);
 
-    return err;
-error:
-    Pa_Terminate();
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-    return err;
+        atomic.wavetable.reserve(static_cast<size_t>(samplesize));
+        for (int i = 0; i < samplesize; i++)
+            atomic.wavetable.push_back(static_cast<char>(rawsample.get()) / 127.0f);
+        atomic.loop = LoopParams(LoopType::pingpong, 12000, static_cast<uint32_t>(samplesize));
+        atomic.prepare();
+
+        // Queued rather than set directly, so the voices come in one after the
+        // other at exact frames once the stream is running.
+        const uint16_t voices = 3;
+        const float panning[voices] = { AudioChannel::panning_full_left * 0.75f, AudioChannel::panning_full_right * 0.75f,
+            AudioChannel::panning_center };
+        const float rates[voices] = { 11025, 11025 * 1.10f, 11025 * .95f };
+        for (uint16_t v = 0; v < voices; v++) {
+            const uint64_t start = v * static_cast<uint64_t>(SAMPLE_RATE) / 2;
+            mix.commands->push(VoiceCommand::set_volume(start, v, AudioChannel::volume_max));
+            mix.commands->push(VoiceCommand::set_panning(start, v, panning[v]));
+            mix.commands->push(VoiceCommand::set_playback_rate(start, v, rates[v]));
+            mix.commands->push(VoiceCommand::play(start, v, &atomic));
+        }
+    }
+
+    if (ahead_ms > 0) {
+        const auto lookahead = static_cast<size_t>(ahead_ms * SAMPLE_RATE / 1000);
+        if (song) {
+            ahead.reset(new RenderAhead([&song, &stats](StereoSample* out, size_t frames) -> size_t {
+                if (song->finished()) {
+                    return 0;
+                }
+                song->render(out, frames);
+                stats.record_voices(song->mixer.active_count());
+                return frames;
+            }, lookahead, SAMPLE_RATE));
+        } else {
+            ahead.reset(new RenderAhead([&mix, &stats](StereoSample* out, size_t frames) {
+                mix.render(out, frames);
+                stats.record_voices(mix.active_count());
+                return frames;
+            }, lookahead, SAMPLE_RATE));
+        }
+        ahead->start();
+        playback.ahead = ahead.get();
+    }
+
+    const auto render = ahead ? renderAhead : song ? renderSong : renderMixer;
+    try {
+        output = make_output(output_name, output_options);
+        output->start([&playback, render](StereoSample* out, size_t frames, bool underflow) {
+            return render(playback, out, frames, underflow);
+        });
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr, "sonic: %s: %s\n", output_name.c_str(), e.what());
+        return 1;
+    }
+
+    if (stats_path) {
+        stats_writer = std::thread(write_stats, &stats, stats_path, &stop_stats);
+    }
+    if (seconds > 0) {
+        output->wait(seconds);
+    } else if (output_name == "portaudio") {
+        printf("Press enter to exit...\n");
+        getchar();
+    } else {
+        output->wait(song ? 0 : DEMO_SECONDS);
+    }
+    output->stop();
+    if (stats_writer.joinable()) {
+        stop_stats = true;
+        stats_writer.join();
+    }
+
+    printf("%s", format_text(stats.read()).c_str());
+    printf("Test finished.\n");
+    return 0;
 }
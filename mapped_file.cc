@@ -0,0 +1,48 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+    : address(nullptr)
+    , size(0)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("can't read " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("can't read " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    // Empty files can't be mapped; they're left as an empty view.
+    if (size) {
+        address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            address = nullptr;
+            close(fd);
+            throw std::runtime_error("can't map " + path);
+        }
+        // The loader reads the file front to back, with a few jumps
+        madvise(address, size, MADV_WILLNEED);
+    }
+    close(fd);
+}
+
+MappedFile::MappedFile(MappedFile&& rhs)
+    : address(rhs.address)
+    , size(rhs.size)
+{
+    rhs.address = nullptr;
+    rhs.size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+    if (address) {
+        munmap(address, size);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A read-only window onto bytes owned by someone else, typically a
+// MappedFile. Every read is checked against the size of the window and
+// throws std::runtime_error rather than reading past the end.
+class ByteView {
+public:
+    ByteView()
+        : _data(nullptr)
+        , _size(0)
+    {
+    }
+    ByteView(const uint8_t* d, size_t s)
+        : _data(d)
+        , _size(s)
+    {
+    }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool contains(size_t offset, size_t length) const
+    {
+        return offset <= _size && length <= _size - offset;
+    }
+    void check(size_t offset, size_t length) const
+    {
+        if (!contains(offset, length)) {
+            throw std::runtime_error("read past the end of the file");
+        }
+    }
+    // Fixed-layout structures are read with memcpy, so they need no
+    // particular alignment in the file. Multi-byte fields are little-endian
+    // on disk and are used as-is, which is correct on every host we build for.
+    template <typename T>
+    T read(size_t offset) const
+    {
+        check(offset, sizeof(T));
+        T value;
+        std::memcpy(&value, _data + offset, sizeof(T));
+        return value;
+    }
+    template <typename T>
+    std::vector<T> read_vector(size_t offset, size_t count) const
+    {
+        check(offset, count * sizeof(T));
+        std::vector<T> values(count);
+        if (count) {
+            std::memcpy(&values[0], _data + offset, count * sizeof(T));
+        }
+        return values;
+    }
+    ByteView subview(size_t offset, size_t length) const
+    {
+        check(offset, length);
+        return ByteView(_data + offset, length);
+    }
+
+private:
+    const uint8_t* _data;
+    size_t _size;
+};
+
+// Maps a whole file into memory read-only for as long as the object lives.
+class MappedFile {
+public:
+    // Throws std::runtime_error if the file can't be opened or mapped.
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(MappedFile&& rhs);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ByteView bytes() const { return ByteView(static_cast<const uint8_t*>(address), size); }
+
+private:
+    void* address;
+    size_t size;
+};
+#endif
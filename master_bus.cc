@@ -0,0 +1,341 @@
+#include "master_bus.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MASTER_BUS_X86 1
+#include <immintrin.h>
+#endif
+
+size_t sample_format_bytes(SampleFormat format)
+{
+    switch (format) {
+    case SampleFormat::int16:
+        return 2;
+    case SampleFormat::int24:
+        return 3;
+    case SampleFormat::float32:
+        return 4;
+    }
+    return 0;
+}
+
+const char* sample_format_name(SampleFormat format)
+{
+    switch (format) {
+    case SampleFormat::int16:
+        return "s16";
+    case SampleFormat::int24:
+        return "s24";
+    case SampleFormat::float32:
+        return "f32";
+    }
+    return "unknown";
+}
+
+bool sample_format_from_name(const char* name, SampleFormat& format)
+{
+    const SampleFormat formats[] = { SampleFormat::int16, SampleFormat::int24, SampleFormat::float32 };
+    for (auto f : formats) {
+        if (std::strcmp(name, sample_format_name(f)) == 0) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* clipping_name(Clipping clipping)
+{
+    switch (clipping) {
+    case Clipping::none:
+        return "none";
+    case Clipping::hard:
+        return "hard";
+    case Clipping::soft:
+        return "soft";
+    }
+    return "unknown";
+}
+
+bool clipping_from_name(const char* name, Clipping& clipping)
+{
+    const Clipping clippings[] = { Clipping::none, Clipping::hard, Clipping::soft };
+    for (auto c : clippings) {
+        if (std::strcmp(name, clipping_name(c)) == 0) {
+            clipping = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+// What every sample of a block goes through
+struct Stage {
+    float gain;
+    bool soft;
+    bool hard; // for float output; integers are always clipped at full scale
+    float scale; // full scale of the integer format
+    bool dither;
+};
+}
+
+// The soft clipping curve: x - 4x^3/27 is 1 with a flat top at 1.5, and
+// bends the signal only slightly well below full scale.
+static const float soft_limit = 1.5f;
+static const float soft_cubic = 4.0f / 27.0f;
+
+static inline float shape(const Stage& s, float x)
+{
+    x *= s.gain;
+    if (s.soft) {
+        x = clamp(x, -soft_limit, soft_limit);
+        x = x - soft_cubic * x * x * x;
+    }
+    return x;
+}
+
+static inline uint32_t xorshift(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// The difference of two uniform numbers has a triangular distribution, in
+// (-1, 1): the halves of one 32-bit random number are the two numbers.
+static inline float triangular(uint32_t r)
+{
+    return static_cast<float>(static_cast<int32_t>(r & 0xFFFF) - static_cast<int32_t>(r >> 16)) * (1.0f / 65536.0f);
+}
+
+static inline int32_t to_int(const Stage& s, float x, uint32_t& state)
+{
+    float v = shape(s, x) * s.scale;
+    if (s.dither) {
+        v += triangular(xorshift(state));
+    }
+    return static_cast<int32_t>(std::lrint(clamp(v, -s.scale, s.scale)));
+}
+
+template <SampleFormat Format>
+static void process_scalar(const Stage& s, const float* in, size_t first, size_t count, void* out, uint32_t* state)
+{
+    for (size_t i = first; i < count; i++) {
+        if (Format == SampleFormat::float32) {
+            const float v = shape(s, in[i]);
+            static_cast<float*>(out)[i] = s.hard ? clamp(v, -1.0f, 1.0f) : v;
+        } else if (Format == SampleFormat::int16) {
+            static_cast<int16_t*>(out)[i] = static_cast<int16_t>(to_int(s, in[i], state[i % 8]));
+        } else {
+            const auto v = static_cast<uint32_t>(to_int(s, in[i], state[i % 8]));
+            auto* bytes = static_cast<uint8_t*>(out) + 3 * i;
+            bytes[0] = static_cast<uint8_t>(v);
+            bytes[1] = static_cast<uint8_t>(v >> 8);
+            bytes[2] = static_cast<uint8_t>(v >> 16);
+        }
+    }
+}
+
+#ifdef MASTER_BUS_X86
+// The vector kernels work through the same steps as the scalar code, in
+// the same order, so all of them give the same samples.
+
+__attribute__((target("sse2"))) static inline __m128 shape_sse2(const Stage& s, __m128 x)
+{
+    x = _mm_mul_ps(x, _mm_set1_ps(s.gain));
+    if (s.soft) {
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-soft_limit)), _mm_set1_ps(soft_limit));
+        x = _mm_sub_ps(x, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(soft_cubic), x), x), x));
+    }
+    return x;
+}
+
+__attribute__((target("sse2"))) static inline __m128 triangular_sse2(__m128i& state)
+{
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    const __m128i low = _mm_and_si128(state, _mm_set1_epi32(0xFFFF));
+    const __m128i high = _mm_srli_epi32(state, 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(low, high)), _mm_set1_ps(1.0f / 65536.0f));
+}
+
+__attribute__((target("sse2"))) static inline __m128i to_int_sse2(const Stage& s, __m128 x, __m128i& state)
+{
+    __m128 v = _mm_mul_ps(shape_sse2(s, x), _mm_set1_ps(s.scale));
+    if (s.dither) {
+        v = _mm_add_ps(v, triangular_sse2(state));
+    }
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-s.scale)), _mm_set1_ps(s.scale));
+    return _mm_cvtps_epi32(v);
+}
+
+// Eight samples at a time, the first four using generators 0-3 and the
+// rest 4-7
+template <SampleFormat Format>
+__attribute__((target("sse2"))) static void process_sse2(const Stage& s, const float* in, size_t count, void* out,
+    uint32_t* state)
+{
+    __m128i state_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i state_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128 a = _mm_loadu_ps(in + i);
+        const __m128 b = _mm_loadu_ps(in + i + 4);
+        if (Format == SampleFormat::float32) {
+            __m128 va = shape_sse2(s, a);
+            __m128 vb = shape_sse2(s, b);
+            if (s.hard) {
+                va = _mm_min_ps(_mm_max_ps(va, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+                vb = _mm_min_ps(_mm_max_ps(vb, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+            }
+            _mm_storeu_ps(static_cast<float*>(out) + i, va);
+            _mm_storeu_ps(static_cast<float*>(out) + i + 4, vb);
+        } else if (Format == SampleFormat::int16) {
+            const __m128i packed = _mm_packs_epi32(to_int_sse2(s, a, state_lo), to_int_sse2(s, b, state_hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(static_cast<int16_t*>(out) + i), packed);
+        } else {
+            // SSE2 can't shuffle bytes, so the packing is left to the scalar unit
+            alignas(16) int32_t v[8];
+            _mm_store_si128(reinterpret_cast<__m128i*>(v), to_int_sse2(s, a, state_lo));
+            _mm_store_si128(reinterpret_cast<__m128i*>(v + 4), to_int_sse2(s, b, state_hi));
+            auto* bytes = static_cast<uint8_t*>(out) + 3 * i;
+            for (size_t k = 0; k < 8; k++) {
+                const auto u = static_cast<uint32_t>(v[k]);
+                bytes[3 * k] = static_cast<uint8_t>(u);
+                bytes[3 * k + 1] = static_cast<uint8_t>(u >> 8);
+                bytes[3 * k + 2] = static_cast<uint8_t>(u >> 16);
+            }
+        }
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state_lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state_hi);
+    process_scalar<Format>(s, in, i, count, out, state);
+}
+
+__attribute__((target("avx2"))) static inline __m256 shape_avx2(const Stage& s, __m256 x)
+{
+    x = _mm256_mul_ps(x, _mm256_set1_ps(s.gain));
+    if (s.soft) {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-soft_limit)), _mm256_set1_ps(soft_limit));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(soft_cubic), x), x), x));
+    }
+    return x;
+}
+
+__attribute__((target("avx2"))) static inline __m256 triangular_avx2(__m256i& state)
+{
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+    state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+    const __m256i low = _mm256_and_si256(state, _mm256_set1_epi32(0xFFFF));
+    const __m256i high = _mm256_srli_epi32(state, 16);
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(low, high)), _mm256_set1_ps(1.0f / 65536.0f));
+}
+
+__attribute__((target("avx2"))) static inline __m256i to_int_avx2(const Stage& s, __m256 x, __m256i& state)
+{
+    __m256 v = _mm256_mul_ps(shape_avx2(s, x), _mm256_set1_ps(s.scale));
+    if (s.dither) {
+        v = _mm256_add_ps(v, triangular_avx2(state));
+    }
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-s.scale)), _mm256_set1_ps(s.scale));
+    return _mm256_cvtps_epi32(v);
+}
+
+// Eight samples at a time, one from each generator
+template <SampleFormat Format>
+__attribute__((target("avx2"))) static void process_avx2(const Stage& s, const float* in, size_t count, void* out,
+    uint32_t* state)
+{
+    __m256i dither_state = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state));
+    // Moves the low three bytes of each 32-bit sample together, in each
+    // half, then the two halves' twelve bytes together
+    const __m256i pack24 = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i join24 = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 x = _mm256_loadu_ps(in + i);
+        if (Format == SampleFormat::float32) {
+            __m256 v = shape_avx2(s, x);
+            if (s.hard) {
+                v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+            }
+            _mm256_storeu_ps(static_cast<float*>(out) + i, v);
+        } else if (Format == SampleFormat::int16) {
+            const __m256i v = to_int_avx2(s, x, dither_state);
+            const __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(static_cast<int16_t*>(out) + i), packed);
+        } else {
+            const __m256i v = to_int_avx2(s, x, dither_state);
+            const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack24), join24);
+            auto* bytes = static_cast<uint8_t*>(out) + 3 * i;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), _mm256_castsi256_si128(packed));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(bytes + 16), _mm256_extracti128_si256(packed, 1));
+        }
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(state), dither_state);
+    process_scalar<Format>(s, in, i, count, out, state);
+}
+#endif
+
+template <SampleFormat Format>
+static void process_format(MixKernel kernel, const Stage& s, const float* in, size_t count, void* out,
+    uint32_t* state)
+{
+    switch (kernel) {
+#ifdef MASTER_BUS_X86
+    case MixKernel::avx2:
+        process_avx2<Format>(s, in, count, out, state);
+        return;
+    case MixKernel::sse2:
+        process_sse2<Format>(s, in, count, out, state);
+        return;
+#else
+    case MixKernel::avx2:
+    case MixKernel::sse2:
+#endif
+    case MixKernel::scalar:
+        break;
+    }
+    process_scalar<Format>(s, in, 0, count, out, state);
+}
+
+MasterBus::MasterBus(SampleFormat format, MixKernel k)
+    : _format(format)
+    , kernel(mix_kernel_supported(k) ? k : MixKernel::scalar)
+{
+    for (size_t i = 0; i < dither_state.size(); i++) {
+        dither_state[i] = 0x9E3779B9u * static_cast<uint32_t>(i + 1);
+    }
+}
+
+void MasterBus::process(const StereoSample* in, size_t frames, void* out)
+{
+    if (frames == 0) {
+        return;
+    }
+    Stage s;
+    s.gain = gain;
+    s.soft = clipping == Clipping::soft;
+    s.hard = clipping == Clipping::hard;
+    s.scale = _format == SampleFormat::int24 ? 8388607.0f : 32767.0f;
+    s.dither = dither && _format != SampleFormat::float32;
+    const auto* samples = reinterpret_cast<const float*>(in);
+    const size_t count = 2 * frames;
+    switch (_format) {
+    case SampleFormat::int16:
+        process_format<SampleFormat::int16>(kernel, s, samples, count, out, dither_state.data());
+        break;
+    case SampleFormat::int24:
+        process_format<SampleFormat::int24>(kernel, s, samples, count, out, dither_state.data());
+        break;
+    case SampleFormat::float32:
+        process_format<SampleFormat::float32>(kernel, s, samples, count, out, dither_state.data());
+        break;
+    }
+}
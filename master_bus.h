@@ -0,0 +1,59 @@
+#ifndef _MASTER_BUS_H_
+#define _MASTER_BUS_H_
+#include "mixer.h"
+#include <array>
+#include <cstdint>
+
+// How samples leave the player: 16 or 24-bit signed integers (the 24-bit
+// ones packed into three bytes, little-endian) or floats with full scale 1
+enum class SampleFormat {
+    int16,
+    int24,
+    float32,
+};
+
+// Bytes one channel of a frame takes
+size_t sample_format_bytes(SampleFormat format);
+const char* sample_format_name(SampleFormat format);
+// Sets format and returns true if name is s16, s24 or f32.
+bool sample_format_from_name(const char* name, SampleFormat& format);
+
+// What happens to the mix past full scale. Integer formats can't hold it,
+// so they always end up clipped hard at full scale, whatever is asked for.
+enum class Clipping {
+    none, // left as it is, for float output
+    hard, // cut off at full scale
+    soft, // bent smoothly towards full scale, reaching it at 1.5
+};
+
+const char* clipping_name(Clipping clipping);
+// Sets clipping and returns true if name is one of the names above.
+bool clipping_from_name(const char* name, Clipping& clipping);
+
+// The last stage of the mix, between Mixer::render() and whatever plays or
+// stores the audio. One pass over a block applies the gain, clips and
+// converts to the output format, adding dither on the way if asked to, so
+// getting audio out costs little more than copying it.
+class MasterBus {
+public:
+    // Song's mix volume and any volume on top of it; 1 leaves levels alone
+    float gain = 1;
+    Clipping clipping = Clipping::hard;
+    // Triangular dither of one least significant bit, for integer formats
+    bool dither = false;
+
+    explicit MasterBus(SampleFormat format = SampleFormat::float32, MixKernel kernel = best_mix_kernel());
+    SampleFormat format() const { return _format; }
+    size_t frame_bytes() const { return 2 * sample_format_bytes(_format); }
+    // Writes frames of in to out as format() says, frame_bytes() each. For
+    // float32, out may be in.
+    void process(const StereoSample* in, size_t frames, void* out);
+
+private:
+    SampleFormat _format;
+    MixKernel kernel;
+    // Random number generators for the dither; sample i of a block takes
+    // the next number from generator i % 8, whichever kernel runs.
+    std::array<uint32_t, 8> dither_state;
+};
+#endif
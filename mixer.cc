@@ -2,48 +2,810 @@
 #include <cmath>
 #include <cstring>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define MIXER_X86 1
+#include <immintrin.h>
+#endif
+
 inline float lerp(float v1, float v2, float t)
 {
     return t * v2 + (1.0f - t) * v1;
 }
 
-void render_audio(AudioChannel* data, StereoSample* out, size_t samples_remaining)
+// The fraction of a frame as a float in [0, 1). Only its top 24 bits are
+// kept, which a float holds exactly, so the scalar and vector conversions agree.
+static inline float fraction_to_float(uint32_t fraction)
 {
-    float right_panning = data->panning * 0.5f + 0.5f;
-    float left_panning = 1.0f - right_panning;
-    for (; data->is_active && samples_remaining; out++, samples_remaining--) {
-        float sample = data->sample->wavetable[static_cast<size_t>(data->sample_index)];
-        out->left = data->volume * sample * left_panning;
-        out->right = data->volume * sample * right_panning;
-
-        data->sample_index += data->sample_step;
-        auto whole_index = static_cast<size_t>(data->sample_index);
-        if (data->loop.is_off() && whole_index >= data->sample->wavetable.size()) {
-            data->disable();
-        } else if (data->loop.is_forward() && whole_index >= data->loop.end) {
-            data->sample_index -= data->loop.length();
-        } else if (data->loop.is_pingpong()) {
-            if (data->sample_step > 0 && whole_index >= data->loop.end) {
-                data->sample_index = data->loop.end - (whole_index - data->loop.end + 1);
-                data->sample_step = -data->sample_step;
-            } else if (data->sample_step < 0 && whole_index < data->loop.begin) {
-                data->sample_index = data->loop.begin + (whole_index - data->sample_index);
-                data->sample_step = -data->sample_step;
+    return static_cast<float>(fraction >> 8) * (1.0f / 16777216.0f);
+}
+
+#ifdef MIXER_X86
+__attribute__((target("avx2"))) static inline __m256 fraction8_to_float(__m256i fraction)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(fraction, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+#endif
+
+// How the interpolators read a sample's frames, whatever they're stored as.
+// at() gives frame i as a float and at8() gives eight frames at once with
+// AVX2; offset() moves a pointer by whole frames. Integer frames are
+// converted exactly, so every kernel gives the same floats, and the same as
+// converting the whole sample to floats up front would.
+template <typename T, bool Stereo = false>
+struct FrameReader {
+    using Frame = T;
+    static const size_t channels = Stereo ? 2 : 1;
+    static const int bits = 8 * sizeof(T);
+
+    // Full scale is 1; stereo frames are added together, so halve it to
+    // average them.
+    static float scale() { return (Stereo ? 0.5f : 1.0f) / static_cast<float>(1 << (bits - 1)); }
+    static const T* offset(const T* wave, std::ptrdiff_t frames)
+    {
+        return wave + frames * static_cast<std::ptrdiff_t>(channels);
+    }
+    static float at(const T* wave, size_t i)
+    {
+        int v = wave[channels * i];
+        if (Stereo) {
+            v += wave[channels * i + 1];
+        }
+        return static_cast<float>(v) * scale();
+    }
+#ifdef MIXER_X86
+    // Gathers the 32 bits starting at each frame, with the frame in their
+    // low bits, and sign-extends its channels out of them. The guard frames
+    // keep the bytes read past the frame inside the sample.
+    __attribute__((target("avx2"))) static __m256 at8(const T* wave, __m256i i)
+    {
+        const __m256i raw = _mm256_i32gather_epi32(reinterpret_cast<const int*>(wave), i, sizeof(T) * channels);
+        __m256i v = _mm256_srai_epi32(_mm256_slli_epi32(raw, 32 - bits), 32 - bits);
+        if (Stereo) {
+            v = _mm256_add_epi32(v, _mm256_srai_epi32(_mm256_slli_epi32(raw, 32 - 2 * bits), 32 - bits));
+        }
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(scale()));
+    }
+#endif
+};
+
+template <>
+struct FrameReader<float> {
+    using Frame = float;
+    static const float* offset(const float* wave, std::ptrdiff_t frames) { return wave + frames; }
+    static float at(const float* wave, size_t i) { return wave[i]; }
+#ifdef MIXER_X86
+    __attribute__((target("avx2"))) static __m256 at8(const float* wave, __m256i i)
+    {
+        return _mm256_i32gather_ps(wave, i, 4);
+    }
+#endif
+};
+
+// The interpolators. Each reads the sample at frame i plus a fraction of a
+// frame, one position at a time (at) and, on x86, eight at a time with AVX2
+// (at8), through a FrameReader. Both do the same float operations in the
+// same order, so every kernel still gives identical output. taps is how
+// many frames they read around the position; Sample::guard_frames has to
+// cover the widest of them.
+template <typename Reader>
+struct NearestInterpolator {
+    using Frame = typename Reader::Frame;
+    static const size_t taps = 1;
+    static float at(const Frame* wave, size_t i, uint32_t)
+    {
+        return Reader::at(wave, i);
+    }
+#ifdef MIXER_X86
+    __attribute__((target("avx2"))) static __m256 at8(const Frame* wave, __m256i i, __m256i)
+    {
+        return Reader::at8(wave, i);
+    }
+#endif
+};
+
+template <typename Reader>
+struct LinearInterpolator {
+    using Frame = typename Reader::Frame;
+    static const size_t taps = 2;
+    static float at(const Frame* wave, size_t i, uint32_t fraction)
+    {
+        return lerp(Reader::at(wave, i), Reader::at(wave, i + 1), fraction_to_float(fraction));
+    }
+#ifdef MIXER_X86
+    __attribute__((target("avx2"))) static __m256 at8(const Frame* wave, __m256i i, __m256i fraction)
+    {
+        const __m256 t = fraction8_to_float(fraction);
+        const __m256 v1 = Reader::at8(wave, i);
+        const __m256 v2 = Reader::at8(Reader::offset(wave, 1), i);
+        return _mm256_add_ps(_mm256_mul_ps(t, v2), _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), t), v1));
+    }
+#endif
+};
+
+// Catmull-Rom through the frames before, at and the two after the position.
+template <typename Reader>
+struct CubicInterpolator {
+    using Frame = typename Reader::Frame;
+    static const size_t taps = 4;
+    static float at(const Frame* wave, size_t i, uint32_t fraction)
+    {
+        const float t = fraction_to_float(fraction);
+        const float y0 = Reader::at(Reader::offset(wave, -1), i);
+        const float y1 = Reader::at(wave, i);
+        const float y2 = Reader::at(wave, i + 1);
+        const float y3 = Reader::at(wave, i + 2);
+        const float c1 = 0.5f * (y2 - y0);
+        const float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+        const float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+        return ((c3 * t + c2) * t + c1) * t + y1;
+    }
+#ifdef MIXER_X86
+    __attribute__((target("avx2"))) static __m256 at8(const Frame* wave, __m256i i, __m256i fraction)
+    {
+        const __m256 t = fraction8_to_float(fraction);
+        const __m256 y0 = Reader::at8(Reader::offset(wave, -1), i);
+        const __m256 y1 = Reader::at8(wave, i);
+        const __m256 y2 = Reader::at8(Reader::offset(wave, 1), i);
+        const __m256 y3 = Reader::at8(Reader::offset(wave, 2), i);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(y2, y0));
+        __m256 c2 = _mm256_sub_ps(y0, _mm256_mul_ps(_mm256_set1_ps(2.5f), y1));
+        c2 = _mm256_add_ps(c2, _mm256_mul_ps(_mm256_set1_ps(2.0f), y2));
+        c2 = _mm256_sub_ps(c2, _mm256_mul_ps(half, y3));
+        const __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(y3, y0)),
+            _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(y1, y2)));
+        __m256 v = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+        v = _mm256_add_ps(_mm256_mul_ps(v, t), c1);
+        return _mm256_add_ps(_mm256_mul_ps(v, t), y1);
+    }
+#endif
+};
+
+// Blackman-windowed sinc, with the weights for each tap worked out ahead of
+// time for phases fractions of a frame. The phase is simply the top bits of
+// the position's fraction. The filter isn't narrowed when a sample plays
+// faster than the output rate, so high notes can still alias.
+template <size_t Taps>
+struct SincTable {
+    static const unsigned phase_bits = 8;
+    static const size_t phases = size_t(1) << phase_bits;
+    // Frames read before the one the position falls in
+    static const size_t lead = Taps / 2 - 1;
+
+    float weights[phases * Taps];
+    SincTable()
+    {
+        const double pi = 3.14159265358979323846;
+        for (size_t p = 0; p < phases; p++) {
+            const double fraction = static_cast<double>(p) / phases;
+            double w[Taps];
+            double sum = 0;
+            for (size_t k = 0; k < Taps; k++) {
+                const double t = static_cast<double>(k) - static_cast<double>(lead) - fraction;
+                const double sinc = t == 0 ? 1.0 : std::sin(pi * t) / (pi * t);
+                const double a = 2 * pi * t / Taps;
+                w[k] = sinc * (0.42 + 0.5 * std::cos(a) + 0.08 * std::cos(2 * a));
+                sum += w[k];
+            }
+            // Unity gain at every phase, so a constant signal stays constant
+            for (size_t k = 0; k < Taps; k++) {
+                weights[p * Taps + k] = static_cast<float>(w[k] / sum);
             }
         }
     }
-    // Set any remaining samples to zero (silence)
+    static const SincTable table;
+};
+
+template <size_t Taps>
+const SincTable<Taps> SincTable<Taps>::table;
+
+template <typename Reader, size_t Taps>
+struct SincInterpolator {
+    using Frame = typename Reader::Frame;
+    using Table = SincTable<Taps>;
+    static const size_t taps = Taps;
+
+    static float at(const Frame* wave, size_t i, uint32_t fraction)
+    {
+        const size_t phase = fraction >> (32 - Table::phase_bits);
+        const Frame* frame = Reader::offset(wave, -static_cast<std::ptrdiff_t>(Table::lead));
+        const float* weight = Table::table.weights + phase * Taps;
+        float v = 0;
+        for (size_t k = 0; k < Taps; k++) {
+            v += Reader::at(frame, i + k) * weight[k];
+        }
+        return v;
+    }
+#ifdef MIXER_X86
+    __attribute__((target("avx2"))) static __m256 at8(const Frame* wave, __m256i i, __m256i fraction)
+    {
+        const __m256i phase = _mm256_srli_epi32(fraction, 32 - Table::phase_bits);
+        const __m256i row = _mm256_mullo_epi32(phase, _mm256_set1_epi32(static_cast<int>(Taps)));
+        const Frame* frame = Reader::offset(wave, -static_cast<std::ptrdiff_t>(Table::lead));
+        __m256 v = _mm256_setzero_ps();
+        for (size_t k = 0; k < Taps; k++) {
+            const __m256 s = Reader::at8(Reader::offset(frame, static_cast<std::ptrdiff_t>(k)), i);
+            const __m256 w = _mm256_i32gather_ps(Table::table.weights + k, row, 4);
+            v = _mm256_add_ps(v, _mm256_mul_ps(s, w));
+        }
+        return v;
+    }
+#endif
+};
+
+// Resamples n frames starting at pos and adds them, scaled by the left and
+// right gains, into out. wave is the sample's frames, stored as the
+// interpolator's reader expects. The caller splits playback into runs that
+// end at the next loop point or the end of the sample, so there are no
+// boundary checks in here.
+using MixSpanFunction = void (*)(const void* wave, SamplePosition pos, SamplePosition step, size_t n,
+    float left_gain, float right_gain, StereoSample* out);
+
+// Frame i always reads the sample at pos + i * step. Positions are
+// integers, so the vector kernels can hand their tail to the scalar loop
+// and still produce bit-identical output.
+template <typename Interpolator>
+static void mix_frames_scalar(const typename Interpolator::Frame* wave, SamplePosition pos, SamplePosition step,
+    size_t i, size_t n, float left_gain, float right_gain, StereoSample* out)
+{
+    SamplePosition p = pos + i * step;
+    for (; i < n; i++, p += step) {
+        float sample = Interpolator::at(wave, position_frame(p), position_fraction(p));
+        out[i].left += sample * left_gain;
+        out[i].right += sample * right_gain;
+    }
+}
+
+template <typename Interpolator>
+static void mix_span_scalar(const void* data, SamplePosition pos, SamplePosition step, size_t n,
+    float left_gain, float right_gain, StereoSample* out)
+{
+    const auto* wave = static_cast<const typename Interpolator::Frame*>(data);
+    mix_frames_scalar<Interpolator>(wave, pos, step, 0, n, left_gain, right_gain, out);
+}
+
+#ifdef MIXER_X86
+template <typename Interpolator>
+__attribute__((target("sse2"))) static void mix_span_sse2(const void* data, SamplePosition pos, SamplePosition step,
+    size_t n, float left_gain, float right_gain, StereoSample* out)
+{
+    const auto* wave = static_cast<const typename Interpolator::Frame*>(data);
+    const __m128 gains = _mm_setr_ps(left_gain, right_gain, left_gain, right_gain);
+    auto* dest = reinterpret_cast<float*>(out);
+    size_t i = 0;
+    SamplePosition p = pos;
+    for (; i + 4 <= n; i += 4) {
+        float s[4];
+        for (auto& sample : s) {
+            sample = Interpolator::at(wave, position_frame(p), position_fraction(p));
+            p += step;
+        }
+        __m128 lo = _mm_loadu_ps(dest + 2 * i);
+        __m128 hi = _mm_loadu_ps(dest + 2 * i + 4);
+        lo = _mm_add_ps(lo, _mm_mul_ps(_mm_setr_ps(s[0], s[0], s[1], s[1]), gains));
+        hi = _mm_add_ps(hi, _mm_mul_ps(_mm_setr_ps(s[2], s[2], s[3], s[3]), gains));
+        _mm_storeu_ps(dest + 2 * i, lo);
+        _mm_storeu_ps(dest + 2 * i + 4, hi);
+    }
+    mix_frames_scalar<Interpolator>(wave, pos, step, i, n, left_gain, right_gain, out);
+}
+
+template <typename Interpolator>
+__attribute__((target("avx2"))) static void mix_span_avx2(const void* data, SamplePosition pos, SamplePosition step,
+    size_t n, float left_gain, float right_gain, StereoSample* out)
+{
+    const auto* wave = static_cast<const typename Interpolator::Frame*>(data);
+    const __m256 gains = _mm256_setr_ps(left_gain, right_gain, left_gain, right_gain,
+        left_gain, right_gain, left_gain, right_gain);
+    auto at = [pos, step](size_t frame) { return static_cast<long long>(pos + frame * step); };
+    // The positions of frames 0 1 4 5 and 2 3 6 7, arranged so that picking
+    // the odd (whole frame) and even (fraction) halves of the two gives them
+    // back in order 0 to 7.
+    __m256i p0 = _mm256_setr_epi64x(at(0), at(1), at(4), at(5));
+    __m256i p1 = _mm256_setr_epi64x(at(2), at(3), at(6), at(7));
+    const __m256i advance = _mm256_set1_epi64x(static_cast<long long>(8 * step));
+    auto* dest = reinterpret_cast<float*>(out);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 a = _mm256_castsi256_ps(p0);
+        const __m256 b = _mm256_castsi256_ps(p1);
+        const __m256i frame = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        const __m256i fraction = _mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        p0 = _mm256_add_epi64(p0, advance);
+        p1 = _mm256_add_epi64(p1, advance);
+        __m256 s = Interpolator::at8(wave, frame, fraction);
+        // Duplicate each sample into a left/right pair: s0 s0 s1 s1 ... s7 s7
+        __m256 lo_pairs = _mm256_unpacklo_ps(s, s);
+        __m256 hi_pairs = _mm256_unpackhi_ps(s, s);
+        __m256 lo = _mm256_permute2f128_ps(lo_pairs, hi_pairs, 0x20);
+        __m256 hi = _mm256_permute2f128_ps(lo_pairs, hi_pairs, 0x31);
+        __m256 out_lo = _mm256_loadu_ps(dest + 2 * i);
+        __m256 out_hi = _mm256_loadu_ps(dest + 2 * i + 8);
+        _mm256_storeu_ps(dest + 2 * i, _mm256_add_ps(out_lo, _mm256_mul_ps(lo, gains)));
+        _mm256_storeu_ps(dest + 2 * i + 8, _mm256_add_ps(out_hi, _mm256_mul_ps(hi, gains)));
+    }
+    mix_frames_scalar<Interpolator>(wave, pos, step, i, n, left_gain, right_gain, out);
+}
+#endif
+
+bool mix_kernel_supported(MixKernel kernel)
+{
+    switch (kernel) {
+    case MixKernel::scalar:
+        return true;
+#ifdef MIXER_X86
+    case MixKernel::sse2:
+        return __builtin_cpu_supports("sse2");
+    case MixKernel::avx2:
+        return __builtin_cpu_supports("avx2");
+#else
+    case MixKernel::sse2:
+    case MixKernel::avx2:
+        return false;
+#endif
+    }
+    return false;
+}
+
+MixKernel best_mix_kernel()
+{
+    static const MixKernel best = mix_kernel_supported(MixKernel::avx2)
+        ? MixKernel::avx2
+        : mix_kernel_supported(MixKernel::sse2) ? MixKernel::sse2 : MixKernel::scalar;
+    return best;
+}
+
+const char* mix_kernel_name(MixKernel kernel)
+{
+    switch (kernel) {
+    case MixKernel::scalar:
+        return "scalar";
+    case MixKernel::sse2:
+        return "sse2";
+    case MixKernel::avx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+template <typename Interpolator>
+static MixSpanFunction span_function(MixKernel kernel)
+{
+    static_assert(Interpolator::taps <= Sample::guard_frames, "guard frames too narrow for interpolator");
+#ifdef MIXER_X86
+    switch (kernel) {
+    case MixKernel::avx2:
+        return mix_span_avx2<Interpolator>;
+    case MixKernel::sse2:
+        return mix_span_sse2<Interpolator>;
+    case MixKernel::scalar:
+        break;
+    }
+#else
+    (void)kernel;
+#endif
+    return mix_span_scalar<Interpolator>;
+}
+
+template <typename Reader>
+static MixSpanFunction span_function(MixKernel kernel, Interpolation mode)
+{
+    switch (mode) {
+    case Interpolation::nearest:
+        break;
+    case Interpolation::linear:
+        return span_function<LinearInterpolator<Reader>>(kernel);
+    case Interpolation::cubic:
+        return span_function<CubicInterpolator<Reader>>(kernel);
+    case Interpolation::sinc8:
+        return span_function<SincInterpolator<Reader, 8>>(kernel);
+    case Interpolation::sinc16:
+        return span_function<SincInterpolator<Reader, 16>>(kernel);
+    }
+    return span_function<NearestInterpolator<Reader>>(kernel);
+}
+
+// The one place the interpolation and sample storage are chosen at run
+// time: once per call to mix_audio, never per frame.
+static MixSpanFunction span_function(MixKernel kernel, Interpolation mode, SampleStorage storage)
+{
+    switch (storage) {
+    case SampleStorage::float32:
+        break;
+    case SampleStorage::int8:
+        return span_function<FrameReader<int8_t>>(kernel, mode);
+    case SampleStorage::int16:
+        return span_function<FrameReader<int16_t>>(kernel, mode);
+    case SampleStorage::int8_stereo:
+        return span_function<FrameReader<int8_t, true>>(kernel, mode);
+    case SampleStorage::int16_stereo:
+        return span_function<FrameReader<int16_t, true>>(kernel, mode);
+    }
+    return span_function<FrameReader<float>>(kernel, mode);
+}
+
+const char* interpolation_name(Interpolation mode)
+{
+    switch (mode) {
+    case Interpolation::nearest:
+        return "nearest";
+    case Interpolation::linear:
+        return "linear";
+    case Interpolation::cubic:
+        return "cubic";
+    case Interpolation::sinc8:
+        return "sinc8";
+    case Interpolation::sinc16:
+        return "sinc16";
+    }
+    return "unknown";
+}
+
+bool interpolation_from_name(const char* name, Interpolation& mode)
+{
+    const Interpolation modes[] = { Interpolation::nearest, Interpolation::linear, Interpolation::cubic,
+        Interpolation::sinc8, Interpolation::sinc16 };
+    for (auto m : modes) {
+        if (std::strcmp(name, interpolation_name(m)) == 0) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* sample_storage_name(SampleStorage storage)
+{
+    switch (storage) {
+    case SampleStorage::float32:
+        return "float32";
+    case SampleStorage::int8:
+        return "int8";
+    case SampleStorage::int16:
+        return "int16";
+    case SampleStorage::int8_stereo:
+        return "int8_stereo";
+    case SampleStorage::int16_stereo:
+        return "int16_stereo";
+    }
+    return "unknown";
+}
+
+size_t sample_storage_frame_bytes(SampleStorage storage)
+{
+    switch (storage) {
+    case SampleStorage::float32:
+        break;
+    case SampleStorage::int8:
+        return 1;
+    case SampleStorage::int16:
+    case SampleStorage::int8_stereo:
+        return 2;
+    case SampleStorage::int16_stereo:
+        return 4;
+    }
+    return sizeof(float);
+}
+
+static size_t storage_channels(SampleStorage storage)
+{
+    return storage == SampleStorage::int8_stereo || storage == SampleStorage::int16_stereo ? 2 : 1;
+}
+
+// Lays out values, frames of channels values each, as Sample::prepare()
+// describes. Sets length to the frames that can be played and returns the
+// loop to play.
+template <typename T>
+static LoopParams lay_out_frames(std::vector<T>& values, size_t channels, const LoopParams& loop, size_t& length)
+{
+    const size_t guard = Sample::guard_frames;
+    LoopParams source_loop = loop;
+    if (source_loop.end > values.size() / channels || source_loop.begin >= source_loop.end) {
+        source_loop = LoopParams();
+    }
+    std::vector<T> data;
+    LoopParams playback_loop;
+    if (source_loop.is_off()) {
+        data.swap(values);
+    } else {
+        data.assign(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(source_loop.end * channels));
+        if (source_loop.is_pingpong()) {
+            data.reserve(data.size() + source_loop.length() * channels);
+            for (size_t f = 0; f < source_loop.length(); f++) {
+                const size_t from = (source_loop.end - 1 - f) * channels;
+                for (size_t c = 0; c < channels; c++) {
+                    data.push_back(data[from + c]);
+                }
+            }
+        }
+        playback_loop = LoopParams(LoopType::forward, source_loop.begin, static_cast<uint32_t>(data.size() / channels));
+    }
+    length = data.size() / channels;
+
+    values.assign(guard * channels, T(0));
+    values.insert(values.end(), data.begin(), data.end());
+    for (size_t i = 0; i < guard; i++) {
+        for (size_t c = 0; c < channels; c++) {
+            if (playback_loop.is_off()) {
+                values.push_back(T(0));
+            } else {
+                values.push_back(data[(playback_loop.begin + i % playback_loop.length()) * channels + c]);
+            }
+        }
+    }
+    values.shrink_to_fit();
+    return playback_loop;
+}
+
+void Sample::prepare()
+{
+    if (prepared) {
+        return;
+    }
+    prepared = true;
+    const size_t channels = storage_channels(_storage);
+    switch (_storage) {
+    case SampleStorage::float32:
+        _playback_loop = lay_out_frames(wavetable, channels, loop, _length);
+        break;
+    case SampleStorage::int8:
+    case SampleStorage::int8_stereo:
+        _playback_loop = lay_out_frames(pcm8, channels, loop, _length);
+        break;
+    case SampleStorage::int16:
+    case SampleStorage::int16_stereo:
+        _playback_loop = lay_out_frames(pcm16, channels, loop, _length);
+        break;
+    }
+}
+
+void Sample::set_pcm(std::vector<int8_t> frames, bool stereo)
+{
+    pcm8.swap(frames);
+    pcm16.clear();
+    wavetable.clear();
+    _storage = stereo ? SampleStorage::int8_stereo : SampleStorage::int8;
+    prepared = false;
+}
+
+void Sample::set_pcm(std::vector<int16_t> frames, bool stereo)
+{
+    pcm16.swap(frames);
+    pcm8.clear();
+    wavetable.clear();
+    _storage = stereo ? SampleStorage::int16_stereo : SampleStorage::int16;
+    prepared = false;
+}
+
+const void* Sample::frames() const
+{
+    const size_t guard = guard_frames * storage_channels(_storage);
+    switch (_storage) {
+    case SampleStorage::float32:
+        break;
+    case SampleStorage::int8:
+    case SampleStorage::int8_stereo:
+        return pcm8.data() + guard;
+    case SampleStorage::int16:
+    case SampleStorage::int16_stereo:
+        return pcm16.data() + guard;
+    }
+    return wavetable.data() + guard;
+}
+
+size_t Sample::frame_bytes() const
+{
+    return wavetable.capacity() * sizeof(float) + pcm8.capacity() * sizeof(int8_t)
+        + pcm16.capacity() * sizeof(int16_t);
+}
+
+// How many frames can be rendered before the playback position reaches the
+// end of the sample or of its loop.
+static size_t frames_until_boundary(const AudioChannel& data, size_t samples_remaining)
+{
+    const SamplePosition end = position_from_frames(data.length);
+    if (data.sample_step == 0) {
+        return samples_remaining;
+    }
+    const SamplePosition frames = (end - data.sample_index + data.sample_step - 1) / data.sample_step;
+    return frames < samples_remaining ? static_cast<size_t>(frames) : samples_remaining;
+}
+
+static void wrap_position(AudioChannel* data)
+{
+    if (data->sample_index < position_from_frames(data->length)) {
+        return;
+    }
+    if (data->loop.is_off()) {
+        data->disable();
+        return;
+    }
+    const SamplePosition begin = position_from_frames(data->loop.begin);
+    data->sample_index = begin + (data->sample_index - begin) % position_from_frames(data->loop.length());
+}
+
+void mix_audio(AudioChannel* data, StereoSample* out, size_t samples_remaining, MixKernel kernel)
+{
+    if (!data->is_active) {
+        return;
+    }
+    const float right_panning = data->panning * 0.5f + 0.5f;
+    const float left_panning = 1.0f - right_panning;
+    const float left_gain = data->volume * left_panning;
+    const float right_gain = data->volume * right_panning;
+    const auto mix_span = span_function(kernel, data->interpolation, data->storage);
+
+    while (data->is_active && samples_remaining) {
+        size_t n = frames_until_boundary(*data, samples_remaining);
+        mix_span(data->frames, data->sample_index, data->sample_step, n, left_gain, right_gain, out);
+        data->sample_index += n * data->sample_step;
+        out += n;
+        samples_remaining -= n;
+        wrap_position(data);
+    }
+}
+
+void skip_audio(AudioChannel* data, size_t frames)
+{
+    while (data->is_active && frames) {
+        const size_t n = frames_until_boundary(*data, frames);
+        data->sample_index += n * data->sample_step;
+        frames -= n;
+        wrap_position(data);
+    }
+}
+
+void render_audio(AudioChannel* data, StereoSample* out, size_t samples_remaining)
+{
     std::memset(out, 0, samples_remaining * sizeof(out[0]));
+    mix_audio(data, out, samples_remaining, best_mix_kernel());
+}
+
+Mixer::Mixer(size_t num_channels, int sample_rate, bool command_queue)
+    : channels(num_channels, AudioChannel(sample_rate))
+    , kernel(best_mix_kernel())
+    , commands(command_queue ? new CommandQueue : nullptr)
+    , _time(0)
+    , active((num_channels + 63) / 64)
+{
+    for (size_t i = 0; i < channels.size(); i++) {
+        channels[i].active_set = &active[i / 64];
+        channels[i].active_bit = uint64_t(1) << (i % 64);
+    }
+}
+
+size_t Mixer::memory_usage() const
+{
+    return sizeof(*this) + channels.capacity() * sizeof(AudioChannel) + active.capacity() * sizeof(uint64_t)
+        + (commands ? sizeof(CommandQueue) : 0);
+}
+
+size_t Mixer::active_count() const
+{
+    size_t count = 0;
+    for (uint64_t bits : active) {
+        count += static_cast<size_t>(__builtin_popcountll(bits));
+    }
+    return count;
+}
+
+// Walks the set bits in channel order, so channels are summed in the same
+// order as a plain loop over all of them would.
+void Mixer::mix_active(StereoSample* out, size_t frames)
+{
+    for (size_t word = 0; word < active.size(); word++) {
+        for (uint64_t bits = active[word]; bits; bits &= bits - 1) {
+            const auto bit = static_cast<size_t>(__builtin_ctzll(bits));
+            mix_audio(&channels[word * 64 + bit], out, frames, kernel);
+        }
+    }
+}
+
+void Mixer::mix_routed(StereoSample* const* stems, const uint8_t* route, size_t offset, size_t frames)
+{
+    for (size_t word = 0; word < active.size(); word++) {
+        for (uint64_t bits = active[word]; bits; bits &= bits - 1) {
+            const size_t c = word * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+            if (StereoSample* out = stems[route[c]]) {
+                mix_audio(&channels[c], out + offset, frames, kernel);
+            } else {
+                skip_audio(&channels[c], frames);
+            }
+        }
+    }
+}
+
+void Mixer::skip_active(size_t frames)
+{
+    for (size_t word = 0; word < active.size(); word++) {
+        for (uint64_t bits = active[word]; bits; bits &= bits - 1) {
+            const auto bit = static_cast<size_t>(__builtin_ctzll(bits));
+            skip_audio(&channels[word * 64 + bit], frames);
+        }
+    }
+}
+
+void Mixer::apply(const VoiceCommand& command)
+{
+    if (command.channel >= channels.size()) {
+        return;
+    }
+    auto& c = channels[command.channel];
+    switch (command.type) {
+    case VoiceCommand::Type::play:
+        if (command.sample) {
+            c.play(command.sample);
+        }
+        break;
+    case VoiceCommand::Type::stop:
+        c.disable();
+        break;
+    case VoiceCommand::Type::set_volume:
+        c.set_volume(command.value);
+        break;
+    case VoiceCommand::Type::set_panning:
+        c.set_panning(command.value);
+        break;
+    case VoiceCommand::Type::set_playback_rate:
+        c.set_playback_rate(command.value);
+        break;
+    case VoiceCommand::Type::set_interpolation:
+        c.interpolation = command.interpolation;
+        break;
+    }
 }
 
 void Mixer::render(StereoSample* out, size_t samples_to_render)
 {
     memset(out, 0, samples_to_render * sizeof(out[0]));
-    for (auto& c : channels_and_buffers) {
-        render_audio(&c.channel, &c.buffer[0], samples_to_render);
-        for (size_t i = 0; i < samples_to_render; i++) {
-            out[i].left += c.buffer[i].left;
-            out[i].right += c.buffer[i].right;
+    advance(out, samples_to_render);
+}
+
+void Mixer::render_routed(StereoSample* const* stems, size_t stem_count, const uint8_t* route, size_t frames)
+{
+    for (size_t i = 0; i < stem_count; i++) {
+        if (stems[i]) {
+            memset(stems[i], 0, frames * sizeof(stems[i][0]));
+        }
+    }
+    advance(nullptr, frames, stems, route);
+}
+
+void Mixer::skip(size_t frames)
+{
+    advance(nullptr, frames);
+}
+
+void Mixer::set_time(uint64_t frame)
+{
+    _time.store(frame, std::memory_order_release);
+}
+
+void Mixer::advance(StereoSample* out, size_t frames, StereoSample* const* stems, const uint8_t* route)
+{
+    const uint64_t start = _time.load(std::memory_order_relaxed);
+    size_t done = 0;
+    while (done < frames) {
+        // Render up to the next command due in this block, then apply it
+        size_t until = frames;
+        if (const VoiceCommand* command = commands ? commands->front() : nullptr) {
+            if (command->time <= start + done) {
+                apply(*command);
+                commands->pop();
+                continue;
+            }
+            if (command->time - start < until) {
+                until = command->time - start;
+            }
+        }
+        if (route) {
+            mix_routed(stems, route, done, until - done);
+        } else if (out) {
+            mix_active(out + done, until - done);
+        } else {
+            skip_active(until - done);
         }
+        done = until;
     }
+    _time.store(start + frames, std::memory_order_release);
 }
@@ -1,7 +1,10 @@
 #ifndef _MIXER_H_
 #define _MIXER_H_
+#include "spsc_queue.h"
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 template <typename T>
@@ -28,16 +31,108 @@ struct LoopParams {
         , end(e)
     {
     }
-    bool is_off() { return type == LoopType::none; }
-    bool is_forward() { return type == LoopType::forward; }
-    bool is_pingpong() { return type == LoopType::pingpong; }
-    uint32_t length() { return end - begin; }
+    bool is_off() const { return type == LoopType::none; }
+    bool is_forward() const { return type == LoopType::forward; }
+    bool is_pingpong() const { return type == LoopType::pingpong; }
+    uint32_t length() const { return end - begin; }
 };
 
+// How a sample's frames are stored. Samples from modules keep the width
+// they have in the file, and stereo ones both their channels, interleaved;
+// the mixer converts them to float (and mixes stereo down to mono) in
+// registers as it reads them.
+enum class SampleStorage : uint8_t {
+    float32,
+    int8,
+    int16,
+    int8_stereo,
+    int16_stereo,
+};
+
+const char* sample_storage_name(SampleStorage storage);
+// Bytes each frame takes
+size_t sample_storage_frame_bytes(SampleStorage storage);
+
 struct Sample {
+    static constexpr float default_c5_speed = 8363;
+    // Silence (or loop data) kept on both sides of the frames so the mixer
+    // and its interpolators can read past either end without checking.
+    static const size_t guard_frames = 16;
+
+    // Fill wavetable (or hand integer frames to set_pcm()) and loop, then
+    // call prepare() before playing the sample.
     std::vector<float> wavetable;
+    LoopParams loop;
+    float c5_speed = default_c5_speed; // playback rate of C-5, in Hz
+    uint8_t default_volume = 64; // 0->64
+    uint8_t global_volume = 64; // 0->64
+
+    // Lays wavetable out for playback: guard frames in front, ping-pong
+    // loops unrolled into a forward loop twice as long, data after the loop
+    // dropped, and guard frames after the end that continue the loop (or
+    // are silent if there's none). Safe to call more than once.
+    void prepare();
+    bool is_prepared() const { return prepared; }
+    // Keeps frames as they are rather than as floats in wavetable, which is
+    // cleared: 8 or 16-bit signed, with stereo frames left then right. Full
+    // scale is 128 or 32768.
+    void set_pcm(std::vector<int8_t> frames, bool stereo);
+    void set_pcm(std::vector<int16_t> frames, bool stereo);
+    SampleStorage storage() const { return _storage; }
+    // The first frame, after the guard, stored as storage() says
+    const void* frames() const;
+    // Bytes of frame data held, guards included
+    size_t frame_bytes() const;
+    // Frames that can be played: up to the end of the (unrolled) loop if
+    // there is one, otherwise the whole sample
+    size_t length() const { return _length; }
+    // Always forward or none; ping-pong loops have been unrolled
+    const LoopParams& playback_loop() const { return _playback_loop; }
+
+private:
+    bool prepared = false;
+    size_t _length = 0;
+    LoopParams _playback_loop;
+    SampleStorage _storage = SampleStorage::float32;
+    std::vector<int8_t> pcm8;
+    std::vector<int16_t> pcm16;
 };
 
+// How a channel reads the sample between two of its frames. The costlier
+// modes sound cleaner, most of all on samples played well below their
+// recorded pitch.
+enum class Interpolation {
+    nearest, // the frame the position falls in
+    linear, // a straight line between the two nearest frames
+    cubic, // a Catmull-Rom spline through the four nearest frames
+    sinc8, // windowed sinc, 8 taps
+    sinc16, // windowed sinc, 16 taps
+};
+
+const char* interpolation_name(Interpolation mode);
+// Sets mode and returns true if name is one of the names above.
+bool interpolation_from_name(const char* name, Interpolation& mode);
+
+// Playback positions and steps are 32.32 fixed point: whole frames in the
+// top 32 bits and the fraction of a frame in the bottom 32. Unlike a float
+// they stay exact however far into a sample playback gets.
+using SamplePosition = uint64_t;
+const unsigned position_fraction_bits = 32;
+
+inline SamplePosition position_from_frames(size_t frames)
+{
+    const SamplePosition whole = frames;
+    return whole << position_fraction_bits;
+}
+inline size_t position_frame(SamplePosition position)
+{
+    return position >> position_fraction_bits;
+}
+inline uint32_t position_fraction(SamplePosition position)
+{
+    return static_cast<uint32_t>(position);
+}
+
 struct AudioChannel {
     static constexpr float volume_mute = 0;
     static constexpr float volume_max = 1.0;
@@ -46,14 +141,25 @@ struct AudioChannel {
     static constexpr float panning_full_left = -1.0;
     static constexpr float panning_full_right = 1.0;
 
-    float volume;
-    float panning;
-    float sample_index;
-    float sample_step;
+    float volume = volume_max;
+    float panning = panning_center;
+    SamplePosition sample_index = 0;
+    SamplePosition sample_step = 0;
     LoopParams loop;
-    const Sample* sample;
-    bool is_active;
+    const Sample* sample = nullptr;
+    // Copied from the sample when it starts playing, so the mixer doesn't
+    // have to go through the sample for them on every run.
+    const void* frames = nullptr;
+    size_t length = 0;
+    SampleStorage storage = SampleStorage::float32;
+    Interpolation interpolation = Interpolation::nearest;
+    bool is_active = false;
     const int sample_rate;
+    // The word and bit of the owning mixer's set of sounding channels;
+    // enable() and disable() keep it up to date. Null for a channel used on
+    // its own.
+    uint64_t* active_set = nullptr;
+    uint64_t active_bit = 0;
 
     explicit AudioChannel(const int rate)
         : sample_rate(rate)
@@ -70,24 +176,58 @@ struct AudioChannel {
     void set_playback_rate(const float playback_rate)
     {
         if (playback_rate > 0) {
-            sample_step = playback_rate / sample_rate;
+            sample_step = static_cast<SamplePosition>(static_cast<double>(playback_rate) / sample_rate
+                * static_cast<double>(position_from_frames(1)));
         }
     }
-    void play(const Sample* samp, const LoopParams& loop_params)
+    // The sample must have been prepared.
+    void play(const Sample* samp)
     {
         sample = samp;
-        loop = loop_params;
+        loop = samp->playback_loop();
+        frames = samp->frames();
+        length = samp->length();
+        storage = samp->storage();
         sample_index = 0;
-        enable();
+        if (length) {
+            enable();
+        }
+    }
+
+    // Takes on other's playback state: everything but the sample rate and
+    // which mixer the channel belongs to.
+    void restore(const AudioChannel& other)
+    {
+        volume = other.volume;
+        panning = other.panning;
+        sample_index = other.sample_index;
+        sample_step = other.sample_step;
+        loop = other.loop;
+        sample = other.sample;
+        frames = other.frames;
+        length = other.length;
+        storage = other.storage;
+        interpolation = other.interpolation;
+        if (other.is_active) {
+            enable();
+        } else {
+            disable();
+        }
     }
 
     void enable()
     {
         is_active = true;
+        if (active_set) {
+            *active_set |= active_bit;
+        }
     }
     void disable()
     {
         is_active = false;
+        if (active_set) {
+            *active_set &= ~active_bit;
+        }
     }
 };
 
@@ -96,26 +236,144 @@ struct StereoSample {
     float right;
 };
 
-struct Mixer {
-    struct ChannelAndBuffer {
-        AudioChannel channel;
-        std::vector<StereoSample> buffer;
-        explicit ChannelAndBuffer(int sample_rate, size_t max_size)
-            : channel(sample_rate)
-            , buffer(max_size, { 0, 0 })
-        {
-        }
+// Inner loops that resample a run of frames and accumulate them straight
+// into the stereo output. Every kernel produces identical results; they only
+// differ in which instruction set they use.
+enum class MixKernel {
+    scalar,
+    sse2,
+    avx2,
+};
+
+bool mix_kernel_supported(MixKernel kernel);
+MixKernel best_mix_kernel();
+const char* mix_kernel_name(MixKernel kernel);
+
+// A change to one channel, sent from a control thread to the thread that
+// renders. time is a frame on the mixer's clock (see Mixer::time()); a
+// command whose time has already passed applies at the start of the next
+// block rendered.
+struct VoiceCommand {
+    enum class Type : uint8_t {
+        play,
+        stop,
+        set_volume,
+        set_panning,
+        set_playback_rate,
+        set_interpolation,
     };
-    std::vector<StereoSample> accmum_buffer;
-    std::vector<ChannelAndBuffer> channels_and_buffers;
-    Mixer(size_t num_channels, int sample_rate, size_t max_size)
-        : channels_and_buffers(num_channels,
-              ChannelAndBuffer(sample_rate, max_size))
+
+    uint64_t time = 0;
+    Type type = Type::stop;
+    uint16_t channel = 0;
+    const Sample* sample = nullptr; // play; must outlive the mixer's use of it
+    float value = 0; // volume, panning or playback rate
+    Interpolation interpolation = Interpolation::nearest;
+
+    static VoiceCommand play(uint64_t time, uint16_t channel, const Sample* sample)
+    {
+        VoiceCommand c(time, Type::play, channel);
+        c.sample = sample;
+        return c;
+    }
+    static VoiceCommand stop(uint64_t time, uint16_t channel) { return VoiceCommand(time, Type::stop, channel); }
+    static VoiceCommand set_volume(uint64_t time, uint16_t channel, float volume)
+    {
+        return VoiceCommand(time, Type::set_volume, channel, volume);
+    }
+    static VoiceCommand set_panning(uint64_t time, uint16_t channel, float panning)
+    {
+        return VoiceCommand(time, Type::set_panning, channel, panning);
+    }
+    static VoiceCommand set_playback_rate(uint64_t time, uint16_t channel, float rate)
+    {
+        return VoiceCommand(time, Type::set_playback_rate, channel, rate);
+    }
+    static VoiceCommand set_interpolation(uint64_t time, uint16_t channel, Interpolation mode)
     {
+        VoiceCommand c(time, Type::set_interpolation, channel);
+        c.interpolation = mode;
+        return c;
     }
+
+    VoiceCommand() = default;
+    VoiceCommand(uint64_t t, Type ty, uint16_t ch, float v = 0)
+        : time(t)
+        , type(ty)
+        , channel(ch)
+        , value(v)
+    {
+    }
+};
+
+struct Mixer {
+    // Room for a thousand commands between two audio callbacks
+    using CommandQueue = SpscQueue<VoiceCommand, 1024>;
+
+    std::vector<AudioChannel> channels;
+    MixKernel kernel;
+    // The way for another thread to change channels while render() runs.
+    // One thread pushes, in order of time; render() applies each command
+    // at the frame it names. Commands naming a channel that doesn't exist
+    // are dropped. Null in mixers made without a queue.
+    std::unique_ptr<CommandQueue> commands;
+
+    // The command queue takes 32 KiB, which matters when there are
+    // thousands of mixers; one driven directly by its owner, as a
+    // SongPlayer's is, can go without.
+    Mixer(size_t num_channels, int sample_rate, bool command_queue = true);
+    // Renders the next samples_remaining frames of all channels into out,
+    // applying queued commands as their time comes. Never locks or allocates.
+    // Only the channels that are sounding cost anything.
     void render(StereoSample* out, size_t samples_remaining);
-    AudioChannel& channel(size_t i) { return channels_and_buffers[i].channel; }
+    // Like render(), but each channel goes to a buffer of its own: channel i
+    // is mixed into stems[route[i]], or only moved on if that's null. Every
+    // buffer in stems[0, stem_count) that isn't null is cleared first. For
+    // rendering groups of channels apart from each other, as stems.
+    void render_routed(StereoSample* const* stems, size_t stem_count, const uint8_t* route, size_t frames);
+    // Moves on by frames as render() would, applying commands on the way,
+    // but without producing any audio. Much cheaper than rendering.
+    void skip(size_t frames);
+    size_t active_count() const;
+    AudioChannel& channel(size_t i) { return channels[i]; }
+    // Bytes owned by the mixer, including the object itself.
+    size_t memory_usage() const;
+    // Frames rendered so far. Safe to read from any thread; a control thread
+    // schedules commands relative to it.
+    uint64_t time() const { return _time.load(std::memory_order_acquire); }
+    // Moves the clock, as when restoring a saved state. Not while rendering.
+    void set_time(uint64_t frame);
+    // Applies a command right away. Only for the rendering thread, or when
+    // nothing is rendering.
+    void apply(const VoiceCommand& command);
+    // Switches every channel to mode; channels can still be changed one by one afterwards.
+    void set_interpolation(Interpolation mode)
+    {
+        for (auto& c : channels) {
+            c.interpolation = mode;
+        }
+    }
+
+private:
+    // Renders into out, or only moves the channels on if out is null. With
+    // a route, renders as render_routed() does instead.
+    void advance(StereoSample* out, size_t frames, StereoSample* const* stems = nullptr,
+        const uint8_t* route = nullptr);
+    void mix_active(StereoSample* out, size_t frames);
+    // Mixes into the stems starting at frame offset
+    void mix_routed(StereoSample* const* stems, const uint8_t* route, size_t offset, size_t frames);
+    void skip_active(size_t frames);
+
+    std::atomic<uint64_t> _time;
+    // One bit per channel, set while it's sounding
+    std::vector<uint64_t> active;
 };
 
-void render_audio(AudioChannel* data, StereoSample* out, int samples_remaining);
+// Adds the channel's output to out, advancing its playback position. Uses
+// the channel's interpolation.
+void mix_audio(AudioChannel* data, StereoSample* out, size_t samples_remaining, MixKernel kernel);
+// Advances the channel's playback position as mix_audio would, without mixing.
+void skip_audio(AudioChannel* data, size_t frames);
+// Renders the channel alone into out, overwriting whatever was there.
+void render_audio(AudioChannel* data, StereoSample* out, size_t samples_remaining);
 #endif
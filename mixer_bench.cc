@@ -0,0 +1,153 @@
+#include "mixer.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#define SAMPLE_RATE (44100)
+#define FRAMES_PER_BUFFER (1024)
+#define TOTAL_CHANNELS (64)
+
+static Sample make_test_sample(LoopType loop_type)
+{
+    Sample s;
+    s.wavetable.resize(SAMPLE_RATE);
+    for (size_t i = 0; i < s.wavetable.size(); i++) {
+        s.wavetable[i] = std::sin(static_cast<float>(i) * 0.05f) * 0.5f;
+    }
+    const auto size = static_cast<uint32_t>(s.wavetable.size());
+    s.loop = loop_type == LoopType::pingpong ? LoopParams(LoopType::pingpong, size / 4, size)
+                                             : LoopParams(LoopType::forward, size / 2, size);
+    s.prepare();
+    return s;
+}
+
+static void start_voices(Mixer& mix, const Sample samples[2], size_t active)
+{
+    for (size_t i = 0; i < mix.channels.size(); i++) {
+        auto& channel = mix.channel(i);
+        channel.disable();
+        if (i >= active) {
+            continue;
+        }
+        // Alternate loop types and detune every voice so the runs between
+        // loop boundaries differ from channel to channel.
+        channel.play(&samples[i % 2]);
+        channel.set_volume(AudioChannel::volume_max / static_cast<float>(active));
+        channel.set_panning(static_cast<float>(i % 9) / 4.0f - 1.0f);
+        channel.set_playback_rate(22050.0f * (1.0f + static_cast<float>(i) * 0.01f));
+    }
+}
+
+// How the mixer used to find its voices: look at every channel in turn.
+static void render_all_channels(Mixer& mix, StereoSample* out, size_t frames)
+{
+    std::fill(out, out + frames, StereoSample { 0, 0 });
+    for (auto& channel : mix.channels) {
+        mix_audio(&channel, out, frames, mix.kernel);
+    }
+}
+
+// The mixer used to render every channel into its own buffer and then sum
+// the buffers in a second pass. Kept here as the baseline to compare against.
+static void render_two_pass(Mixer& mix, std::vector<std::vector<StereoSample>>& buffers,
+    StereoSample* out, size_t frames)
+{
+    std::fill(out, out + frames, StereoSample { 0, 0 });
+    for (size_t c = 0; c < mix.channels.size(); c++) {
+        auto& buffer = buffers[c];
+        std::fill(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(frames), StereoSample { 0, 0 });
+        mix_audio(&mix.channels[c], &buffer[0], frames, mix.kernel);
+        for (size_t i = 0; i < frames; i++) {
+            out[i].left += buffer[i].left;
+            out[i].right += buffer[i].right;
+        }
+    }
+}
+
+template <typename RenderFunction>
+static double frames_per_second(RenderFunction render)
+{
+    using clock = std::chrono::steady_clock;
+    const size_t blocks = 2000;
+    render(); // warm up
+    auto start = clock::now();
+    for (size_t i = 0; i < blocks; i++) {
+        render();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return static_cast<double>(blocks * FRAMES_PER_BUFFER) / elapsed.count();
+}
+
+int main()
+{
+    const Sample samples[2] = { make_test_sample(LoopType::forward), make_test_sample(LoopType::pingpong) };
+    std::vector<StereoSample> out(FRAMES_PER_BUFFER);
+    std::vector<std::vector<StereoSample>> buffers(TOTAL_CHANNELS, std::vector<StereoSample>(FRAMES_PER_BUFFER));
+    const MixKernel kernels[] = { MixKernel::scalar, MixKernel::sse2, MixKernel::avx2 };
+    const size_t voice_counts[] = { 8, 32, 64 };
+
+    printf("%-10s %8s %16s %16s\n", "kernel", "voices", "fused frames/s", "two-pass frames/s");
+    for (size_t active : voice_counts) {
+        Mixer mix(TOTAL_CHANNELS, SAMPLE_RATE);
+        for (auto kernel : kernels) {
+            if (!mix_kernel_supported(kernel)) {
+                continue;
+            }
+            mix.kernel = kernel;
+            start_voices(mix, samples, active);
+            double fused = frames_per_second([&] { mix.render(&out[0], out.size()); });
+            start_voices(mix, samples, active);
+            double two_pass = frames_per_second([&] { render_two_pass(mix, buffers, &out[0], out.size()); });
+            printf("%-10s %8zu %16.0f %16.0f\n", mix_kernel_name(kernel), active, fused, two_pass);
+        }
+    }
+
+    // What one voice costs with each interpolation, and how many of them a
+    // core could mix in real time at this rate.
+    const Interpolation modes[] = { Interpolation::nearest, Interpolation::linear, Interpolation::cubic,
+        Interpolation::sinc8, Interpolation::sinc16 };
+    const size_t voices = 32;
+    printf("\n%-10s %-10s %16s %16s\n", "kernel", "interp", "ns/voice/frame", "realtime voices");
+    for (auto kernel : kernels) {
+        if (!mix_kernel_supported(kernel)) {
+            continue;
+        }
+        Mixer mix(voices, SAMPLE_RATE);
+        mix.kernel = kernel;
+        for (auto mode : modes) {
+            mix.set_interpolation(mode);
+            start_voices(mix, samples, voices);
+            double rate = frames_per_second([&] { mix.render(&out[0], out.size()); });
+            double ns_per_voice = 1e9 / rate / static_cast<double>(voices);
+            printf("%-10s %-10s %16.2f %16.0f\n", mix_kernel_name(kernel), interpolation_name(mode),
+                ns_per_voice, 1e9 / ns_per_voice / SAMPLE_RATE);
+        }
+    }
+
+    // The cost of a block as voices start sounding on a large mixer, walking
+    // only the active channels versus checking every channel.
+    const size_t pool_channels = 256;
+    const size_t sweep[] = { 0, 1, 2, 4, 8, 16, 32, 64 };
+    printf("\n%8s %8s %18s %18s\n", "channels", "active", "active-set us/blk", "scan-all us/blk");
+    for (size_t active : sweep) {
+        Mixer mix(pool_channels, SAMPLE_RATE);
+        // Spread the voices over the whole pool rather than the first channels
+        auto spread = [&] {
+            start_voices(mix, samples, 0);
+            for (size_t i = 0; i < active; i++) {
+                auto& channel = mix.channel(i * pool_channels / active);
+                channel.play(&samples[i % 2]);
+                channel.set_volume(AudioChannel::volume_max / static_cast<float>(active));
+                channel.set_playback_rate(22050.0f * (1.0f + static_cast<float>(i) * 0.01f));
+            }
+        };
+        spread();
+        double with_set = frames_per_second([&] { mix.render(&out[0], out.size()); });
+        spread();
+        double scan_all = frames_per_second([&] { render_all_channels(mix, &out[0], out.size()); });
+        printf("%8zu %8zu %18.3f %18.3f\n", pool_channels, active,
+            1e6 * FRAMES_PER_BUFFER / with_set, 1e6 * FRAMES_PER_BUFFER / scan_all);
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "module_analysis.h"
+#include <algorithm>
+#include <cstdio>
+
+void TextBuffer::grow(size_t size)
+{
+    buffer.resize(std::max(buffer.size() * 2, size));
+}
+
+void TextBuffer::append(const char* s, size_t n)
+{
+    memcpy(reserve(n), s, n);
+    _size += n;
+}
+
+void TextBuffer::append(char c)
+{
+    *reserve(1) = c;
+    ++_size;
+}
+
+void TextBuffer::append_uint(uint64_t value)
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    char* out = reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        out[i] = digits[n - 1 - i];
+    }
+    _size += n;
+}
+
+void TextBuffer::append_fixed(double value, int decimals)
+{
+    char* out = reserve(32);
+    const int n = snprintf(out, 32, "%.*f", decimals, value);
+    _size += static_cast<size_t>(std::min(std::max(n, 0), 31));
+}
+
+void TextBuffer::append_json_string(const std::string& s)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    append('"');
+    for (char c : s) {
+        const auto u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            append('\\');
+            append(c);
+        } else if (u < 0x20 || u >= 0x7F) {
+            // Module names are in a DOS code page, not UTF-8
+            append("\\u00", 4);
+            append(hex_digits[u >> 4]);
+            append(hex_digits[u & 15]);
+        } else {
+            append(c);
+        }
+    }
+    append('"');
+}
+
+ModuleStats analyze_module(const Module& mod, uint64_t max_ticks)
+{
+    using Type = ModuleStats::CommandType;
+    ModuleStats stats;
+    stats.song_name = mod.song_name;
+    stats.patterns = mod.pattern_count();
+    stats.samples = mod.samples.size();
+    stats.instruments = mod.use_instruments ? mod.instruments.size() : 0;
+    for (uint8_t order : mod.orders) {
+        if (order == Module::order_end) {
+            break;
+        }
+        if (order != Module::order_skip) {
+            stats.orders++;
+        }
+    }
+
+    std::vector<bool> seen(mod.pattern_count());
+    for (uint8_t order : mod.orders) {
+        if (order >= seen.size() || seen[order]) {
+            continue;
+        }
+        seen[order] = true;
+        const auto pattern = mod.pattern(order);
+        stats.channels_used |= pattern->channels_used();
+        for (size_t r = 0; r < pattern->row_count(); r++) {
+            const auto row = pattern->row(r);
+            for (size_t i = 0; i < row.size(); i++) {
+                const auto& entry = row[i];
+                if (!entry.comms[0].is_type(Type::none)) {
+                    stats.volume_effects[static_cast<size_t>(entry.comms[0].type())]++;
+                }
+                if (!entry.comms[1].is_type(Type::none)) {
+                    stats.effects[static_cast<size_t>(entry.comms[1].type())]++;
+                }
+            }
+        }
+    }
+
+    // Ticks last 2.5 / tempo seconds, as SongPlayer plays them
+    PlayerContext player(&mod);
+    while (!(player.loop_count > 0 && player.ticks_to_next_row == 0)) {
+        if (stats.length_ticks == max_ticks) {
+            stats.length_complete = false;
+            break;
+        }
+        player.process_tick();
+        player.updated_channels = 0;
+        stats.length_ticks++;
+        stats.length_seconds += 2.5 / player.tempo;
+    }
+
+    for (const auto& sample : mod.samples) {
+        stats.sample_frames += sample.length();
+    }
+    stats.sample_bytes = module_memory_usage(mod).samples;
+    return stats;
+}
+
+// The letters of the effects used, in alphabetical order
+static void append_effect_letters(const std::array<size_t, static_cast<size_t>(ModuleStats::CommandType::count)>& counts,
+    TextBuffer& out)
+{
+    out.append('"');
+    for (size_t t = 0; t < counts.size(); t++) {
+        if (counts[t]) {
+            out.append(PatternEntry::Command::letter(static_cast<ModuleStats::CommandType>(t)));
+        }
+    }
+    out.append('"');
+}
+
+void format_stats_json(const ModuleStats& stats, const std::string& path, TextBuffer& out)
+{
+    out.append("{\"file\": ");
+    out.append_json_string(path);
+    out.append(", \"song_name\": ");
+    out.append_json_string(stats.song_name);
+    out.append(", \"orders\": ");
+    out.append_uint(stats.orders);
+    out.append(", \"patterns\": ");
+    out.append_uint(stats.patterns);
+    out.append(", \"samples\": ");
+    out.append_uint(stats.samples);
+    out.append(", \"instruments\": ");
+    out.append_uint(stats.instruments);
+    out.append(", \"channels_used\": [");
+    bool first = true;
+    for (uint64_t bits = stats.channels_used; bits; bits &= bits - 1) {
+        if (!first) {
+            out.append(", ", 2);
+        }
+        first = false;
+        out.append_uint(static_cast<uint64_t>(__builtin_ctzll(bits)) + 1);
+    }
+    out.append("], \"effects\": ");
+    append_effect_letters(stats.effects, out);
+    out.append(", \"volume_column\": ");
+    append_effect_letters(stats.volume_effects, out);
+    out.append(", \"length_ticks\": ");
+    out.append_uint(stats.length_ticks);
+    out.append(", \"length_seconds\": ");
+    out.append_fixed(stats.length_seconds, 3);
+    out.append(", \"length_complete\": ");
+    out.append(stats.length_complete ? "true" : "false");
+    out.append(", \"sample_frames\": ");
+    out.append_uint(stats.sample_frames);
+    out.append(", \"sample_bytes\": ");
+    out.append_uint(stats.sample_bytes);
+    out.append("}\n");
+}
+
+void dump_patterns(const Module& mod, TextBuffer& out)
+{
+    for (size_t p = 0; p < mod.pattern_count(); p++) {
+        const auto pattern = mod.pattern(p);
+        out.append("Pattern ");
+        out.append_uint(p);
+        out.append(", ");
+        out.append_uint(pattern->row_count());
+        out.append(" rows\n");
+        const uint64_t used = pattern->channels_used();
+        const size_t columns = used ? 64 - static_cast<size_t>(__builtin_clzll(used)) : 0;
+        for (size_t r = 0; r < pattern->row_count(); r++) {
+            // The row number, then an entry per channel
+            char* text = out.reserve(4 + columns * (PatternEntry::text_length + 1) + 1);
+            text[0] = static_cast<char>('0' + r / 100 % 10);
+            text[1] = static_cast<char>('0' + r / 10 % 10);
+            text[2] = static_cast<char>('0' + r % 10);
+            text[3] = '|';
+            text += 4;
+            for (size_t c = 0; c < columns; c++) {
+                text = pattern->entry(r, c).format(text);
+                *text++ = '|';
+            }
+            *text++ = '\n';
+            out.commit(text);
+        }
+    }
+}
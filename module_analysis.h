@@ -0,0 +1,84 @@
+#ifndef _MODULE_ANALYSIS_H_
+#define _MODULE_ANALYSIS_H_
+#include "player.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Text built up in a buffer that's kept from one use to the next: once it
+// has grown to fit the biggest output, formatting into it allocates nothing.
+class TextBuffer {
+public:
+    void clear() { _size = 0; }
+    // Room for n more characters at the end. Write them there, then pass
+    // the end of what was written to commit().
+    char* reserve(size_t n)
+    {
+        if (buffer.size() < _size + n) {
+            grow(_size + n);
+        }
+        return buffer.data() + _size;
+    }
+    void commit(const char* end) { _size = static_cast<size_t>(end - buffer.data()); }
+    void append(const char* s, size_t n);
+    void append(const char* s) { append(s, strlen(s)); }
+    void append(char c);
+    void append_uint(uint64_t value);
+    // With the given number of decimal places
+    void append_fixed(double value, int decimals);
+    // In quotes, escaped for JSON
+    void append_json_string(const std::string& s);
+    const char* data() const { return buffer.data(); }
+    size_t size() const { return _size; }
+
+private:
+    void grow(size_t size);
+
+    std::vector<char> buffer;
+    size_t _size = 0;
+};
+
+// What there is to know about a module without playing it out loud
+struct ModuleStats {
+    using CommandType = PatternEntry::Command::Type;
+
+    std::string song_name;
+    size_t orders = 0; // not counting "+++" markers and what follows the end
+    size_t patterns = 0;
+    size_t samples = 0;
+    size_t instruments = 0;
+    // One bit per channel with anything in it in a pattern that's played
+    uint64_t channels_used = 0;
+    // Cells in played patterns using each effect, by type, in the effect
+    // column and in the volume column
+    std::array<size_t, static_cast<size_t>(CommandType::count)> effects;
+    std::array<size_t, static_cast<size_t>(CommandType::count)> volume_effects;
+    // One pass through the song, as the sequencer plays it
+    uint64_t length_ticks = 0;
+    double length_seconds = 0;
+    // False if the song was still going when we gave up on it
+    bool length_complete = true;
+    size_t sample_frames = 0;
+    size_t sample_bytes = 0; // as loaded into memory
+
+    ModuleStats()
+    {
+        effects.fill(0);
+        volume_effects.fill(0);
+    }
+};
+
+// Runs the sequencer through the song without mixing anything, so it costs
+// next to nothing beside rendering. Songs that would play for more than
+// max_ticks ticks are cut short there.
+ModuleStats analyze_module(const Module& mod, uint64_t max_ticks = uint64_t(1) << 24);
+
+// Appends the stats as a single line of JSON, with path as the module's file.
+void format_stats_json(const ModuleStats& stats, const std::string& path, TextBuffer& out);
+
+// Appends the text of every pattern, row by row, as far as the last channel
+// the pattern uses.
+void dump_patterns(const Module& mod, TextBuffer& out);
+#endif
@@ -0,0 +1,72 @@
+#include "module_files.h"
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static bool has_module_extension(const std::string& name)
+{
+    if (name.size() < 3) {
+        return false;
+    }
+    std::string extension = name.substr(name.size() - 3);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    return extension == ".it";
+}
+
+static bool is_directory(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+static void search_directory(const std::string& directory, std::vector<std::string>& found)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return;
+    }
+    while (const dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = directory + "/" + name;
+        if (is_directory(path)) {
+            search_directory(path, found);
+        } else if (has_module_extension(name)) {
+            found.push_back(path);
+        }
+    }
+    closedir(dir);
+}
+
+std::vector<std::string> find_modules(const std::vector<std::string>& paths)
+{
+    std::vector<std::string> found;
+    for (const auto& path : paths) {
+        if (is_directory(path)) {
+            search_directory(path, found);
+        } else {
+            found.push_back(path);
+        }
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+std::string module_basename(const std::string& path)
+{
+    const size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    const size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+size_t file_size(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
@@ -0,0 +1,17 @@
+#ifndef _MODULE_FILES_H_
+#define _MODULE_FILES_H_
+#include <string>
+#include <vector>
+
+// Expands a list of files and directories into the module files they name.
+// Directories are searched recursively for files ending in ".it" (in any
+// case); plain files are passed through as given. The result is sorted and
+// has no duplicates.
+std::vector<std::string> find_modules(const std::vector<std::string>& paths);
+
+// The file name without its directory or extension.
+std::string module_basename(const std::string& path);
+
+// Size of the file in bytes, or 0 if it can't be read.
+size_t file_size(const std::string& path);
+#endif
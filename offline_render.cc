@@ -0,0 +1,48 @@
+#include "offline_render.h"
+#include "song.h"
+#include <chrono>
+#include <memory>
+#include <vector>
+
+void set_up_master_bus(MasterBus& bus, const Module& mod, const RenderOptions& options)
+{
+    bus.gain = mod.mix_gain();
+    bus.clipping = options.clipping;
+    bus.dither = options.dither;
+}
+
+RenderResult render_module(const std::string& module_path, const std::string& output_path,
+    const RenderOptions& options)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    Module mod = load_module(module_path);
+    std::unique_ptr<AudioFileWriter> writer;
+    if (!output_path.empty()) {
+        writer.reset(new AudioFileWriter(output_path, file_type_for_path(output_path), options.format,
+            options.sample_rate));
+        set_up_master_bus(writer->master_bus(), mod, options);
+    }
+    SongPlayer song(&mod, options.sample_rate, options.voice_limit);
+    song.mixer.set_interpolation(options.interpolation);
+    std::vector<StereoSample> buffer(song.max_tick_frames());
+    const auto max_frames = static_cast<size_t>(options.max_seconds * options.sample_rate);
+
+    RenderResult result;
+    while (!song.finished() && (max_frames == 0 || result.frames < max_frames)) {
+        size_t frames = song.render_tick(&buffer[0]);
+        if (writer) {
+            writer->write(&buffer[0], frames);
+        }
+        result.frames += frames;
+    }
+    if (writer) {
+        writer->close();
+    }
+
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    result.elapsed_seconds = elapsed.count();
+    result.audio_seconds = static_cast<double>(result.frames) / options.sample_rate;
+    return result;
+}
@@ -0,0 +1,35 @@
+#ifndef _OFFLINE_RENDER_H_
+#define _OFFLINE_RENDER_H_
+#include "audio_file.h"
+#include "master_bus.h"
+#include "mixer.h"
+#include "player.h"
+#include <string>
+
+struct RenderOptions {
+    int sample_rate = 44100;
+    SampleFormat format = SampleFormat::int16;
+    double max_seconds = 0; // 0 renders the whole song
+    Interpolation interpolation = Interpolation::nearest;
+    size_t voice_limit = 256; // most voices sounding at once
+    Clipping clipping = Clipping::hard;
+    bool dither = false;
+};
+
+struct RenderResult {
+    size_t frames = 0;
+    double audio_seconds = 0;
+    double elapsed_seconds = 0; // wall time, including loading the module
+
+    double realtime_factor() const { return elapsed_seconds > 0 ? audio_seconds / elapsed_seconds : 0; }
+};
+
+// Sets the bus up as options say, with the song's mix volume as its gain.
+void set_up_master_bus(MasterBus& bus, const Module& mod, const RenderOptions& options);
+
+// Loads a module and renders it as fast as possible. The audio is written to
+// output_path, or thrown away if output_path is empty. Throws
+// std::runtime_error if the module can't be loaded or the file written.
+RenderResult render_module(const std::string& module_path, const std::string& output_path,
+    const RenderOptions& options);
+#endif
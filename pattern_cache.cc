@@ -0,0 +1,204 @@
+#include "pattern_cache.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <stdexcept>
+#include <thread>
+
+// One thread shared by every cache in the process, so prefetching costs a
+// thread per program rather than one per loaded module.
+class PatternPrefetcher {
+public:
+    static PatternPrefetcher& instance()
+    {
+        static PatternPrefetcher prefetcher;
+        return prefetcher;
+    }
+
+    void enqueue(std::weak_ptr<PatternCache> cache, size_t index)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.emplace_back(std::move(cache), index);
+        }
+        wake.notify_one();
+    }
+
+    ~PatternPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+private:
+    PatternPrefetcher()
+        : stopping(false)
+        , thread(&PatternPrefetcher::run, this)
+    {
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] { return stopping || !requests.empty(); });
+            if (stopping) {
+                return;
+            }
+            auto request = std::move(requests.front());
+            requests.pop_front();
+            lock.unlock();
+            // The cache may have been destroyed since the request was made
+            if (auto cache = request.first.lock()) {
+                if (!cache->lookup(request.second)) {
+                    cache->insert(request.second, cache->decode(request.second));
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::pair<std::weak_ptr<PatternCache>, size_t>> requests;
+    bool stopping;
+    std::thread thread;
+};
+
+static std::shared_ptr<const Pattern> empty_pattern()
+{
+    static const auto empty = std::make_shared<Pattern>();
+    return empty;
+}
+
+PatternCache::PatternCache(std::vector<std::vector<uint8_t>> packed_patterns, size_t max_cached)
+    : packed(std::move(packed_patterns))
+    , capacity(max_cached ? max_cached : 1)
+    , slots(packed.size())
+{
+    for (auto& slot : slots) {
+        slot.lru_position = lru.end();
+    }
+}
+
+size_t PatternCache::row_count(size_t index) const
+{
+    if (index >= packed.size() || packed[index].size() < sizeof(it_file::pattern_header)) {
+        return Pattern::default_rows;
+    }
+    const auto header = ByteView(packed[index].data(), packed[index].size()).read<it_file::pattern_header>(0);
+    return header.row_num ? header.row_num : Pattern::default_rows;
+}
+
+std::shared_ptr<const Pattern> PatternCache::lookup(size_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = slots[index];
+    if (slot.pattern) {
+        lru.splice(lru.begin(), lru, slot.lru_position);
+    }
+    return slot.pattern;
+}
+
+void PatternCache::insert(size_t index, std::shared_ptr<const Pattern> pattern)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = slots[index];
+    if (slot.pattern) { // Someone else decoded it first
+        return;
+    }
+    if (lru.size() >= capacity) {
+        auto& victim = slots[lru.back()];
+        victim.pattern.reset();
+        victim.lru_position = lru.end();
+        lru.pop_back();
+    }
+    slot.pattern = std::move(pattern);
+    lru.push_front(index);
+    slot.lru_position = lru.begin();
+}
+
+std::shared_ptr<const Pattern> PatternCache::decode(size_t index) const
+{
+    const auto& bytes = packed[index];
+    if (bytes.empty()) {
+        return empty_pattern();
+    }
+    try {
+        return std::make_shared<Pattern>(unpack_pattern(ByteView(bytes.data(), bytes.size()), 0));
+    } catch (const std::runtime_error&) {
+        return empty_pattern();
+    }
+}
+
+std::shared_ptr<const Pattern> PatternCache::get(size_t index)
+{
+    if (index >= packed.size()) {
+        return empty_pattern();
+    }
+    if (auto pattern = lookup(index)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        _stats.hits++;
+        return pattern;
+    }
+    auto pattern = decode(index);
+    insert(index, pattern);
+    std::lock_guard<std::mutex> lock(mutex);
+    _stats.misses++;
+    return pattern;
+}
+
+void PatternCache::prefetch(size_t index)
+{
+    if (index >= packed.size()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots[index].pattern) {
+            return;
+        }
+        _stats.prefetches++;
+    }
+    PatternPrefetcher::instance().enqueue(shared_from_this(), index);
+}
+
+void PatternCache::load_all()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = std::max(capacity, packed.size());
+    }
+    for (size_t i = 0; i < packed.size(); i++) {
+        get(i);
+    }
+}
+
+PatternCache::Stats PatternCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return _stats;
+}
+
+size_t PatternCache::packed_bytes() const
+{
+    size_t bytes = sizeof(*this) + packed.capacity() * sizeof(packed[0]) + slots.capacity() * sizeof(Slot);
+    for (const auto& p : packed) {
+        bytes += p.capacity();
+    }
+    return bytes;
+}
+
+size_t PatternCache::cached_bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (size_t index : lru) {
+        bytes += slots[index].pattern->memory_usage();
+    }
+    return bytes;
+}
@@ -0,0 +1,64 @@
+#ifndef _PATTERN_CACHE_H_
+#define _PATTERN_CACHE_H_
+#include "player.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Holds a module's patterns in their packed on-disk form and decodes them on
+// first use. At most `capacity` decoded patterns are kept; the least recently
+// used one is dropped to make room. Patterns are handed out as shared
+// pointers, so one that is evicted while a player is still on it stays alive
+// until the player moves on.
+//
+// Safe to use from several threads at once.
+class PatternCache : public std::enable_shared_from_this<PatternCache> {
+public:
+    static const size_t default_capacity = 16;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t prefetches = 0;
+    };
+
+    // Each element of packed is a pattern header followed by its packed
+    // rows, or empty for the blank patterns a file stores as offset 0.
+    PatternCache(std::vector<std::vector<uint8_t>> packed, size_t capacity = default_capacity);
+
+    size_t size() const { return packed.size(); }
+    size_t row_count(size_t index) const;
+    // Returns the decoded pattern, decoding it now if it isn't cached. Indexes
+    // past the end, and patterns that fail to decode, come back empty.
+    std::shared_ptr<const Pattern> get(size_t index);
+    // Decodes the pattern on the background prefetch thread if it isn't
+    // cached yet. Never blocks on the decode.
+    void prefetch(size_t index);
+    // Decodes every pattern and keeps them all from then on, so get() never
+    // has to decode (or allocate) again. For real-time playback.
+    void load_all();
+
+    Stats stats() const;
+    size_t packed_bytes() const;
+    size_t cached_bytes() const;
+
+private:
+    struct Slot {
+        std::shared_ptr<const Pattern> pattern;
+        std::list<size_t>::iterator lru_position;
+    };
+
+    std::shared_ptr<const Pattern> lookup(size_t index);
+    void insert(size_t index, std::shared_ptr<const Pattern> pattern);
+    std::shared_ptr<const Pattern> decode(size_t index) const;
+    friend class PatternPrefetcher;
+
+    const std::vector<std::vector<uint8_t>> packed;
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::vector<Slot> slots;
+    std::list<size_t> lru; // most recently used first
+    Stats _stats;
+};
+#endif
@@ -1,250 +1,104 @@
-#include <array>
-#include <fstream>
-#include <iomanip>
-#include <iostream>
-#include <sstream>
-#include <vector>
+#include "player.h"
+#include "it_sample.h"
+#include "pattern_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
 
-struct PatternEntry {
-    class Note {
-        static const uint8_t empty = 253;
-        static const uint8_t cut = 254;
-        static const uint8_t off = 255;
-
-    public:
-        std::string to_string() const
-        {
-            if (is_empty()) {
-                return "...";
-            }
-            if (is_cut()) {
-                return "===";
-            }
-            if (is_off()) {
-                return "---";
-            }
-            static const std::string note_names[] = {
-                "C-", "C#", "D-", "D#", "E-", "F-", "F#", "G-", "G#", "A-", "A#", "B-"
-            };
-            return note_names[semitone()] + std::to_string(octave());
-        }
-        bool is_note() const { return _index < 190; }
-        bool is_empty() const { return _index == empty; }
-        bool is_cut() const { return _index == cut; }
-        bool is_off() const { return _index == off; }
-        int octave() const { return _index / 12; }
-        int semitone() const { return _index % 12; }
-        int period() const
-        {
-            static const short periods[] = {
-                1712,
-                1616,
-                1524,
-                1440,
-                1356,
-                1280,
-                1208,
-                1140,
-                1076,
-                1016,
-                960,
-                907
-            };
-            return 32 * periods[semitone()] >> octave();
-        }
-        operator int() const { return _index; }
-        Note() = default;
-        explicit Note(const uint8_t i)
-            : _index(i)
-        {
-        }
-
-    private:
-        uint8_t _index = empty;
-    };
-    class Inst {
-    public:
-        static const uint8_t empty = 255;
-        Inst() = default;
-        operator int() const { return _index; }
-        bool is_empty() const { return _index == empty; }
-        explicit Inst(const uint8_t i)
-            : _index(i)
-        {
-        }
-        std::string to_string() const
-        {
-            if (is_empty()) {
-                return "..";
-            }
-            std::stringstream ss;
-            ss << std::setfill('0') << std::setw(2) << static_cast<int>(_index);
-            return ss.str();
-        }
-
-    private:
-        uint8_t _index = empty;
-    };
-    class Command {
-    public:
-        enum class Type : uint8_t {
-            none,
-            set_speed,
-            set_tempo,
-            set_volume,
-            set_panning,
-            unknown
-        };
-
-        std::string to_string() const
-        {
-            char type_indicator = '\0';
-            switch (_type) {
-            case Type::none:
-                type_indicator = '.';
-                break;
-            case Type::set_speed:
-                type_indicator = 'A';
-                break;
-            case Type::set_tempo:
-                type_indicator = 'T';
-                break;
-            case Type::set_volume:
-                type_indicator = 'v';
-                break;
-            case Type::set_panning:
-                type_indicator = 'X';
-                break;
-            case Type::unknown:
-                type_indicator = '?';
-                break;
-            }
-            std::stringstream ss;
-            ss << type_indicator;
-            ss << std::setfill('0') << std::setw(2)
-               << std::hex << std::uppercase << static_cast<int>(_param);
-            return ss.str();
-        }
-        bool is_type(Type t) const { return _type == t; }
-        uint8_t param() const { return _param; }
-        uint8_t param_hi_nybble() const { return _param >> 4; }
-        uint8_t param_lo_nybble() const { return _param & 15; }
-        Command() = default;
-        explicit Command(Type t, uint8_t p)
-            : _type(t)
-            , _param(p)
-        {
+Pattern Pattern::Builder::build() const
+{
+    Pattern p(rows);
+    p.channel_mask = channel_mask;
+    for (size_t c = 0; c < max_channels; c++) {
+        if (channel_mask & (uint64_t(1) << c)) {
+            p.channel_numbers[p.used_channels++] = static_cast<uint8_t>(c);
         }
-
-    private:
-        Type _type = Type::none;
-        uint8_t _param = 0;
-    };
-    using Comms = std::array<Command, 2>;
-    std::string to_string() const { return note.to_string() + ' ' + inst.to_string() + ' ' + comms[0].to_string() + ' ' + comms[1].to_string(); }
-
-    Note note;
-    Inst inst;
-    Comms comms;
-};
-
-class Pattern {
-    static const size_t max_channels = 64;
-    static const size_t default_rows = 64;
-    using RowType = std::array<PatternEntry, max_channels>;
-
-public:
-    void set(size_t row, size_t col, const PatternEntry& entry)
-    {
-        rows[row].entries[col] = entry;
-    }
-    const PatternEntry entry(size_t row, size_t col) const
-    {
-        return rows[row].entries[col];
     }
-    size_t row_count() const { return rows.size(); }
-    const RowType& row(size_t r) const { return rows[r].entries; }
-    Pattern(Pattern&& rhs)
-        : rows(std::move(rhs.rows))
-    {
+    p.entries.resize(rows * p.used_channels);
+    for (const auto& cell : cells) {
+        const auto column = static_cast<size_t>(__builtin_popcountll(channel_mask & ((uint64_t(1) << cell.col) - 1)));
+        p.entries[cell.row * p.used_channels + column] = cell.entry;
     }
-    explicit Pattern(size_t n_rows = default_rows)
-        : rows(n_rows)
-    {
-    }
-
-private:
-    struct Row {
-        RowType entries;
-        Row() = default;
-        Row(Row&& rhs)
-            : entries(std::move(rhs.entries))
-        {
-        }
-    };
-    std::vector<Row> rows;
-};
-
-namespace it_file {
-#pragma pack(push, 1)
-struct header {
-    char impm[4]; // Must be 'I', 'M', 'P', 'M'
-    char song_name[26];
-    uint16_t philiht; // Pattern row highlight information. Only relevant for pattern editing situations.
-    uint16_t order_num;
-    uint16_t instrument_num;
-    uint16_t sample_num;
-    uint16_t pattern_num;
-    uint16_t created_with;
-    uint16_t compatible_with;
-    uint16_t flags;
-    uint16_t special;
-    uint8_t global_volume; // 0->128
-    uint8_t mix_volume; // 0->128
-    uint8_t initial_speed;
-    uint8_t initial_tempo;
-    uint8_t panning_separation;
-    uint8_t pitch_wheel_depth;
-    uint16_t message_length;
-    uint32_t message_offset;
-    uint32_t reserved;
-    uint8_t channel_panning[64];
-    uint8_t channel_volume[64];
-};
-
-struct pattern_header {
-    uint16_t packed_data_length;
-    uint16_t row_num;
-    uint8_t filler[4];
-};
-#pragma pack(pop)
+    return p;
 }
 
-template <typename T>
-void flex_read(T* buffer, const size_t count, std::istream& f)
+// Effects come as a letter numbered from 1 (A) and a parameter byte.
+static PatternEntry::Command decode_effect(uint8_t it_command, uint8_t param)
 {
-    f.read(reinterpret_cast<char*>(&buffer[0]), static_cast<std::streamsize>(count * sizeof(T)));
+    using Type = PatternEntry::Command::Type;
+    if (it_command > static_cast<uint8_t>(Type::midi_macro)) {
+        return PatternEntry::Command(Type::unknown, param);
+    }
+    const auto type = static_cast<Type>(it_command);
+    if (type == Type::set_panning) {
+        // 0-255 to the 0-64 of the volume column and the channel settings
+        return PatternEntry::Command(type, static_cast<uint8_t>((param + 2) >> 2));
+    }
+    return PatternEntry::Command(type, param);
 }
 
-template <typename T>
-std::vector<T> load_vector(std::istream& f, const size_t count)
+// The volume column packs a volume, a panning or one of a few effects with a
+// parameter from 0 to 9 into one byte. A parameter of 0 repeats the last one,
+// as it does in the effect column.
+static PatternEntry::Command decode_volume_column(uint8_t vol)
 {
-    std::vector<T> temp(count);
-    flex_read(&temp[0], count, f);
-    return std::move(temp);
+    using Type = PatternEntry::Command::Type;
+    using Command = PatternEntry::Command;
+    static const uint8_t portamento_speeds[] = { 0, 1, 4, 8, 16, 32, 64, 96, 128, 255 };
+    if (vol <= 64) {
+        return Command(Type::set_volume, vol);
+    }
+    if (vol >= 128 && vol <= 192) {
+        return Command(Type::set_panning, static_cast<uint8_t>(vol - 128));
+    }
+    const uint8_t x = vol < 128 ? (vol - 65) % 10 : (vol - 193) % 10;
+    if (vol < 75) { // a: fine volume slide up
+        return Command(Type::volume_slide, x ? static_cast<uint8_t>(x << 4 | 0xF) : 0);
+    }
+    if (vol < 85) { // b: fine volume slide down
+        return Command(Type::volume_slide, x ? static_cast<uint8_t>(0xF0 | x) : 0);
+    }
+    if (vol < 95) { // c: volume slide up
+        return Command(Type::volume_slide, static_cast<uint8_t>(x << 4));
+    }
+    if (vol < 105) { // d: volume slide down
+        return Command(Type::volume_slide, x);
+    }
+    if (vol < 115) { // e: portamento down
+        return Command(Type::portamento_down, static_cast<uint8_t>(x * 4));
+    }
+    if (vol < 125) { // f: portamento up
+        return Command(Type::portamento_up, static_cast<uint8_t>(x * 4));
+    }
+    if (vol >= 193 && vol < 203) { // g: tone portamento
+        return Command(Type::tone_portamento, portamento_speeds[x]);
+    }
+    if (vol >= 203 && vol < 213) { // h: vibrato depth, at the last speed
+        return Command(Type::vibrato, x);
+    }
+    return Command();
 }
 
-Pattern unpack_pattern(std::istream& f)
+Pattern unpack_pattern(const ByteView& file, size_t offset)
 {
-    it_file::pattern_header pat_header;
-    flex_read(&pat_header, 1, f);
+    const auto pat_header = file.read<it_file::pattern_header>(offset);
+    const ByteView packed = file.subview(offset + sizeof pat_header, pat_header.packed_data_length);
+    const uint8_t* cursor = packed.data();
+    const uint8_t* const end = cursor + packed.size();
+    auto next_byte = [&cursor, end]() -> uint8_t {
+        if (cursor == end) {
+            throw std::runtime_error("pattern data ends mid-row");
+        }
+        return *cursor++;
+    };
 
-    Pattern p;
-    uint8_t row = 0;
-    uint8_t mask_variables[64];
+    Pattern::Builder p(pat_header.row_num ? pat_header.row_num : Pattern::default_rows);
+    uint16_t row = 0;
+    uint8_t mask_variables[64] = {};
     PatternEntry entries[64];
     while (row < pat_header.row_num) {
-        uint8_t channel_variable = f.get();
+        uint8_t channel_variable = next_byte();
         if (channel_variable == 0) {
             row++;
             continue;
@@ -252,43 +106,23 @@ Pattern unpack_pattern(std::istream& f)
         uint8_t mask_variable = 0;
         uint8_t channel = (channel_variable - 1) & 63;
         if (channel_variable & 128) {
-            mask_variable = f.get();
+            mask_variable = next_byte();
             mask_variables[channel] = mask_variable;
         } else {
             mask_variable = mask_variables[channel];
         }
         if (mask_variable & 1) {
-            entries[channel].note = PatternEntry::Note(f.get());
+            entries[channel].note = PatternEntry::Note(next_byte());
         }
         if (mask_variable & 2) {
-            entries[channel].inst = PatternEntry::Inst(f.get());
+            entries[channel].inst = PatternEntry::Inst(next_byte());
         }
         if (mask_variable & 4) {
-            uint8_t vol_comm = f.get();
-            if (vol_comm <= 64) {
-                entries[channel].comms[0] = PatternEntry::Command(PatternEntry::Command::Type::set_volume, vol_comm);
-            } else if (vol_comm >= 128 && vol_comm <= 192) {
-                entries[channel].comms[0] = PatternEntry::Command(PatternEntry::Command::Type::set_panning, vol_comm - 65);
-            }
+            entries[channel].comms[0] = decode_volume_column(next_byte());
         }
         if (mask_variable & 8) {
-            uint8_t it_command = f.get();
-            PatternEntry::Command::Type type;
-            switch (it_command) {
-            case 0: // None
-                type = PatternEntry::Command::Type::none;
-                break;
-            case 1: // A - Set Speed
-                type = PatternEntry::Command::Type::set_speed;
-                break;
-            case 20: // T - Set Tempo
-                type = PatternEntry::Command::Type::set_tempo;
-                break;
-            default:
-                type = PatternEntry::Command::Type::unknown;
-                break;
-            }
-            entries[channel].comms[1] = PatternEntry::Command(type, f.get());
+            const uint8_t it_command = next_byte();
+            entries[channel].comms[1] = decode_effect(it_command, next_byte());
         }
         PatternEntry entry;
         if (mask_variable & (16 | 1)) {
@@ -305,139 +139,323 @@ Pattern unpack_pattern(std::istream& f)
         }
         p.set(row, channel, entry);
     }
-    return p;
+    return p.build();
 }
 
-struct Module {
-    std::string song_name;
-    std::vector<uint8_t> orders;
-    std::vector<Pattern> patterns;
-};
+Module load_module(const ByteView& file)
+{
+    if (file.size() < sizeof(it_file::header) || std::memcmp(file.data(), "IMPM", 4) != 0) {
+        throw std::runtime_error("not an Impulse Tracker module");
+    }
+    const auto it_header = file.read<it_file::header>(0);
 
-struct PlayerContext {
-    struct HostChannel {
-        int sample_index = 0;
-        int period = 0;
-        int volume = 0;
-        bool new_note = false;
-    };
+    // The order list and the three offset tables follow the header directly
+    size_t offset = sizeof it_header;
+    Module mod;
+    mod.orders = file.read_vector<uint8_t>(offset, it_header.order_num);
+    offset += it_header.order_num;
+    auto instrument_offsets = file.read_vector<uint32_t>(offset, it_header.instrument_num);
+    offset += it_header.instrument_num * sizeof(uint32_t);
+    auto sample_offsets = file.read_vector<uint32_t>(offset, it_header.sample_num);
+    offset += it_header.sample_num * sizeof(uint32_t);
+    auto pattern_offsets = file.read_vector<uint32_t>(offset, it_header.pattern_num);
 
-    const Module* mod;
-    std::array<HostChannel, 64> host_channels;
-    uint8_t ticks_to_next_row;
-    uint8_t current_row;
-    uint8_t breaking_row;
-    uint8_t current_order;
-    uint8_t ticks_per_row; // aka "speed"
-    uint8_t tempo;
+    mod.song_name = std::string(it_header.song_name, strnlen(it_header.song_name, sizeof it_header.song_name));
+    mod.initial_speed = it_header.initial_speed ? it_header.initial_speed : 6;
+    mod.initial_tempo = it_header.initial_tempo >= 0x20 ? it_header.initial_tempo : 125;
+    mod.global_volume = std::min<uint8_t>(it_header.global_volume, 128);
+    mod.mix_volume = std::min<uint8_t>(it_header.mix_volume, 128);
+    std::copy(std::begin(it_header.channel_panning), std::end(it_header.channel_panning), mod.channel_panning.begin());
+    std::copy(std::begin(it_header.channel_volume), std::end(it_header.channel_volume), mod.channel_volume.begin());
+    // Only copy the packed bytes now; patterns are decoded when they're played
+    std::vector<std::vector<uint8_t>> packed_patterns(pattern_offsets.size());
+    for (size_t i = 0; i < pattern_offsets.size(); i++) {
+        if (pattern_offsets[i]) {
+            const auto pat_header = file.read<it_file::pattern_header>(pattern_offsets[i]);
+            const ByteView bytes = file.subview(pattern_offsets[i], sizeof pat_header + pat_header.packed_data_length);
+            packed_patterns[i].assign(bytes.data(), bytes.data() + bytes.size());
+        }
+    }
+    mod.patterns = std::make_shared<PatternCache>(std::move(packed_patterns));
 
-    const Pattern& current_pattern() const
-    {
-        return mod->patterns[mod->orders[current_order]];
-    }
-    void process_row();
-    void process_tick();
-    void advance_to_next_order();
-    PlayerContext(const Module* m)
-        : mod(m)
-        , ticks_to_next_row(0)
-        , current_row(0)
-        , breaking_row(64)
-        , current_order(0)
-        , ticks_per_row(6)
-        , tempo(128)
-    {
-    }
-};
+    mod.samples.reserve(sample_offsets.size());
+    mod.sample_names.resize(sample_offsets.size());
+    for (size_t i = 0; i < sample_offsets.size(); i++) {
+        mod.samples.push_back(load_sample(file, sample_offsets[i], &mod.sample_names[i]));
+        mod.samples.back().prepare();
+    }
 
-void PlayerContext::advance_to_next_order()
-{
-    while (mod->orders[++current_order] == 254) {
+    mod.use_instruments = it_header.flags & it_file::header_flags::use_instruments;
+    mod.instruments.reserve(instrument_offsets.size());
+    for (const auto& instrument_offset : instrument_offsets) {
+        const auto inst_header = file.read<it_file::instrument_header>(instrument_offset);
+        Instrument instrument;
+        instrument.name = std::string(inst_header.instrument_name,
+            strnlen(inst_header.instrument_name, sizeof inst_header.instrument_name));
+        const uint8_t* fields = inst_header.format_fields;
+        uint8_t nna;
+        if (it_header.compatible_with >= 0x200) {
+            nna = fields[0];
+            instrument.fadeout = static_cast<uint16_t>(fields[3] | fields[4] << 8);
+        } else {
+            nna = fields[9];
+            instrument.fadeout = static_cast<uint16_t>((fields[7] | fields[8] << 8) * 2);
+        }
+        instrument.new_note_action = nna <= 3 ? static_cast<NewNoteAction>(nna) : NewNoteAction::cut;
+        for (size_t note = 0; note < instrument.keyboard.size(); note++) {
+            instrument.keyboard[note] = { inst_header.keyboard[2 * note], inst_header.keyboard[2 * note + 1] };
+        }
+        mod.instruments.push_back(instrument);
     }
-    if (mod->orders[current_order] == 255
-        || current_order >= mod->orders.size()) {
-        current_order = 0;
+    return mod;
+}
+
+Module load_module(const std::string& path)
+{
+    MappedFile file(path);
+    try {
+        return load_module(file.bytes());
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error(path + ": " + e.what());
     }
 }
 
-void PlayerContext::process_row()
+ModuleMemoryReport module_memory_usage(const Module& mod)
 {
-    size_t c = 0;
-    for (const auto& entry : current_pattern().row(current_row)) {
-        if (entry.note.is_note()) {
-            host_channels[c].period = entry.note.period();
-            host_channels[c].sample_index = entry.inst;
-            host_channels[c].volume = entry.comms[0].is_type(PatternEntry::Command::Type::set_volume)
-                ? entry.comms[0].param()
-                : 64; // This should sample default
-            host_channels[c].new_note = true;
+    ModuleMemoryReport report;
+    if (mod.patterns) {
+        report.patterns = mod.patterns->packed_bytes();
+        report.cached_patterns = mod.patterns->cached_bytes();
+        for (size_t i = 0; i < mod.patterns->size(); i++) {
+            report.dense_patterns += sizeof(std::vector<PatternEntry>)
+                + mod.patterns->row_count(i) * Pattern::max_channels * sizeof(PatternEntry);
         }
-        c++;
     }
+    for (const auto& sample : mod.samples) {
+        report.samples += sizeof(sample) + sample.frame_bytes();
+    }
+    report.samples += (mod.samples.capacity() - mod.samples.size()) * sizeof(Sample);
+    report.other = sizeof(mod) + mod.orders.capacity() + mod.song_name.capacity();
+    return report;
 }
 
-void PlayerContext::process_tick()
+size_t Module::pattern_count() const
 {
-    if (ticks_to_next_row == 0) {
-        process_row();
-        if (++current_row >= breaking_row) {
-            advance_to_next_order();
-            current_row = 0;
-            breaking_row = current_pattern().row_count();
-        }
-        ticks_to_next_row = ticks_per_row;
+    return patterns ? patterns->size() : 0;
+}
+
+std::shared_ptr<const Pattern> Module::pattern(size_t index) const
+{
+    static const auto empty = std::make_shared<Pattern>();
+    return patterns ? patterns->get(index) : empty;
+}
+
+void Module::prefetch_pattern(size_t index) const
+{
+    if (patterns) {
+        patterns->prefetch(index);
     }
-    --ticks_to_next_row;
 }
 
-int main(int argc, char* argv[])
+void Module::load_all_patterns() const
 {
-    (void)argc;
-    (void)argv;
+    if (patterns) {
+        patterns->load_all();
+    }
+}
 
-    std::ifstream it("/home/piron/Downloads/m4v-fasc.it", std::ios::binary);
-    it_file::header it_header;
-    it.read(reinterpret_cast<char*>(&it_header), sizeof it_header);
+PlayerContext::PlayerContext(const Module* m)
+    : mod(m)
+    , running_effects(0)
+    , updated_channels(0)
+    , ticks_to_next_row(0)
+    , row_tick(0)
+    , current_row(0)
+    , breaking_row(64)
+    , current_order(0)
+    , ticks_per_row(m->initial_speed)
+    , tempo(m->initial_tempo)
+    , global_volume(m->global_volume)
+    , jump_order(-1)
+    , break_row(-1)
+    , loop_back(false)
+    , row_delay(0)
+    , tick_delay(0)
+    , loop_count(0)
+{
+    for (size_t c = 0; c < host_channels.size(); c++) {
+        host_channels[c].channel_volume = std::min<int>(mod->channel_volume[c], 64);
+        host_channels[c].panning = mod->channel_panning[c] & 127;
+    }
+    while (current_order < mod->orders.size() && mod->orders[current_order] == Module::order_skip) {
+        ++current_order;
+    }
+    load_current_pattern();
+    breaking_row = static_cast<uint8_t>(current_pattern().row_count());
+}
 
-    Module mod;
-    mod.orders = load_vector<uint8_t>(it, it_header.order_num);
-    auto instrument_offsets = load_vector<uint32_t>(it, it_header.instrument_num);
-    auto sample_offsets = load_vector<uint32_t>(it, it_header.sample_num);
-    auto pattern_offsets = load_vector<uint32_t>(it, it_header.pattern_num);
+void PlayerContext::load_current_pattern()
+{
+    const size_t order_count = mod->orders.size();
+    pattern = mod->pattern(current_order < order_count ? mod->orders[current_order] : Module::order_end);
+    bool wrapped;
+    const size_t next = next_order(current_order, wrapped);
+    if (next < order_count) {
+        mod->prefetch_pattern(mod->orders[next]);
+    }
+}
 
-    mod.song_name = it_header.song_name;
-    mod.patterns.reserve(it_header.pattern_num);
-    for (const auto& offset : pattern_offsets) {
-        if (offset) {
-            it.seekg(offset);
-            mod.patterns.emplace_back(unpack_pattern(it));
-        } else {
-            mod.patterns.emplace_back(Pattern());
+size_t PlayerContext::next_order(size_t order, bool& wrapped) const
+{
+    const size_t order_count = mod->orders.size();
+    wrapped = false;
+    do {
+        ++order;
+    } while (order < order_count && mod->orders[order] == Module::order_skip);
+    if (order >= order_count || mod->orders[order] == Module::order_end) {
+        wrapped = true;
+        order = 0;
+        while (order < order_count && mod->orders[order] == Module::order_skip) {
+            ++order;
         }
     }
+    return order;
+}
 
-    PlayerContext player(&mod);
-    const auto& pattern = player.current_pattern();
-    for (size_t i = 0; i < 64; i++) {
-        for (size_t j = 0; j < 8; j++) {
-            std::cout << pattern.entry(i, j).to_string() << "|";
-        }
-        std::cout << "\n";
+void PlayerContext::advance_to_next_order()
+{
+    bool wrapped;
+    current_order = static_cast<uint8_t>(next_order(current_order, wrapped));
+    if (wrapped) {
+        ++loop_count;
+    }
+    load_current_pattern();
+}
+
+void PlayerContext::jump_to(size_t order, size_t row)
+{
+    const size_t order_count = mod->orders.size();
+    // Going back, or staying on the same order, is the song repeating
+    bool wrapped = order <= current_order;
+    if (order >= order_count || mod->orders[order] == Module::order_skip || mod->orders[order] == Module::order_end) {
+        bool went_round;
+        order = next_order(order, went_round);
+        wrapped = wrapped || went_round;
     }
+    if (wrapped) {
+        ++loop_count;
+    }
+    current_order = static_cast<uint8_t>(order);
+    load_current_pattern();
+    breaking_row = static_cast<uint8_t>(current_pattern().row_count());
+    current_row = static_cast<uint8_t>(row < breaking_row ? row : 0);
+}
 
-    while (true) {
-        player.process_tick();
-        for (auto& host_channel : player.host_channels) {
-            if (host_channel.new_note) {
-                std::cout << "Playing Sample #" << host_channel.sample_index
-                          << " at period: " << host_channel.period
-                          << " and volume: " << host_channel.volume << "\n";
-                host_channel.new_note = false;
+void PlayerContext::play_entry(size_t c, const PatternEntry& entry, bool portamento)
+{
+    auto& host = host_channels[c];
+    const uint64_t bit = uint64_t(1) << c;
+    if (!entry.inst.is_empty()) {
+        host.instrument = entry.inst;
+    }
+    if (entry.note.is_note() && entry.note < 120) {
+        int note = entry.note;
+        int sample = host.instrument;
+        if (mod->use_instruments) {
+            // The instrument's keyboard picks the sample, and may transpose
+            sample = 0;
+            if (host.instrument >= 1 && static_cast<size_t>(host.instrument) <= mod->instruments.size()) {
+                const auto& key = mod->instruments[static_cast<size_t>(host.instrument - 1)].keyboard[static_cast<size_t>(note)];
+                note = key.first < 120 ? key.first : note;
+                sample = key.second;
             }
         }
+        const int period = PatternEntry::Note(static_cast<uint8_t>(note)).period();
+        host.effects.target_period = period;
+        if (portamento && host.period > 0) {
+            return;
+        }
+        host.period = period;
+        host.sample_index = sample;
+        int default_volume = 64;
+        if (sample >= 1 && static_cast<size_t>(sample) <= mod->samples.size()) {
+            default_volume = mod->samples[static_cast<size_t>(sample - 1)].default_volume;
+        }
+        host.volume = entry.comms[0].is_type(PatternEntry::Command::Type::set_volume)
+            ? entry.comms[0].param()
+            : default_volume;
+        host.sample_offset = 0;
+        host.new_note = true;
+        host.effects.vibrato_position = 0;
+        host.effects.tremolo_position = 0;
+        host.effects.retrigger_ticks = 0;
+        updated_channels |= bit;
+    } else if (entry.note.is_off()) {
+        host.note_off = true;
+        updated_channels |= bit;
+    } else if (entry.note.is_cut()) {
+        host.note_cut = true;
+        updated_channels |= bit;
     }
+}
 
-    std::cin >> argc;
+void PlayerContext::process_row()
+{
+    using Type = PatternEntry::Command::Type;
+    stop_effects();
+    const auto row = current_pattern().row(current_row);
+    for (size_t i = 0; i < row.size(); i++) {
+        const size_t c = row.channel(i);
+        const auto& entry = row[i];
+        const auto& volume = entry.comms[0];
+        const auto& effect = entry.comms[1];
+        // SDx plays the entry's note a few ticks late
+        bool delayed = false;
+        if (effect.is_type(Type::special)) {
+            const uint8_t param = effect.param() ? effect.param() : host_channels[c].effects.special;
+            delayed = param >> 4 == 0xD && (param & 15);
+        }
+        if (delayed) {
+            host_channels[c].effects.delayed_note = entry;
+        } else {
+            const bool portamento = volume.is_type(Type::tone_portamento) || effect.is_type(Type::tone_portamento)
+                || effect.is_type(Type::tone_portamento_volume_slide);
+            play_entry(c, entry, portamento);
+        }
+        if (!delayed || !volume.is_type(Type::set_volume)) {
+            start_effect(c, 0, volume);
+        }
+        start_effect(c, 1, effect);
+    }
+}
 
-    return 0;
+void PlayerContext::process_tick()
+{
+    if (ticks_to_next_row == 0) {
+        row_tick = 0;
+        jump_order = -1;
+        break_row = -1;
+        loop_back = false;
+        row_delay = 0;
+        tick_delay = 0;
+        process_row();
+        if (loop_back) {
+            current_row = static_cast<uint8_t>(break_row);
+        } else if (jump_order >= 0) {
+            jump_to(static_cast<size_t>(jump_order), break_row >= 0 ? static_cast<size_t>(break_row) : 0);
+        } else if (break_row >= 0) {
+            bool wrapped;
+            jump_to(next_order(current_order, wrapped), static_cast<size_t>(break_row));
+        } else if (++current_row >= breaking_row) {
+            advance_to_next_order();
+            current_row = 0;
+            breaking_row = static_cast<uint8_t>(current_pattern().row_count());
+        }
+        const unsigned ticks = ticks_per_row * (1u + row_delay) + tick_delay;
+        ticks_to_next_row = static_cast<uint8_t>(ticks < 255 ? ticks : 255);
+    } else {
+        ++row_tick;
+        run_effects();
+    }
+    --ticks_to_next_row;
 }
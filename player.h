@@ -0,0 +1,603 @@
+#ifndef _PLAYER_H_
+#define _PLAYER_H_
+#include "mapped_file.h"
+#include "mixer.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct PatternEntry {
+    class Note {
+        static const uint8_t empty = 253;
+        static const uint8_t cut = 254;
+        static const uint8_t off = 255;
+
+    public:
+        static const size_t text_length = 3;
+        // Writes the text_length characters of the note's text to out and
+        // returns the end of them.
+        char* format(char* out) const
+        {
+            static const char note_names[] = "C-C#D-D#E-F-F#G-G#A-A#B-";
+            if (is_empty() || is_cut() || is_off()) {
+                const char c = is_empty() ? '.' : is_cut() ? '=' : '-';
+                out[0] = out[1] = out[2] = c;
+            } else {
+                out[0] = note_names[2 * semitone()];
+                out[1] = note_names[2 * semitone() + 1];
+                out[2] = static_cast<char>('0' + octave() % 10);
+            }
+            return out + text_length;
+        }
+        std::string to_string() const
+        {
+            char text[text_length];
+            return std::string(text, format(text));
+        }
+        bool is_note() const { return _index < 190; }
+        bool is_empty() const { return _index == empty; }
+        bool is_cut() const { return _index == cut; }
+        bool is_off() const { return _index == off; }
+        int octave() const { return _index / 12; }
+        int semitone() const { return _index % 12; }
+        int period() const
+        {
+            static const short periods[] = {
+                1712,
+                1616,
+                1524,
+                1440,
+                1356,
+                1280,
+                1208,
+                1140,
+                1076,
+                1016,
+                960,
+                907
+            };
+            return 32 * periods[semitone()] >> octave();
+        }
+        operator int() const { return _index; }
+        Note() = default;
+        explicit Note(const uint8_t i)
+            : _index(i)
+        {
+        }
+
+    private:
+        uint8_t _index = empty;
+    };
+    class Inst {
+    public:
+        static const uint8_t empty = 255;
+        Inst() = default;
+        operator int() const { return _index; }
+        bool is_empty() const { return _index == empty; }
+        explicit Inst(const uint8_t i)
+            : _index(i)
+        {
+        }
+        static const size_t text_length = 2;
+        // Writes the text_length characters of the instrument's text to out
+        // and returns the end of them.
+        char* format(char* out) const
+        {
+            if (is_empty()) {
+                out[0] = out[1] = '.';
+            } else {
+                out[0] = static_cast<char>('0' + _index / 10 % 10);
+                out[1] = static_cast<char>('0' + _index % 10);
+            }
+            return out + text_length;
+        }
+        std::string to_string() const
+        {
+            char text[text_length];
+            return std::string(text, format(text));
+        }
+
+    private:
+        uint8_t _index = empty;
+    };
+    class Command {
+    public:
+        // Effects are numbered as in the file, so A (set speed) is 1. The
+        // volume column is decoded into the same effects, with their
+        // parameters in effect column units, apart from set_volume.
+        enum class Type : uint8_t {
+            none,
+            set_speed, // A
+            jump_to_order, // B
+            pattern_break, // C
+            volume_slide, // D
+            portamento_down, // E
+            portamento_up, // F
+            tone_portamento, // G
+            vibrato, // H
+            tremor, // I
+            arpeggio, // J
+            vibrato_volume_slide, // K
+            tone_portamento_volume_slide, // L
+            set_channel_volume, // M
+            channel_volume_slide, // N
+            sample_offset, // O
+            panning_slide, // P
+            retrigger, // Q
+            tremolo, // R
+            special, // S
+            set_tempo, // T
+            fine_vibrato, // U
+            set_global_volume, // V
+            global_volume_slide, // W
+            set_panning, // X, 0-64 (or 100 for surround) rather than 0-255
+            panbrello, // Y
+            midi_macro, // Z
+            set_volume, // the volume column's volume, 0-64
+            unknown,
+            count
+        };
+
+        // The effect's letter: '.' for none, 'v' for the volume column's
+        // volume and '?' for one we don't know.
+        static char letter(Type type)
+        {
+            if (type == Type::none) {
+                return '.';
+            }
+            if (type == Type::set_volume) {
+                return 'v';
+            }
+            if (type <= Type::midi_macro) {
+                return static_cast<char>('A' + static_cast<int>(type) - 1);
+            }
+            return '?';
+        }
+        static const size_t text_length = 3;
+        // Writes the text_length characters of the command's text, its
+        // letter and parameter in hex, to out and returns the end of them.
+        char* format(char* out) const
+        {
+            static const char hex_digits[] = "0123456789ABCDEF";
+            out[0] = letter(_type);
+            out[1] = hex_digits[_param >> 4];
+            out[2] = hex_digits[_param & 15];
+            return out + text_length;
+        }
+        std::string to_string() const
+        {
+            char text[text_length];
+            return std::string(text, format(text));
+        }
+        Type type() const { return _type; }
+        bool is_type(Type t) const { return _type == t; }
+        uint8_t param() const { return _param; }
+        uint8_t param_hi_nybble() const { return _param >> 4; }
+        uint8_t param_lo_nybble() const { return _param & 15; }
+        Command() = default;
+        explicit Command(Type t, uint8_t p)
+            : _type(t)
+            , _param(p)
+        {
+        }
+
+    private:
+        Type _type = Type::none;
+        uint8_t _param = 0;
+    };
+    using Comms = std::array<Command, 2>;
+    static const size_t text_length = Note::text_length + Inst::text_length + 2 * Command::text_length + 3;
+    // Writes the text_length characters of the entry's text to out and
+    // returns the end of them. Allocates nothing, for dumping whole modules.
+    char* format(char* out) const
+    {
+        out = note.format(out);
+        *out++ = ' ';
+        out = inst.format(out);
+        *out++ = ' ';
+        out = comms[0].format(out);
+        *out++ = ' ';
+        return comms[1].format(out);
+    }
+    std::string to_string() const
+    {
+        char text[text_length];
+        return std::string(text, format(text));
+    }
+
+    Note note;
+    Inst inst;
+    Comms comms;
+};
+
+// Patterns only store the channels that have something in them: a mask of
+// the channels used anywhere in the pattern, and for every row one entry per
+// used channel, packed together. A four-channel song costs a sixteenth of
+// what a dense 64-channel grid would.
+class Pattern {
+public:
+    static const size_t max_channels = 64;
+    static const size_t default_rows = 64;
+
+    // The used channels of one row, in channel order.
+    class RowView {
+    public:
+        RowView(const PatternEntry* entries, const uint8_t* channels, size_t count)
+            : _entries(entries)
+            , _channels(channels)
+            , _count(count)
+        {
+        }
+        size_t size() const { return _count; }
+        size_t channel(size_t i) const { return _channels[i]; }
+        const PatternEntry& operator[](size_t i) const { return _entries[i]; }
+
+    private:
+        const PatternEntry* _entries;
+        const uint8_t* _channels;
+        size_t _count;
+    };
+
+    // Collects cells in any order, then packs them into a Pattern.
+    class Builder {
+    public:
+        explicit Builder(size_t n_rows = default_rows)
+            : rows(n_rows)
+            , channel_mask(0)
+        {
+        }
+        void set(size_t row, size_t col, const PatternEntry& entry)
+        {
+            cells.push_back({ row, col, entry });
+            channel_mask |= uint64_t(1) << col;
+        }
+        Pattern build() const;
+
+    private:
+        struct Cell {
+            size_t row;
+            size_t col;
+            PatternEntry entry;
+        };
+        size_t rows;
+        uint64_t channel_mask;
+        std::vector<Cell> cells;
+    };
+
+    const PatternEntry entry(size_t row, size_t col) const
+    {
+        const uint64_t bit = uint64_t(1) << col;
+        if (!(channel_mask & bit)) {
+            return PatternEntry();
+        }
+        const auto column = static_cast<size_t>(__builtin_popcountll(channel_mask & (bit - 1)));
+        return entries[row * used_channels + column];
+    }
+    size_t row_count() const { return rows; }
+    RowView row(size_t r) const
+    {
+        return RowView(entries.data() + r * used_channels, channel_numbers.data(), used_channels);
+    }
+    uint64_t channels_used() const { return channel_mask; }
+    // Bytes owned by the pattern, including the object itself.
+    size_t memory_usage() const { return sizeof(*this) + entries.capacity() * sizeof(PatternEntry); }
+
+    Pattern(Pattern&& rhs) = default;
+    Pattern& operator=(Pattern&& rhs) = default;
+    explicit Pattern(size_t n_rows = default_rows)
+        : rows(n_rows)
+        , used_channels(0)
+        , channel_mask(0)
+        , channel_numbers()
+    {
+    }
+
+private:
+    size_t rows;
+    size_t used_channels;
+    uint64_t channel_mask;
+    std::array<uint8_t, max_channels> channel_numbers;
+    std::vector<PatternEntry> entries;
+};
+
+namespace it_file {
+#pragma pack(push, 1)
+struct header {
+    char impm[4]; // Must be 'I', 'M', 'P', 'M'
+    char song_name[26];
+    uint16_t philiht; // Pattern row highlight information. Only relevant for pattern editing situations.
+    uint16_t order_num;
+    uint16_t instrument_num;
+    uint16_t sample_num;
+    uint16_t pattern_num;
+    uint16_t created_with;
+    uint16_t compatible_with;
+    uint16_t flags;
+    uint16_t special;
+    uint8_t global_volume; // 0->128
+    uint8_t mix_volume; // 0->128
+    uint8_t initial_speed;
+    uint8_t initial_tempo;
+    uint8_t panning_separation;
+    uint8_t pitch_wheel_depth;
+    uint16_t message_length;
+    uint32_t message_offset;
+    uint32_t reserved;
+    uint8_t channel_panning[64];
+    uint8_t channel_volume[64];
+};
+
+struct pattern_header {
+    uint16_t packed_data_length;
+    uint16_t row_num;
+    uint8_t filler[4];
+};
+
+struct sample_header {
+    char imps[4]; // Must be 'I', 'M', 'P', 'S'
+    char file_name[12];
+    uint8_t zero;
+    uint8_t global_volume; // 0->64
+    uint8_t flags;
+    uint8_t default_volume; // 0->64
+    char sample_name[26];
+    uint8_t convert;
+    uint8_t default_panning;
+    uint32_t length; // in samples, not bytes
+    uint32_t loop_begin;
+    uint32_t loop_end;
+    uint32_t c5_speed;
+    uint32_t sustain_loop_begin;
+    uint32_t sustain_loop_end;
+    uint32_t sample_pointer;
+    uint8_t vibrato_speed;
+    uint8_t vibrato_depth;
+    uint8_t vibrato_rate;
+    uint8_t vibrato_type;
+};
+
+// Only the parts of the instrument header that are the same in the old
+// (pre-2.00) and new formats, plus the bytes in between that differ.
+struct instrument_header {
+    char impi[4]; // Must be 'I', 'M', 'P', 'I'
+    char file_name[12];
+    uint8_t zero;
+    // New format: NNA, duplicate check type and action, then fadeout
+    // (16 bits, 0->128). Old format: loop points and fadeout (16 bits,
+    // 0->64) at 7, then NNA at 9.
+    uint8_t format_fields[15];
+    char instrument_name[26];
+    uint8_t more_new_format_fields[6];
+    uint8_t keyboard[240]; // note, sample pairs for each of the 120 notes
+};
+
+namespace sample_flags {
+    const uint8_t present = 1;
+    const uint8_t sixteen_bit = 2;
+    const uint8_t stereo = 4;
+    const uint8_t compressed = 8;
+    const uint8_t loop = 16;
+    const uint8_t sustain_loop = 32;
+    const uint8_t pingpong_loop = 64;
+    const uint8_t pingpong_sustain_loop = 128;
+}
+
+namespace sample_convert {
+    const uint8_t is_signed = 1;
+    const uint8_t big_endian = 2;
+    const uint8_t delta = 4; // On compressed samples this marks IT2.15 compression
+}
+
+namespace header_flags {
+    const uint16_t stereo = 1;
+    const uint16_t use_instruments = 4;
+    const uint16_t linear_slides = 8;
+}
+#pragma pack(pop)
+}
+
+class PatternCache;
+
+// What happens to the note a channel is playing when it plays another
+enum class NewNoteAction : uint8_t {
+    cut, // the old note stops
+    note_continue, // the old note goes on in the background
+    note_off, // the old note is released; without envelopes, that fades it out
+    note_fade, // the old note fades out
+};
+
+struct Instrument {
+    std::string name;
+    NewNoteAction new_note_action = NewNoteAction::cut;
+    // How much the volume drops each tick once the note fades, out of 1024;
+    // 0 never fades.
+    uint16_t fadeout = 0;
+    // For each note, the note actually played and the sample it's played
+    // with, numbered from one (0 means no sample).
+    std::array<std::pair<uint8_t, uint8_t>, 120> keyboard;
+};
+
+struct Module {
+    static const uint8_t order_skip = 254;
+    static const uint8_t order_end = 255;
+
+    std::string song_name;
+    uint8_t initial_speed = 6;
+    uint8_t initial_tempo = 125;
+    uint8_t global_volume = 128; // 0-128
+    uint8_t mix_volume = 128; // 0-128, scales the whole mix
+    std::array<uint8_t, 64> channel_panning;
+    std::array<uint8_t, 64> channel_volume;
+    std::vector<uint8_t> orders;
+    // Patterns are kept packed and decoded when first played
+    std::shared_ptr<PatternCache> patterns;
+    std::vector<Sample> samples;
+    std::vector<std::string> sample_names;
+    // Only used when use_instruments is set; otherwise the instrument column
+    // of a pattern names a sample directly.
+    bool use_instruments = false;
+    std::vector<Instrument> instruments;
+
+    Module()
+    {
+        channel_panning.fill(32);
+        channel_volume.fill(64);
+    }
+    size_t pattern_count() const;
+    // An empty pattern if there's no pattern with that number.
+    std::shared_ptr<const Pattern> pattern(size_t index) const;
+    void prefetch_pattern(size_t index) const;
+    // Decodes all patterns up front and keeps them, so playing the module
+    // never decodes a pattern on the audio thread.
+    void load_all_patterns() const;
+    // The gain for the master bus that mix_volume asks for
+    float mix_gain() const { return static_cast<float>(mix_volume) / 128.0f; }
+};
+
+// Decodes the pattern stored at offset in an .it file image.
+Pattern unpack_pattern(const ByteView& file, size_t offset);
+// Loads the song structure of an .it file, either from a file image already
+// in memory or by mapping the file. Throws std::runtime_error if the file
+// can't be read, isn't an Impulse Tracker module or is truncated.
+Module load_module(const ByteView& file);
+Module load_module(const std::string& path);
+
+struct ModuleMemoryReport {
+    size_t patterns = 0; // packed pattern data
+    size_t cached_patterns = 0; // patterns decoded right now
+    size_t dense_patterns = 0; // what the patterns would take as 64-channel grids
+    size_t samples = 0;
+    size_t other = 0; // orders, names and the Module itself
+
+    size_t total() const { return patterns + cached_patterns + samples + other; }
+};
+ModuleMemoryReport module_memory_usage(const Module& mod);
+
+// What a channel's effects keep from tick to tick and row to row. Most
+// effects given a parameter of 0 repeat the last one they were given, so the
+// channel remembers those too.
+struct ChannelEffects {
+    // The effects that go on working after the row's first tick: the volume
+    // column's and the effect column's, with remembered parameters filled in.
+    std::array<PatternEntry::Command, 2> running;
+    // Remembered parameters
+    uint8_t volume_slide = 0; // D, K and L
+    uint8_t channel_volume_slide = 0;
+    uint8_t global_volume_slide = 0;
+    uint8_t panning_slide = 0;
+    uint8_t portamento = 0; // E and F
+    uint8_t tone_portamento = 0;
+    uint8_t vibrato = 0; // H and U: speed, depth
+    uint8_t tremolo = 0;
+    uint8_t panbrello = 0;
+    uint8_t tremor = 0;
+    uint8_t arpeggio = 0;
+    uint8_t retrigger = 0;
+    uint8_t sample_offset = 0;
+    uint8_t tempo_slide = 0;
+    uint8_t special = 0;
+    // Oscillators: position out of 256 and waveform (S3x, S4x, S5x)
+    uint8_t vibrato_position = 0;
+    uint8_t tremolo_position = 0;
+    uint8_t panbrello_position = 0;
+    uint8_t vibrato_waveform = 0;
+    uint8_t tremolo_waveform = 0;
+    uint8_t panbrello_waveform = 0;
+    // Ticks into tremor's on and off phases, and since the last retrigger
+    uint8_t tremor_ticks = 0;
+    uint8_t retrigger_ticks = 0;
+    // The tick a note cut (SCx) or delayed note (SDx) happens on
+    uint8_t note_cut_tick = 0;
+    uint8_t note_delay_tick = 0;
+    // Pattern loop (SBx): the row it goes back to and how many times more
+    uint8_t loop_row = 0;
+    uint8_t loops_left = 0;
+    int target_period = 0; // where tone portamento slides to
+    PatternEntry delayed_note;
+};
+
+struct PlayerContext {
+    struct HostChannel {
+        int instrument = 0; // the last instrument (or sample) number given
+        int sample_index = 0;
+        int period = 0; // without vibrato and arpeggio
+        int volume = 0; // 0-64, without tremolo and tremor
+        int channel_volume = 64; // 0-64
+        int panning = 32; // 0-64, or 100 for surround; without panbrello
+        int sample_offset = 0; // frames into the sample the next new note starts
+        // What the running effects add on top
+        int vibrato = 0;
+        int arpeggio = 0; // semitones
+        int tremolo = 0;
+        int panbrello = 0;
+        bool muted = false; // by tremor
+        bool new_note = false;
+        bool retrigger = false; // the new note restarts the last rather than following the NNA
+        bool note_off = false; // released by a note off in the pattern
+        bool note_cut = false; // stopped by a note cut in the pattern
+        ChannelEffects effects;
+
+        // What to play with, everything included
+        int final_period() const;
+        int final_volume() const;
+        int final_panning() const;
+    };
+
+    const Module* mod;
+    // Held for as long as the player is on this order, even if the module's
+    // pattern cache evicts it meanwhile.
+    std::shared_ptr<const Pattern> pattern;
+    std::array<HostChannel, 64> host_channels;
+    // Channels running an effect after the row's first tick; only these are
+    // visited on those ticks.
+    uint64_t running_effects;
+    // Channels whose note, pitch, volume or panning changed since whoever
+    // plays the song last looked, and cleared it.
+    uint64_t updated_channels;
+    uint8_t ticks_to_next_row;
+    uint8_t row_tick; // ticks since the row started
+    uint8_t current_row;
+    uint8_t breaking_row;
+    uint8_t current_order;
+    uint8_t ticks_per_row; // aka "speed"
+    uint8_t tempo;
+    uint8_t global_volume; // 0-128
+    // Set by effects during a row, and taken when it ends
+    int jump_order; // B
+    int break_row; // C, and the row a pattern loop goes back to
+    bool loop_back; // break_row is a pattern loop in the same pattern
+    uint8_t row_delay; // SEx: rows the row lasts on top of its own
+    uint8_t tick_delay; // S6x: ticks the row lasts on top of its own
+    // Counts how many times the order list has wrapped back to the start;
+    // the song has played through once when this becomes non-zero.
+    unsigned loop_count;
+
+    const Pattern& current_pattern() const { return *pattern; }
+    void process_row();
+    void process_tick();
+    void advance_to_next_order();
+    // Carries on from row of the order, which is passed through next_order()
+    // if it's not one to play. Counts a wrap if the song goes back.
+    void jump_to(size_t order, size_t row);
+    // The order that plays after `order`, skipping "+++" markers and
+    // wrapping at the end of the list. Sets wrapped if it went back to the start.
+    size_t next_order(size_t order, bool& wrapped) const;
+    // Fetches the pattern for current_order and starts decoding the next one.
+    void load_current_pattern();
+    // Plays the note, instrument and volume of an entry. With portamento the
+    // note becomes where tone portamento slides to, unless there's nothing
+    // playing to slide from.
+    void play_entry(size_t channel, const PatternEntry& entry, bool portamento);
+    // Effects live in effects.cc. start_effect() runs a command on the row's
+    // first tick and sets it running if it carries on; stop_effects() ends
+    // what the last row left running; run_effects() runs them on the other
+    // ticks.
+    void start_effect(size_t channel, size_t column, const PatternEntry::Command& command);
+    void stop_effects();
+    void run_effects();
+    explicit PlayerContext(const Module* m);
+};
+
+#endif
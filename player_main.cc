@@ -0,0 +1,65 @@
+#include "player.h"
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static void print_memory_report(const Module& mod)
+{
+    const auto report = module_memory_usage(mod);
+    std::cout << "patterns: " << report.patterns << " bytes packed, " << report.cached_patterns << " decoded ("
+              << report.dense_patterns << " as dense grids)\n"
+              << "samples:  " << report.samples << " bytes\n"
+              << "other:    " << report.other << " bytes\n"
+              << "total:    " << report.total() << " bytes\n";
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = "/home/piron/Downloads/m4v-fasc.it";
+    bool memory_report = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--memory") == 0) {
+            memory_report = true;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    Module mod;
+    try {
+        mod = load_module(path);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (memory_report) {
+        print_memory_report(mod);
+        return 0;
+    }
+
+    PlayerContext player(&mod);
+    const auto& pattern = player.current_pattern();
+    for (size_t i = 0; i < pattern.row_count(); i++) {
+        for (size_t j = 0; j < 8; j++) {
+            std::cout << pattern.entry(i, j).to_string() << "|";
+        }
+        std::cout << "\n";
+    }
+
+    while (true) {
+        player.process_tick();
+        for (auto& host_channel : player.host_channels) {
+            if (host_channel.new_note) {
+                std::cout << "Playing Sample #" << host_channel.sample_index
+                          << " at period: " << host_channel.period
+                          << " and volume: " << host_channel.volume << "\n";
+                host_channel.new_note = false;
+            }
+        }
+    }
+
+    std::cin >> argc;
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "audio_output.h"
+#include "portaudio.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+class PortAudioOutput : public AudioOutput {
+public:
+    explicit PortAudioOutput(const OutputOptions& o)
+        : options(o)
+        , bus(o.master_bus(SampleFormat::float32))
+        , stream(nullptr)
+    {
+        check(Pa_Initialize());
+    }
+    ~PortAudioOutput() override
+    {
+        stop();
+        Pa_Terminate();
+    }
+    const char* name() const override { return "portaudio"; }
+
+    void start(Render r) override
+    {
+        stop();
+        render = std::move(r);
+
+        PaStreamParameters outputParameters;
+        outputParameters.device = Pa_GetDefaultOutputDevice(); /* default output device */
+        if (outputParameters.device == paNoDevice) {
+            throw std::runtime_error("no default output device");
+        }
+        outputParameters.channelCount = 2; /* stereo output */
+        outputParameters.sampleFormat = paFloat32; /* 32 bit floating point output */
+        outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+        outputParameters.hostApiSpecificStreamInfo = NULL;
+
+        check(Pa_OpenStream(
+            &stream,
+            NULL, /* no input */
+            &outputParameters,
+            options.sample_rate,
+            options.frames_per_buffer,
+            paClipOff, /* the master bus has already clipped what needs clipping */
+            callback,
+            this));
+        const PaError err = Pa_StartStream(stream);
+        if (err != paNoError) {
+            Pa_CloseStream(stream);
+            stream = nullptr;
+            check(err);
+        }
+    }
+    void stop() override
+    {
+        if (stream) {
+            Pa_StopStream(stream);
+            Pa_CloseStream(stream);
+            stream = nullptr;
+        }
+    }
+    bool wait(double seconds) override
+    {
+        using clock = std::chrono::steady_clock;
+        const auto until = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+        while (stream && Pa_IsStreamActive(stream) == 1) {
+            if (seconds > 0 && clock::now() >= until) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+private:
+    static void check(PaError err)
+    {
+        if (err != paNoError) {
+            throw std::runtime_error(std::string("PortAudio: ") + Pa_GetErrorText(err));
+        }
+    }
+
+    /* This routine will be called by the PortAudio engine when audio is needed.
+    ** It may called at interrupt level on some machines so don't do anything
+    ** that could mess up the system like calling malloc() or free().
+    */
+    static int callback(const void* inputBuffer, void* outputBuffer,
+        unsigned long framesPerBuffer,
+        const PaStreamCallbackTimeInfo* timeInfo,
+        PaStreamCallbackFlags statusFlags,
+        void* userData)
+    {
+        auto* self = reinterpret_cast<PortAudioOutput*>(userData);
+        StereoSample* out = reinterpret_cast<StereoSample*>(outputBuffer);
+
+        (void)timeInfo; /* Prevent unused variable warnings. */
+        (void)inputBuffer;
+
+        const bool more = self->render(out, framesPerBuffer, (statusFlags & paOutputUnderflow) != 0);
+        self->bus.process(out, framesPerBuffer, out);
+        return more ? paContinue : paComplete;
+    }
+
+    const OutputOptions options;
+    MasterBus bus;
+    PaStream* stream;
+    Render render;
+};
+}
+
+std::unique_ptr<AudioOutput> make_portaudio_output(const OutputOptions& options)
+{
+    return std::unique_ptr<AudioOutput>(new PortAudioOutput(options));
+}
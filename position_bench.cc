@@ -0,0 +1,157 @@
+#include "mixer.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define SAMPLE_RATE (44100)
+#define FRAMES_PER_BUFFER (1024)
+#define VOICES (32)
+
+// Compares the mixer's 32.32 fixed-point playback positions with the float
+// positions it used to keep: how fast each mixes, and how far each drifts
+// from the true position over a long sample.
+
+// The float version of the mixer's inner loop, kept as the baseline: same
+// runs and loop wrapping, but the position is a float and every frame
+// converts it to an index.
+struct FloatVoice {
+    const float* frames;
+    float length;
+    float loop_begin;
+    float index;
+    float step;
+};
+
+static void mix_float(FloatVoice& v, StereoSample* out, size_t frames, bool linear)
+{
+    while (frames) {
+        const float run = std::ceil((v.length - v.index) / v.step);
+        size_t n = run < 1 ? 1 : static_cast<size_t>(std::min(run, static_cast<float>(frames)));
+        if (n > 1 && v.index + static_cast<float>(n - 1) * v.step >= v.length) {
+            n--;
+        }
+        for (size_t i = 0; i < n; i++) {
+            const float x = v.index + static_cast<float>(i) * v.step;
+            const auto at = static_cast<size_t>(x);
+            float sample = v.frames[at];
+            if (linear) {
+                const float t = x - static_cast<float>(at);
+                sample = t * v.frames[at + 1] + (1.0f - t) * sample;
+            }
+            out[i].left += sample * 0.5f;
+            out[i].right += sample * 0.5f;
+        }
+        v.index += static_cast<float>(n) * v.step;
+        out += n;
+        frames -= n;
+        if (v.index >= v.length) {
+            const float loop_length = v.length - v.loop_begin;
+            v.index -= loop_length * std::floor((v.index - v.loop_begin) / loop_length);
+        }
+    }
+}
+
+template <typename RenderFunction>
+static double ns_per_voice_frame(RenderFunction render)
+{
+    using clock = std::chrono::steady_clock;
+    const size_t blocks = 2000;
+    render(); // warm up
+    auto start = clock::now();
+    for (size_t i = 0; i < blocks; i++) {
+        render();
+    }
+    std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+    return elapsed.count() / static_cast<double>(blocks * FRAMES_PER_BUFFER * VOICES);
+}
+
+static float voice_rate(size_t voice)
+{
+    return 22050.0f * (1.0f + static_cast<float>(voice) * 0.01f);
+}
+
+static void speed(const Sample& sample)
+{
+    std::vector<StereoSample> out(FRAMES_PER_BUFFER);
+    printf("%-22s %16s %16s\n", "", "nearest ns/v/f", "linear ns/v/f");
+
+    std::vector<FloatVoice> voices(VOICES);
+    double float_ns[2];
+    for (int linear = 0; linear < 2; linear++) {
+        for (size_t i = 0; i < voices.size(); i++) {
+            voices[i] = FloatVoice { static_cast<const float*>(sample.frames()), static_cast<float>(sample.length()),
+                static_cast<float>(sample.playback_loop().begin), 0, voice_rate(i) / SAMPLE_RATE };
+        }
+        float_ns[linear] = ns_per_voice_frame([&] {
+            std::memset(&out[0], 0, out.size() * sizeof(out[0]));
+            for (auto& v : voices) {
+                mix_float(v, &out[0], out.size(), linear != 0);
+            }
+        });
+    }
+    printf("%-22s %16.2f %16.2f\n", "float, scalar", float_ns[0], float_ns[1]);
+
+    const MixKernel kernels[] = { MixKernel::scalar, MixKernel::sse2, MixKernel::avx2 };
+    for (auto kernel : kernels) {
+        if (!mix_kernel_supported(kernel)) {
+            continue;
+        }
+        double fixed_ns[2];
+        for (int linear = 0; linear < 2; linear++) {
+            Mixer mix(VOICES, SAMPLE_RATE);
+            mix.kernel = kernel;
+            mix.set_interpolation(linear ? Interpolation::linear : Interpolation::nearest);
+            for (size_t i = 0; i < mix.channels.size(); i++) {
+                mix.channel(i).play(&sample);
+                mix.channel(i).set_volume(AudioChannel::volume_max);
+                mix.channel(i).set_playback_rate(voice_rate(i));
+            }
+            fixed_ns[linear] = ns_per_voice_frame([&] { mix.render(&out[0], out.size()); });
+        }
+        char label[32];
+        snprintf(label, sizeof label, "fixed 32.32, %s", mix_kernel_name(kernel));
+        printf("%-22s %16.2f %16.2f\n", label, fixed_ns[0], fixed_ns[1]);
+    }
+}
+
+// Steps both position types through a long one-shot sample a buffer at a
+// time, the way the mixer advances them, and reports how far each is from
+// the exact position. Only positions are tracked; no audio is mixed.
+static void drift()
+{
+    const double step = 1.0 / 3.0 + 0.0001;
+    const double seconds[] = { 60, 600, 3600 };
+    printf("\n%-10s %14s %18s %18s\n", "audio", "true frame", "float error", "fixed error");
+    for (double s : seconds) {
+        const auto frames = static_cast<size_t>(s * SAMPLE_RATE);
+        float float_index = 0;
+        const auto float_step = static_cast<float>(step);
+        SamplePosition fixed_index = 0;
+        const auto fixed_step = static_cast<SamplePosition>(step * static_cast<double>(position_from_frames(1)));
+        for (size_t done = 0; done < frames; done += FRAMES_PER_BUFFER) {
+            float_index += static_cast<float>(FRAMES_PER_BUFFER) * float_step;
+            fixed_index += FRAMES_PER_BUFFER * fixed_step;
+        }
+        const double exact = static_cast<double>((frames + FRAMES_PER_BUFFER - 1) / FRAMES_PER_BUFFER * FRAMES_PER_BUFFER) * step;
+        const double fixed = static_cast<double>(fixed_index) / static_cast<double>(position_from_frames(1));
+        printf("%8.0f s %14.0f %12.3f frames %12.6f frames\n", s, exact,
+            static_cast<double>(float_index) - exact, fixed - exact);
+    }
+}
+
+int main()
+{
+    Sample sample;
+    sample.wavetable.resize(SAMPLE_RATE);
+    for (size_t i = 0; i < sample.wavetable.size(); i++) {
+        sample.wavetable[i] = std::sin(static_cast<float>(i) * 0.05f) * 0.5f;
+    }
+    sample.loop = LoopParams(LoopType::forward, SAMPLE_RATE / 2, SAMPLE_RATE);
+    sample.prepare();
+
+    speed(sample);
+    drift();
+    return 0;
+}
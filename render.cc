@@ -0,0 +1,73 @@
+#include "offline_render.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static int usage()
+{
+    fprintf(stderr,
+        "usage: render [options] <module.it> <output.wav|output.raw>\n"
+        "  --rate <hz>         output sample rate (default 44100)\n"
+        "  --format <fmt>      s16, s24 or f32 (default s16)\n"
+        "  --clip <mode>       none, hard or soft: what happens past full scale\n"
+        "                      (default hard; none only matters for f32)\n"
+        "  --dither            add triangular dither when writing s16 or s24\n"
+        "  --interp <mode>     nearest, linear, cubic, sinc8 or sinc16 (default nearest)\n"
+        "  --voices <n>        most voices sounding at once, 1 to 256 (default 256)\n"
+        "  --seconds <n>       stop after n seconds even if the song goes on\n");
+    return 2;
+}
+
+int main(int argc, char* argv[])
+{
+    RenderOptions options;
+    const char* paths[2] = { nullptr, nullptr };
+    size_t path_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            options.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!sample_format_from_name(argv[++i], options.format)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--clip") == 0 && i + 1 < argc) {
+            if (!clipping_from_name(argv[++i], options.clipping)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--dither") == 0) {
+            options.dither = true;
+        } else if (strcmp(argv[i], "--interp") == 0 && i + 1 < argc) {
+            if (!interpolation_from_name(argv[++i], options.interpolation)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            const int voices = atoi(argv[++i]);
+            if (voices < 1 || voices > 256) {
+                return usage();
+            }
+            options.voice_limit = static_cast<size_t>(voices);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            options.max_seconds = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && path_count < 2) {
+            paths[path_count++] = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (path_count != 2 || options.sample_rate <= 0) {
+        return usage();
+    }
+
+    try {
+        RenderResult result = render_module(paths[0], paths[1], options);
+        printf("%s: rendered %.1f s of audio in %.3f s (%.1fx realtime)\n",
+            paths[1], result.audio_seconds, result.elapsed_seconds, result.realtime_factor());
+    } catch (const std::runtime_error& e) {
+        fprintf(stderr, "render: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
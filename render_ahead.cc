@@ -0,0 +1,76 @@
+#include "render_ahead.h"
+#include <chrono>
+
+static const size_t max_chunk = 256;
+static const size_t min_chunk = 16;
+
+RenderAhead::RenderAhead(Source s, size_t lookahead, int rate)
+    : source(std::move(s))
+    , _lookahead(std::max(lookahead, 2 * min_chunk))
+    , chunk(std::max(std::min(_lookahead / 4, max_chunk), min_chunk))
+    , sample_rate(rate)
+    , ring(_lookahead + chunk)
+    , stopping(false)
+    , source_done(false)
+{
+}
+
+RenderAhead::~RenderAhead()
+{
+    stop();
+}
+
+void RenderAhead::start()
+{
+    if (thread.joinable()) {
+        return;
+    }
+    stopping = false;
+    produce();
+    thread = std::thread(&RenderAhead::run, this);
+}
+
+void RenderAhead::stop()
+{
+    if (thread.joinable()) {
+        stopping = true;
+        thread.join();
+    }
+}
+
+size_t RenderAhead::read(StereoSample* out, size_t frames)
+{
+    const size_t n = ring.read(out, frames);
+    std::fill(out + n, out + frames, StereoSample { 0, 0 });
+    return n;
+}
+
+void RenderAhead::produce()
+{
+    while (!source_done.load(std::memory_order_relaxed) && ring.fill() < _lookahead) {
+        StereoSample* out;
+        const size_t space = ring.writable(out, chunk);
+        if (space == 0) {
+            return;
+        }
+        const size_t n = source(out, space);
+        ring.commit(n);
+        if (n < space) {
+            source_done.store(true, std::memory_order_release);
+        }
+    }
+}
+
+void RenderAhead::run()
+{
+    // About half a chunk's worth of playing time, so the ring is topped up
+    // well before the callback can drain what's above the lookahead
+    const auto nap = std::chrono::microseconds(chunk * 500000 / static_cast<size_t>(sample_rate));
+    while (!stopping.load()) {
+        produce();
+        if (source_done.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::this_thread::sleep_for(nap);
+    }
+}
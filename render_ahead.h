@@ -0,0 +1,61 @@
+#ifndef _RENDER_AHEAD_H_
+#define _RENDER_AHEAD_H_
+#include "frame_ring.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Renders audio ahead of time on a thread of its own, so the audio callback
+// only copies frames out of a ring. A slow tick then eats into the frames
+// already buffered instead of making the callback miss its deadline, which
+// lets the device run with much smaller buffers. The price is latency: what
+// the producer renders is heard lookahead frames later, so changes made to
+// the song take that long to be heard.
+class RenderAhead {
+public:
+    // Renders the next frames into out and returns how many it rendered;
+    // fewer than asked means there's nothing more to play. Only ever called
+    // from the producer thread (and from start()).
+    using Source = std::function<size_t(StereoSample* out, size_t frames)>;
+
+    // Keeps up to lookahead frames rendered ahead of the callback.
+    RenderAhead(Source source, size_t lookahead, int sample_rate);
+    // Stops the producer.
+    ~RenderAhead();
+    RenderAhead(const RenderAhead&) = delete;
+    RenderAhead& operator=(const RenderAhead&) = delete;
+
+    // Fills the ring, then starts the producer thread.
+    void start();
+    // Stops the producer thread; what's buffered can still be read.
+    void stop();
+
+    // For the audio callback: copies the next frames into out. If the
+    // producer has fallen behind, the frames it hasn't rendered yet are
+    // silent. Returns how many frames were ready, so fewer than asked is an
+    // underrun unless the source has ended. Wait-free.
+    size_t read(StereoSample* out, size_t frames);
+    // True once the source has ended and everything it rendered was read.
+    bool finished() const { return source_done.load(std::memory_order_acquire) && ring.fill() == 0; }
+
+    // Frames rendered and waiting to be played. Any thread.
+    size_t fill() const { return ring.fill(); }
+    size_t lookahead() const { return _lookahead; }
+
+private:
+    void run();
+    // Renders until the ring holds lookahead frames or the source ends.
+    void produce();
+
+    Source source;
+    const size_t _lookahead;
+    // Frames rendered in one go; small enough that the producer tops the
+    // ring up often, large enough to keep the source's per-call cost down.
+    const size_t chunk;
+    const int sample_rate;
+    FrameRing ring;
+    std::thread thread;
+    std::atomic<bool> stopping;
+    std::atomic<bool> source_done;
+};
+#endif
@@ -0,0 +1,171 @@
+#include "render_stats.h"
+#include <cstdio>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the audio thread can't wait on a lock to count");
+
+RenderStats::RenderStats(int rate)
+    : sample_rate(rate)
+    , callbacks(0)
+    , frames(0)
+    , underflows(0)
+    , deadline_misses(0)
+    , render_ns(0)
+    , max_render_ns(0)
+    , max_load_ppm(0)
+    , ticks(0)
+    , tick_ns(0)
+    , max_tick_ns(0)
+    , peak_voices(0)
+    , buffered(0)
+    , min_buffered(~uint64_t(0))
+{
+    for (auto& bucket : load_histogram) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void RenderStats::record_callback(clock::time_point started, size_t n, bool underflow)
+{
+    const uint64_t ns = ns_since(started);
+    // What the buffer lasts, which is how long the callback had
+    const uint64_t budget_ns = n * uint64_t(1000000000) / static_cast<uint64_t>(sample_rate);
+    const uint64_t load_ppm = budget_ns ? ns * 1000000 / budget_ns : 0;
+
+    add(callbacks, 1);
+    add(frames, n);
+    add(underflows, underflow);
+    add(deadline_misses, ns > budget_ns);
+    add(render_ns, ns);
+    raise(max_render_ns, ns);
+    raise(max_load_ppm, load_ppm);
+    const uint64_t bucket = load_ppm / (bucket_percent * 10000);
+    add(load_histogram[bucket < load_buckets ? bucket : load_buckets - 1], 1);
+}
+
+void RenderStats::record_buffered(size_t frames_waiting)
+{
+    buffered.store(frames_waiting, std::memory_order_relaxed);
+    if (frames_waiting < min_buffered.load(std::memory_order_relaxed)) {
+        min_buffered.store(frames_waiting, std::memory_order_relaxed);
+    }
+}
+
+void RenderStats::record_voices(size_t voices)
+{
+    raise(peak_voices, voices);
+}
+
+void RenderStats::record_tick(clock::time_point started)
+{
+    const uint64_t ns = ns_since(started);
+    add(ticks, 1);
+    add(tick_ns, ns);
+    raise(max_tick_ns, ns);
+}
+
+RenderStats::Report RenderStats::read() const
+{
+    Report r;
+    r.sample_rate = sample_rate;
+    r.callbacks = callbacks.load(std::memory_order_relaxed);
+    r.frames = frames.load(std::memory_order_relaxed);
+    r.underflows = underflows.load(std::memory_order_relaxed);
+    r.deadline_misses = deadline_misses.load(std::memory_order_relaxed);
+    r.render_ns = render_ns.load(std::memory_order_relaxed);
+    r.max_render_ns = max_render_ns.load(std::memory_order_relaxed);
+    r.max_load = static_cast<double>(max_load_ppm.load(std::memory_order_relaxed)) / 1e6;
+    r.ticks = ticks.load(std::memory_order_relaxed);
+    r.tick_ns = tick_ns.load(std::memory_order_relaxed);
+    r.max_tick_ns = max_tick_ns.load(std::memory_order_relaxed);
+    r.peak_voices = peak_voices.load(std::memory_order_relaxed);
+    const uint64_t lowest = min_buffered.load(std::memory_order_relaxed);
+    r.render_ahead = lowest != ~uint64_t(0);
+    r.buffered = buffered.load(std::memory_order_relaxed);
+    r.min_buffered = r.render_ahead ? lowest : 0;
+    for (size_t i = 0; i < load_buckets; i++) {
+        r.load_histogram[i] = load_histogram[i].load(std::memory_order_relaxed);
+    }
+    return r;
+}
+
+double RenderStats::Report::mean_render_us() const
+{
+    return callbacks ? static_cast<double>(render_ns) / static_cast<double>(callbacks) / 1e3 : 0;
+}
+
+double RenderStats::Report::mean_tick_us() const
+{
+    return ticks ? static_cast<double>(tick_ns) / static_cast<double>(ticks) / 1e3 : 0;
+}
+
+double RenderStats::Report::mean_load() const
+{
+    if (!frames || !sample_rate) {
+        return 0;
+    }
+    const double audio_ns = static_cast<double>(frames) * 1e9 / sample_rate;
+    return static_cast<double>(render_ns) / audio_ns;
+}
+
+std::string format_text(const RenderStats::Report& r)
+{
+    char buffer[256];
+    std::string text;
+    snprintf(buffer, sizeof buffer, "callbacks %llu, %.1f s of audio, %llu underflows, %llu deadline misses\n",
+        static_cast<unsigned long long>(r.callbacks), r.sample_rate ? static_cast<double>(r.frames) / r.sample_rate : 0.0,
+        static_cast<unsigned long long>(r.underflows), static_cast<unsigned long long>(r.deadline_misses));
+    text += buffer;
+    snprintf(buffer, sizeof buffer, "render    mean %.1f us, max %.1f us; load mean %.1f%%, max %.1f%%\n",
+        r.mean_render_us(), static_cast<double>(r.max_render_ns) / 1e3, r.mean_load() * 100, r.max_load * 100);
+    text += buffer;
+    snprintf(buffer, sizeof buffer, "ticks     %llu, mean %.1f us, max %.1f us\n", static_cast<unsigned long long>(r.ticks),
+        r.mean_tick_us(), static_cast<double>(r.max_tick_ns) / 1e3);
+    text += buffer;
+    snprintf(buffer, sizeof buffer, "voices    peak %llu\n", static_cast<unsigned long long>(r.peak_voices));
+    text += buffer;
+    if (r.render_ahead) {
+        snprintf(buffer, sizeof buffer, "ahead     %llu frames buffered, lowest %llu\n",
+            static_cast<unsigned long long>(r.buffered), static_cast<unsigned long long>(r.min_buffered));
+        text += buffer;
+    }
+    text += "load     ";
+    for (size_t i = 0; i < RenderStats::load_buckets; i++) {
+        if (!r.load_histogram[i]) {
+            continue;
+        }
+        const unsigned low = static_cast<unsigned>(i) * RenderStats::bucket_percent;
+        if (i + 1 < RenderStats::load_buckets) {
+            snprintf(buffer, sizeof buffer, " %u-%u%%: %llu", low, low + RenderStats::bucket_percent,
+                static_cast<unsigned long long>(r.load_histogram[i]));
+        } else {
+            snprintf(buffer, sizeof buffer, " %u%%+: %llu", low, static_cast<unsigned long long>(r.load_histogram[i]));
+        }
+        text += buffer;
+    }
+    text += '\n';
+    return text;
+}
+
+std::string format_json(const RenderStats::Report& r)
+{
+    char buffer[512];
+    snprintf(buffer, sizeof buffer,
+        "{\"sample_rate\": %d, \"callbacks\": %llu, \"frames\": %llu, \"underflows\": %llu, "
+        "\"deadline_misses\": %llu, \"render_us_mean\": %.2f, \"render_us_max\": %.2f, "
+        "\"load_mean\": %.4f, \"load_max\": %.4f, \"ticks\": %llu, \"tick_us_mean\": %.2f, "
+        "\"tick_us_max\": %.2f, \"peak_voices\": %llu, \"render_ahead\": %s, \"buffered\": %llu, "
+        "\"min_buffered\": %llu, \"load_bucket_percent\": %u, \"load_histogram\": [",
+        r.sample_rate, static_cast<unsigned long long>(r.callbacks), static_cast<unsigned long long>(r.frames),
+        static_cast<unsigned long long>(r.underflows), static_cast<unsigned long long>(r.deadline_misses),
+        r.mean_render_us(), static_cast<double>(r.max_render_ns) / 1e3, r.mean_load(), r.max_load,
+        static_cast<unsigned long long>(r.ticks), r.mean_tick_us(), static_cast<double>(r.max_tick_ns) / 1e3,
+        static_cast<unsigned long long>(r.peak_voices), r.render_ahead ? "true" : "false",
+        static_cast<unsigned long long>(r.buffered), static_cast<unsigned long long>(r.min_buffered),
+        RenderStats::bucket_percent);
+    std::string json = buffer;
+    for (size_t i = 0; i < RenderStats::load_buckets; i++) {
+        json += (i ? ", " : "") + std::to_string(r.load_histogram[i]);
+    }
+    json += "]}";
+    return json;
+}
@@ -0,0 +1,112 @@
+#ifndef _RENDER_STATS_H_
+#define _RENDER_STATS_H_
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// How the audio callback is keeping up: how long each callback takes to
+// render against the time its buffer lasts, how often the device ran dry,
+// how long the sequencer's ticks take and how many voices sounded at most.
+// When a RenderAhead thread renders for the callback, also how many frames
+// it had waiting.
+//
+// The rendering threads record; any other thread can read at any time.
+// Each counter is an atomic with only one thread writing it, so recording
+// is a handful of relaxed loads and stores: no locks, no allocation, no
+// read-modify-write instructions. A read may see one callback's counters
+// half updated, which is fine for monitoring.
+class RenderStats {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Render time as a share of the buffer's duration, in 10% steps; the
+    // last bucket takes everything from 150% up.
+    static const size_t load_buckets = 16;
+    static const unsigned bucket_percent = 10;
+
+    struct Report {
+        int sample_rate = 0;
+        uint64_t callbacks = 0;
+        uint64_t frames = 0;
+        // Callbacks that found the output running dry: the device reported
+        // an underflow, or the render-ahead ring came up short.
+        uint64_t underflows = 0;
+        uint64_t deadline_misses = 0; // callbacks that took longer than their buffer lasts
+        uint64_t render_ns = 0; // in all callbacks
+        uint64_t max_render_ns = 0;
+        double max_load = 0; // worst render time over buffer duration
+        uint64_t ticks = 0;
+        uint64_t tick_ns = 0;
+        uint64_t max_tick_ns = 0;
+        uint64_t peak_voices = 0;
+        // Frames rendered ahead, now and at the lowest; only with render-ahead
+        bool render_ahead = false;
+        uint64_t buffered = 0;
+        uint64_t min_buffered = 0;
+        std::array<uint64_t, load_buckets> load_histogram;
+
+        double mean_render_us() const;
+        double mean_tick_us() const;
+        // Share of the audio's duration spent rendering it
+        double mean_load() const;
+    };
+
+    explicit RenderStats(int sample_rate);
+
+    // Audio thread only. started is when the callback began rendering (or
+    // copying out of the render-ahead ring); underflow says whether the
+    // output ran dry for this callback.
+    void record_callback(clock::time_point started, size_t frames, bool underflow);
+    // Audio thread only: the frames waiting in the render-ahead ring.
+    void record_buffered(size_t frames);
+    // Only from whichever thread renders: after each callback or chunk.
+    void record_voices(size_t voices);
+    // Only from whichever thread renders; started is when the tick began
+    // processing.
+    void record_tick(clock::time_point started);
+
+    // Any thread.
+    Report read() const;
+
+private:
+    static uint64_t ns_since(clock::time_point started)
+    {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - started).count());
+    }
+    static void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void raise(std::atomic<uint64_t>& peak, uint64_t n)
+    {
+        if (n > peak.load(std::memory_order_relaxed)) {
+            peak.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    const int sample_rate;
+    std::atomic<uint64_t> callbacks;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> underflows;
+    std::atomic<uint64_t> deadline_misses;
+    std::atomic<uint64_t> render_ns;
+    std::atomic<uint64_t> max_render_ns;
+    // In millionths, to stay an integer
+    std::atomic<uint64_t> max_load_ppm;
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint64_t> tick_ns;
+    std::atomic<uint64_t> max_tick_ns;
+    std::atomic<uint64_t> peak_voices;
+    std::atomic<uint64_t> buffered;
+    std::atomic<uint64_t> min_buffered; // all ones until anything's recorded
+    std::array<std::atomic<uint64_t>, load_buckets> load_histogram;
+};
+
+// A few lines for people
+std::string format_text(const RenderStats::Report& report);
+// One JSON object, for other programs
+std::string format_json(const RenderStats::Report& report);
+#endif
@@ -0,0 +1,125 @@
+#include "it_sample.h"
+#include "synth_module.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// The usual way of reading the compressed stream: one bit at a time out of
+// the current byte. Kept as the baseline for the buffered reader.
+namespace bitwise {
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t byte = 0;
+    unsigned bit = 0;
+
+    uint32_t read(unsigned width)
+    {
+        uint32_t value = 0;
+        for (unsigned i = 0; i < width; i++, bit++) {
+            if (bit == 8) {
+                bit = 0;
+                byte++;
+            }
+            if (byte < size && (data[byte] >> bit) & 1) {
+                value |= uint32_t(1) << i;
+            }
+        }
+        return value;
+    }
+};
+
+template <typename T>
+void decompress(const std::vector<uint8_t>& data, T* out, size_t count, bool it215)
+{
+    const unsigned sample_bits = 8 * sizeof(T);
+    const unsigned max_width = sample_bits + 1;
+    const uint32_t border_offset = sizeof(T) == 1 ? 4 : 8;
+    const size_t block_samples = sizeof(T) == 1 ? 0x8000 : 0x4000;
+    size_t offset = 0;
+    while (count) {
+        const size_t block = count < block_samples ? count : block_samples;
+        const size_t length = data[offset] | static_cast<size_t>(data[offset + 1]) << 8;
+        BitReader bits { &data[offset + 2], length };
+        offset += 2 + length;
+        unsigned width = max_width;
+        T d1 = 0;
+        T d2 = 0;
+        for (size_t i = 0; i < block;) {
+            uint32_t value = bits.read(width);
+            if (width < 7) {
+                if (value == uint32_t(1) << (width - 1)) {
+                    value = bits.read(sizeof(T) == 1 ? 3 : 4) + 1;
+                    width = value < width ? value : value + 1;
+                    continue;
+                }
+            } else if (width < max_width) {
+                const uint32_t border = (((uint32_t(1) << sample_bits) - 1) >> (max_width - width)) - border_offset;
+                if (value > border && value <= border + 2 * border_offset) {
+                    value -= border;
+                    width = value < width ? value : value + 1;
+                    continue;
+                }
+            } else if (value & (uint32_t(1) << sample_bits)) {
+                width = (value + 1) & 0xFF;
+                continue;
+            }
+            int32_t delta = width < sample_bits
+                ? static_cast<int32_t>(value << (32 - width)) >> (32 - width)
+                : static_cast<T>(value);
+            d1 = static_cast<T>(d1 + delta);
+            d2 = static_cast<T>(d2 + d1);
+            out[i++] = it215 ? d2 : d1;
+        }
+        out += block;
+        count -= block;
+    }
+}
+}
+
+template <typename Decode>
+static double samples_per_second(size_t samples, Decode decode)
+{
+    using clock = std::chrono::steady_clock;
+    const size_t passes = 20;
+    decode(); // warm up
+    auto start = clock::now();
+    for (size_t i = 0; i < passes; i++) {
+        decode();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return static_cast<double>(samples * passes) / elapsed.count();
+}
+
+template <typename T>
+static void bench(const char* name, bool it215)
+{
+    const size_t length = 44100 * 20;
+    const auto wave = make_test_wave(length, 3, sizeof(T) == 2);
+    std::vector<T> source(wave.begin(), wave.end());
+    const auto packed = compress_it_sample(source.data(), source.size(), it215);
+    std::vector<T> out(length);
+
+    const double buffered = samples_per_second(length, [&] {
+        decompress_it_sample(ByteView(packed.data(), packed.size()), out.data(), out.size(), it215);
+    });
+    if (out != source) {
+        fprintf(stderr, "sample_bench: %s did not round-trip\n", name);
+    }
+    const double baseline = samples_per_second(length, [&] {
+        bitwise::decompress(packed, out.data(), out.size(), it215);
+    });
+    printf("%-12s %7.1f%% %16.1f %16.1f %8.2fx\n", name,
+        100.0 * static_cast<double>(packed.size()) / static_cast<double>(length * sizeof(T)),
+        buffered / 1e6, baseline / 1e6, buffered / baseline);
+}
+
+int main()
+{
+    printf("%-12s %8s %16s %16s %9s\n", "format", "ratio", "Msamples/s", "bitwise Ms/s", "speedup");
+    bench<int8_t>("8-bit 2.14", false);
+    bench<int8_t>("8-bit 2.15", true);
+    bench<int16_t>("16-bit 2.14", false);
+    bench<int16_t>("16-bit 2.15", true);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "seek_index.h"
+#include "synth_module.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#define SAMPLE_RATE (44100)
+
+// Seek latency with and without a SeekIndex, on synthetic songs of
+// increasing length. Without an index a seek has to play the song from the
+// start, either rendering it (as a naive player would) or just skipping.
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+int main()
+{
+    const size_t pattern_counts[] = { 4, 16, 64, 200 };
+    const size_t seeks = 20;
+    std::mt19937 rng(1);
+
+    printf("%8s %10s %10s %10s %12s %12s %12s\n", "length", "index ms", "snapshots", "index KiB",
+        "indexed us", "skip us", "render us");
+    for (size_t patterns : pattern_counts) {
+        SynthModuleParams params;
+        params.patterns = patterns;
+        params.channels = 16;
+        params.instruments = true;
+        params.new_note_action = 3; // fade, so background voices pile up
+        params.fadeout = 16;
+        const auto bytes = make_synth_module(params);
+        Module mod = load_module(ByteView(bytes.data(), bytes.size()));
+        mod.load_all_patterns();
+
+        auto start = clock_type::now();
+        const SeekIndex index(mod, SAMPLE_RATE);
+        const double build = seconds_since(start);
+
+        std::uniform_int_distribution<uint64_t> target(0, index.length() - 1);
+        std::vector<uint64_t> targets(seeks);
+        for (auto& t : targets) {
+            t = target(rng);
+        }
+
+        SongPlayer song(&mod, SAMPLE_RATE);
+        start = clock_type::now();
+        for (uint64_t t : targets) {
+            index.seek(song, t);
+        }
+        const double indexed = seconds_since(start) / seeks;
+
+        start = clock_type::now();
+        for (uint64_t t : targets) {
+            SongPlayer fresh(&mod, SAMPLE_RATE);
+            fresh.skip(t);
+        }
+        const double skipped = seconds_since(start) / seeks;
+
+        // Rendering is slow enough that a few seeks make the point
+        const size_t render_seeks = 3;
+        std::vector<StereoSample> buffer(4096);
+        start = clock_type::now();
+        for (size_t i = 0; i < render_seeks; i++) {
+            SongPlayer fresh(&mod, SAMPLE_RATE);
+            for (uint64_t left = targets[i]; left;) {
+                const size_t n = left < buffer.size() ? left : buffer.size();
+                fresh.render(&buffer[0], n);
+                left -= n;
+            }
+        }
+        const double rendered = seconds_since(start) / render_seeks;
+
+        const double minutes = static_cast<double>(index.length()) / SAMPLE_RATE / 60;
+        printf("%6.1f m %10.2f %10zu %10.0f %12.1f %12.1f %12.1f\n", minutes, build * 1e3,
+            index.snapshot_count(), static_cast<double>(index.memory_usage()) / 1024,
+            indexed * 1e6, skipped * 1e6, rendered * 1e6);
+    }
+    return 0;
+}
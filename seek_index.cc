@@ -0,0 +1,77 @@
+#include "seek_index.h"
+#include <algorithm>
+
+const uint64_t SeekIndex::not_played;
+
+SeekIndex::SeekIndex(const Module& mod, int sample_rate, size_t voice_limit, double snapshot_interval)
+    : _length(0)
+    , row_frames(mod.orders.size())
+{
+    SongPlayer song(&mod, sample_rate, voice_limit);
+    const auto interval = static_cast<uint64_t>(std::max(snapshot_interval, 0.01) * sample_rate);
+    uint64_t next_snapshot = 0;
+    while (!song.finished()) {
+        const uint64_t frame = song.position();
+        if (frame >= next_snapshot) {
+            snapshots.push_back(song.snapshot());
+            next_snapshot = frame + interval;
+        }
+        const auto& player = song.player;
+        if (player.ticks_to_next_row == 0 && player.current_order < row_frames.size()) {
+            // The next tick starts this row
+            auto& rows = row_frames[player.current_order];
+            if (rows.size() <= player.current_row) {
+                rows.resize(player.current_row + 1u, not_played);
+            }
+            if (rows[player.current_row] == not_played) {
+                rows[player.current_row] = frame;
+            }
+        }
+        song.skip_tick();
+    }
+    _length = song.position();
+}
+
+bool SeekIndex::row_time(size_t order, size_t row, uint64_t& frame) const
+{
+    if (order >= row_frames.size() || row >= row_frames[order].size() || row_frames[order][row] == not_played) {
+        return false;
+    }
+    frame = row_frames[order][row];
+    return true;
+}
+
+uint64_t SeekIndex::seek(SongPlayer& song, uint64_t frame) const
+{
+    auto after = std::upper_bound(snapshots.begin(), snapshots.end(), frame,
+        [](uint64_t f, const SongPlayer::Snapshot& s) { return f < s.frame; });
+    if (after == snapshots.begin()) {
+        return song.position();
+    }
+    const auto& from = *(after - 1);
+    song.restore(from);
+    song.skip(frame - from.frame);
+    return frame;
+}
+
+bool SeekIndex::seek_row(SongPlayer& song, size_t order, size_t row) const
+{
+    uint64_t frame;
+    if (!row_time(order, row, frame)) {
+        return false;
+    }
+    seek(song, frame);
+    return true;
+}
+
+size_t SeekIndex::memory_usage() const
+{
+    size_t bytes = sizeof(*this) + row_frames.capacity() * sizeof(row_frames[0]);
+    for (const auto& rows : row_frames) {
+        bytes += rows.capacity() * sizeof(rows[0]);
+    }
+    for (const auto& s : snapshots) {
+        bytes += sizeof(s) + s.channels.capacity() * sizeof(s.channels[0]);
+    }
+    return bytes;
+}
@@ -0,0 +1,43 @@
+#ifndef _SEEK_INDEX_H_
+#define _SEEK_INDEX_H_
+#include "song.h"
+#include <vector>
+
+// Where everything is in a song, for seeking. Built by running the song
+// through once without rendering it: notes where each order and row first
+// starts playing, and keeps a snapshot of the player every so often. A seek
+// restores the last snapshot before the target and skips forward from there,
+// so it costs at most one snapshot interval of sequencing however long the
+// song is.
+class SeekIndex {
+public:
+    static constexpr double default_snapshot_interval = 5.0;
+
+    // The index only suits SongPlayers with the same sample rate and voice
+    // limit it was built with.
+    SeekIndex(const Module& mod, int sample_rate, size_t voice_limit = VoicePool::max_voices,
+        double snapshot_interval = default_snapshot_interval);
+
+    // Frames in one pass through the song
+    uint64_t length() const { return _length; }
+    // The frame the row first starts on. False if it's never played.
+    bool row_time(size_t order, size_t row, uint64_t& frame) const;
+    // Puts song at the frame; past the end of the song plays on from there
+    // (the song loops). Returns the frame seeked to.
+    uint64_t seek(SongPlayer& song, uint64_t frame) const;
+    // Puts song at the start of the row; false if the row is never played.
+    bool seek_row(SongPlayer& song, size_t order, size_t row) const;
+
+    size_t snapshot_count() const { return snapshots.size(); }
+    size_t memory_usage() const;
+
+private:
+    static const uint64_t not_played = ~uint64_t(0);
+
+    uint64_t _length;
+    // First frame of each row, by order then row
+    std::vector<std::vector<uint64_t>> row_frames;
+    // In order of time; the first is at frame 0
+    std::vector<SongPlayer::Snapshot> snapshots;
+};
+#endif
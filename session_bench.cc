@@ -0,0 +1,97 @@
+#include "session_engine.h"
+#include "synth_module.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define SAMPLE_RATE (44100)
+
+// How many sessions one core can keep playing in real time. Sessions play
+// a mix of synthetic songs, each from a random point so their loads don't
+// line up, and the engine renders blocks of all of them as fast as it can.
+// A block of n sessions that takes half the block's duration to render
+// means 2n sessions would just keep up.
+
+using clock_type = std::chrono::steady_clock;
+
+int main(int argc, char* argv[])
+{
+    size_t block_frames = 256;
+    size_t voice_limit = SessionEngine::default_voice_limit;
+    size_t sessions_per_thread = 64;
+    double seconds = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--block") == 0) {
+            block_frames = static_cast<size_t>(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--voices") == 0) {
+            voice_limit = static_cast<size_t>(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--sessions") == 0) {
+            sessions_per_thread = static_cast<size_t>(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            seconds = atof(argv[i + 1]);
+        } else {
+            fprintf(stderr, "usage: session_bench [--block <frames>] [--voices <n>] [--sessions <per thread>] "
+                            "[--seconds <n>]\n");
+            return 2;
+        }
+    }
+
+    std::vector<std::shared_ptr<const Module>> modules;
+    size_t shared_bytes = 0;
+    const size_t channel_counts[] = { 4, 8, 16, 32 };
+    for (size_t i = 0; i < 4; i++) {
+        SynthModuleParams params;
+        params.patterns = 16;
+        params.channels = channel_counts[i];
+        params.instruments = true;
+        params.new_note_action = 3;
+        params.fadeout = 64;
+        params.seed = static_cast<uint32_t>(i + 1);
+        const auto bytes = make_synth_module(params);
+        modules.push_back(SessionEngine::share(load_module(ByteView(bytes.data(), bytes.size()))));
+        shared_bytes += module_memory_usage(*modules.back()).total();
+    }
+
+    const double block_seconds = static_cast<double>(block_frames) / SAMPLE_RATE;
+    printf("block %zu frames (%.2f ms), voice limit %zu, %zu modules sharing %.0f KiB\n\n", block_frames,
+        block_seconds * 1e3, voice_limit, modules.size(), static_cast<double>(shared_bytes) / 1024);
+    printf("%8s %9s %14s %14s %16s %14s\n", "threads", "sessions", "block ms", "realtime x", "sessions/core",
+        "KiB/session");
+
+    std::vector<size_t> thread_counts;
+    for (size_t t = 1; t < hardware_threads(); t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(hardware_threads());
+
+    std::mt19937 rng(1);
+    for (size_t threads : thread_counts) {
+        SessionEngine engine(SAMPLE_RATE, block_frames, threads);
+        const size_t count = sessions_per_thread * threads;
+        size_t session_bytes = 0;
+        for (size_t i = 0; i < count; i++) {
+            const size_t id = engine.open(modules[i % modules.size()], voice_limit);
+            engine.song(id).skip(std::uniform_int_distribution<size_t>(0, 60 * SAMPLE_RATE)(rng));
+            session_bytes += engine.session_memory(id);
+        }
+
+        engine.render_block(); // warm up
+        size_t blocks = 0;
+        const auto start = clock_type::now();
+        double elapsed = 0;
+        while (elapsed < seconds) {
+            engine.render_block();
+            blocks++;
+            elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+        }
+        const double block_time = elapsed / static_cast<double>(blocks);
+        const double realtime = block_seconds / block_time;
+        printf("%8zu %9zu %14.3f %14.1f %16.0f %14.1f\n", threads, count, block_time * 1e3, realtime,
+            static_cast<double>(count) * realtime / static_cast<double>(threads),
+            static_cast<double>(session_bytes) / static_cast<double>(count) / 1024);
+    }
+    return 0;
+}
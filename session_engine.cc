@@ -0,0 +1,74 @@
+#include "session_engine.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Jobs per thread for each block: enough that a thread finishing early can
+// steal work from one that drew expensive sessions, few enough that the
+// pool's per-job cost stays small next to rendering.
+static const size_t jobs_per_thread = 4;
+
+std::shared_ptr<const Module> SessionEngine::share(Module mod)
+{
+    mod.load_all_patterns();
+    return std::make_shared<const Module>(std::move(mod));
+}
+
+SessionEngine::SessionEngine(int rate, size_t block_frames, size_t threads)
+    : sample_rate(rate)
+    , _block_frames(std::max<size_t>(block_frames, 1))
+    , pool(threads)
+{
+}
+
+size_t SessionEngine::open(std::shared_ptr<const Module> mod, size_t voice_limit)
+{
+    if (!mod) {
+        throw std::runtime_error("no module to play");
+    }
+    std::unique_ptr<Session> session(new Session(std::move(mod), sample_rate, voice_limit, _block_frames));
+    playing.push_back(session.get());
+    if (free_ids.empty()) {
+        sessions.push_back(std::move(session));
+        return sessions.size() - 1;
+    }
+    const size_t id = free_ids.back();
+    free_ids.pop_back();
+    sessions[id] = std::move(session);
+    return id;
+}
+
+void SessionEngine::close(size_t id)
+{
+    if (id >= sessions.size() || !sessions[id]) {
+        return;
+    }
+    playing.erase(std::find(playing.begin(), playing.end(), sessions[id].get()));
+    sessions[id].reset();
+    free_ids.push_back(id);
+}
+
+void SessionEngine::render_block()
+{
+    if (playing.empty()) {
+        return;
+    }
+    const size_t jobs = std::min(playing.size(), pool.thread_count() * jobs_per_thread);
+    for (size_t j = 0; j < jobs; j++) {
+        const size_t first = playing.size() * j / jobs;
+        const size_t last = playing.size() * (j + 1) / jobs;
+        pool.submit([this, first, last] {
+            for (size_t i = first; i < last; i++) {
+                Session& session = *playing[i];
+                session.song.render(&session.out[0], session.out.size());
+            }
+        });
+    }
+    pool.wait();
+}
+
+size_t SessionEngine::session_memory(size_t id) const
+{
+    const Session& session = *sessions[id];
+    return sizeof(Session) - sizeof(SongPlayer) + session.song.memory_usage()
+        + session.out.capacity() * sizeof(StereoSample);
+}
@@ -0,0 +1,71 @@
+#ifndef _SESSION_ENGINE_H_
+#define _SESSION_ENGINE_H_
+#include "job_pool.h"
+#include "song.h"
+#include <memory>
+#include <vector>
+
+// Plays many songs at once, for serving many listeners from one process.
+// Each session is a SongPlayer of its own; what the sessions play is shared.
+// A module, its patterns and its samples are loaded once, never change while
+// they're played, and go away with the last session playing them. That
+// leaves a session with only its playback state: the sequencer, the voices
+// and a block of output, a few tens of KiB however big the module is.
+//
+// Sessions are rendered a block at a time, all of them together, spread over
+// a pool of threads. Opening and closing sessions, and render_block(), are
+// for one controlling thread.
+class SessionEngine {
+public:
+    // Enough for most songs, and much less memory than VoicePool::max_voices
+    static const size_t default_voice_limit = 64;
+
+    // Makes a module ready to be shared: decodes all its patterns, so nothing
+    // in it changes (or allocates) while it plays.
+    static std::shared_ptr<const Module> share(Module mod);
+
+    SessionEngine(int sample_rate, size_t block_frames, size_t threads = hardware_threads());
+
+    // Returns the new session's id. Ids of closed sessions are reused.
+    size_t open(std::shared_ptr<const Module> mod, size_t voice_limit = default_voice_limit);
+    void close(size_t id);
+    size_t session_count() const { return playing.size(); }
+
+    // Renders the next block of every session, returning once all are done.
+    void render_block();
+    // The session's last block; block_frames() frames long.
+    const StereoSample* output(size_t id) const { return &sessions[id]->out[0]; }
+    // True once the session's song has played through; it carries on from
+    // the start.
+    bool finished(size_t id) const { return sessions[id]->song.finished(); }
+    // For seeking a session, or changing how it plays, between blocks.
+    SongPlayer& song(size_t id) { return sessions[id]->song; }
+
+    size_t block_frames() const { return _block_frames; }
+    size_t thread_count() const { return pool.thread_count(); }
+    // Bytes owned by the session, not counting the module it shares.
+    size_t session_memory(size_t id) const;
+
+private:
+    struct Session {
+        Session(std::shared_ptr<const Module> m, int sample_rate, size_t voice_limit, size_t block_frames)
+            : mod(std::move(m))
+            , song(mod.get(), sample_rate, voice_limit)
+            , out(block_frames)
+        {
+        }
+        std::shared_ptr<const Module> mod; // kept alive for song
+        SongPlayer song;
+        std::vector<StereoSample> out;
+    };
+
+    const int sample_rate;
+    const size_t _block_frames;
+    // By id; null where a session was closed
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::vector<size_t> free_ids;
+    // The open sessions, packed together for render_block()
+    std::vector<Session*> playing;
+    WorkStealingPool pool;
+};
+#endif
@@ -0,0 +1,221 @@
+#include "song.h"
+#include <algorithm>
+
+static const unsigned slowest_tempo = 32;
+// The period of C-5, which plays a sample at its C5 speed
+static const float middle_c_period = 1712;
+
+// No more mixer channels than there can be voices
+static size_t clamp_voices(size_t voice_limit)
+{
+    const size_t most = VoicePool::max_voices;
+    return voice_limit < 1 ? 1 : voice_limit < most ? voice_limit : most;
+}
+
+SongPlayer::SongPlayer(const Module* m, int sample_rate, size_t voice_limit)
+    : mod(m)
+    , player(m)
+    , mixer(clamp_voices(voice_limit), sample_rate, false)
+    , voices(mixer, voice_limit)
+    , _sample_rate(sample_rate)
+    , tick_remainder(0)
+    , tick_frames_left(0)
+{
+    host_samples.fill(nullptr);
+    voice_channel.fill(0);
+    voice_instrument.fill(0);
+}
+
+size_t SongPlayer::memory_usage() const
+{
+    return sizeof(*this) - sizeof(mixer) + mixer.memory_usage();
+}
+
+size_t SongPlayer::max_tick_frames() const
+{
+    return static_cast<size_t>(_sample_rate) * 5 / (2 * slowest_tempo) + 1;
+}
+
+size_t SongPlayer::next_tick()
+{
+    const auto started = stats ? RenderStats::clock::now() : RenderStats::clock::time_point();
+    player.process_tick();
+    update_channels();
+    if (stats) {
+        stats->record_tick(started);
+    }
+
+    const unsigned numerator = static_cast<unsigned>(_sample_rate) * 5 + tick_remainder;
+    const unsigned denominator = 2u * player.tempo;
+    tick_remainder = numerator % denominator;
+    return numerator / denominator;
+}
+
+size_t SongPlayer::render_tick(StereoSample* out)
+{
+    const size_t frames = tick_frames_left ? tick_frames_left : next_tick();
+    tick_frames_left = 0;
+    mixer.render(out, frames);
+    return frames;
+}
+
+size_t SongPlayer::render_tick_stems(StereoSample* const* stems, StemKey key)
+{
+    const size_t frames = tick_frames_left ? tick_frames_left : next_tick();
+    tick_frames_left = 0;
+    const auto& route = key == StemKey::channel ? voice_channel : voice_instrument;
+    mixer.render_routed(stems, max_stems, route.data(), frames);
+    return frames;
+}
+
+size_t SongPlayer::skip_tick()
+{
+    const size_t frames = tick_frames_left ? tick_frames_left : next_tick();
+    tick_frames_left = 0;
+    mixer.skip(frames);
+    return frames;
+}
+
+void SongPlayer::render(StereoSample* out, size_t frames)
+{
+    advance(out, frames);
+}
+
+void SongPlayer::skip(size_t frames)
+{
+    advance(nullptr, frames);
+}
+
+void SongPlayer::advance(StereoSample* out, size_t frames)
+{
+    while (frames) {
+        if (tick_frames_left == 0) {
+            tick_frames_left = next_tick();
+        }
+        const size_t n = std::min(frames, tick_frames_left);
+        if (out) {
+            mixer.render(out, n);
+            out += n;
+        } else {
+            mixer.skip(n);
+        }
+        frames -= n;
+        tick_frames_left -= n;
+    }
+}
+
+SongPlayer::Snapshot SongPlayer::snapshot() const
+{
+    Snapshot s(player);
+    s.frame = mixer.time();
+    s.voices = voices.save();
+    for (size_t i = 0; i < mixer.channels.size(); i++) {
+        if (mixer.channels[i].is_active) {
+            s.channels.emplace_back(i, mixer.channels[i]);
+        }
+    }
+    s.host_samples = host_samples;
+    s.voice_channel = voice_channel;
+    s.voice_instrument = voice_instrument;
+    s.tick_remainder = tick_remainder;
+    s.tick_frames_left = tick_frames_left;
+    return s;
+}
+
+void SongPlayer::restore(const Snapshot& s)
+{
+    player = s.player;
+    voices.restore(s.voices);
+    for (auto& channel : mixer.channels) {
+        channel.disable();
+    }
+    for (const auto& saved : s.channels) {
+        mixer.channel(saved.first).restore(saved.second);
+    }
+    mixer.set_time(s.frame);
+    host_samples = s.host_samples;
+    voice_channel = s.voice_channel;
+    voice_instrument = s.voice_instrument;
+    tick_remainder = s.tick_remainder;
+    tick_frames_left = s.tick_frames_left;
+}
+
+void SongPlayer::update_channels()
+{
+    voices.tick();
+    // Only the host channels the sequencer changed this tick
+    for (uint64_t updated = player.updated_channels; updated; updated &= updated - 1) {
+        const auto c = static_cast<size_t>(__builtin_ctzll(updated));
+        auto& host = player.host_channels[c];
+        if (host.note_cut) {
+            host.note_cut = false;
+            voices.note_cut(c);
+        }
+        if (host.note_off) {
+            host.note_off = false;
+            voices.note_off(c);
+        }
+        if (mod->channel_panning[c] >= 128) { // Channel is disabled
+            host.new_note = false;
+            continue;
+        }
+        if (host.new_note) {
+            host.new_note = false;
+            if (!start_note(c)) {
+                continue;
+            }
+        }
+        AudioChannel* channel = voices.foreground(c);
+        const Sample* sample = host_samples[c];
+        if (!channel || !sample) {
+            continue;
+        }
+        channel->set_playback_rate(sample->c5_speed * middle_c_period / static_cast<float>(host.final_period()));
+        voices.set_volume(c, static_cast<float>(host.final_volume() * host.channel_volume * sample->global_volume * player.global_volume)
+            / (64.0f * 64.0f * 64.0f * 128.0f));
+        // 0-64 is left to right and 100 is surround, which we play centred.
+        const int panning = host.final_panning();
+        channel->set_panning(panning > 64
+                ? AudioChannel::panning_center
+                : (static_cast<float>(panning) - 32.0f) / 32.0f);
+    }
+    player.updated_channels = 0;
+}
+
+bool SongPlayer::start_note(size_t c)
+{
+    auto& host = player.host_channels[c];
+    const bool retrigger = host.retrigger;
+    host.retrigger = false;
+    // Samples are numbered from one. A note without one replays
+    // whatever sample the channel last played.
+    const Sample* sample = host_samples[c];
+    const auto sample_number = static_cast<size_t>(host.sample_index);
+    if (sample_number >= 1 && sample_number <= mod->samples.size()) {
+        sample = &mod->samples[sample_number - 1];
+    }
+    if (!sample || sample->length() == 0 || host.period <= 0) {
+        return false;
+    }
+    host_samples[c] = sample;
+
+    // Without instruments every new note cuts the last one, and a
+    // retriggered note always takes over from itself
+    NewNoteAction nna = NewNoteAction::cut;
+    uint16_t fadeout = 0;
+    const auto instrument = static_cast<size_t>(host.instrument);
+    if (mod->use_instruments && instrument >= 1 && instrument <= mod->instruments.size()) {
+        nna = retrigger ? NewNoteAction::cut : mod->instruments[instrument - 1].new_note_action;
+        fadeout = mod->instruments[instrument - 1].fadeout;
+    }
+    auto& channel = voices.start_note(c, nna, fadeout);
+    const auto voice = static_cast<size_t>(&channel - mixer.channels.data());
+    voice_channel[voice] = static_cast<uint8_t>(c);
+    voice_instrument[voice] = static_cast<uint8_t>(host.instrument);
+    channel.play(sample);
+    const auto offset = static_cast<size_t>(host.sample_offset);
+    if (offset && offset < sample->length()) {
+        channel.sample_index = position_from_frames(offset);
+    }
+    return true;
+}
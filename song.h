@@ -0,0 +1,105 @@
+#ifndef _SONG_H_
+#define _SONG_H_
+#include "mixer.h"
+#include "player.h"
+#include "render_stats.h"
+#include "voice_pool.h"
+
+// Plays a Module through a Mixer: runs the sequencer once per tick and hands
+// the notes it triggers to voices from a VoicePool, so notes can ring on
+// after their channel moves on to the next one.
+struct SongPlayer {
+    // What stems are split by: the pattern channel a voice's note was played
+    // on, or its instrument (its sample, in songs without instruments)
+    enum class StemKey {
+        channel,
+        instrument,
+    };
+    // Channels and instruments are numbered below this
+    static const size_t max_stems = 256;
+
+    // Everything needed to pick playback up again from a point in the song
+    struct Snapshot {
+        uint64_t frame = 0;
+        PlayerContext player;
+        VoicePool::State voices;
+        // Only the voices that were sounding, by mixer channel
+        std::vector<std::pair<size_t, AudioChannel>> channels;
+        std::array<const Sample*, 64> host_samples;
+        std::array<uint8_t, VoicePool::max_voices> voice_channel;
+        std::array<uint8_t, VoicePool::max_voices> voice_instrument;
+        unsigned tick_remainder = 0;
+        size_t tick_frames_left = 0;
+
+        explicit Snapshot(const PlayerContext& p)
+            : player(p)
+        {
+        }
+    };
+
+    const Module* mod;
+    PlayerContext player;
+    Mixer mixer; // one channel per voice, up to the voice limit
+    VoicePool voices;
+    // If set, how long each tick takes to process is recorded here
+    RenderStats* stats = nullptr;
+
+    // voice_limit caps how many voices sound at once.
+    SongPlayer(const Module* m, int sample_rate, size_t voice_limit = VoicePool::max_voices);
+    // Processes the next tick and returns how many frames it lasts.
+    size_t next_tick();
+    // Processes the next tick and renders all of it into out, which must hold
+    // at least max_tick_frames() frames. Returns the number of frames written.
+    // If render() stopped partway through a tick, renders the rest of that
+    // tick instead.
+    size_t render_tick(StereoSample* out);
+    // Like render_tick(), but renders each voice into the stem its note
+    // belongs to: into stems[n] for channel or instrument n, or nowhere if
+    // that's null. stems has max_stems entries, and each that isn't null
+    // holds at least max_tick_frames() frames.
+    size_t render_tick_stems(StereoSample* const* stems, StemKey key);
+    // Like render_tick(), but moves on without producing audio.
+    size_t skip_tick();
+    // Renders the next frames of the song into out, buffer sizes and tick
+    // lengths being unrelated: the buffer is split wherever a tick starts,
+    // so every tick starts on its exact frame. For audio callbacks; doesn't
+    // allocate as long as the module's patterns are all loaded (see
+    // Module::load_all_patterns).
+    void render(StereoSample* out, size_t frames);
+    // Moves the song on by frames exactly as render() would, without
+    // producing audio: the sequencer runs every tick and voices move on
+    // without being mixed.
+    void skip(size_t frames);
+    // Frames played (or skipped) since the start of the song
+    uint64_t position() const { return mixer.time(); }
+    Snapshot snapshot() const;
+    // Continues from a snapshot of this song, taken by any SongPlayer with the
+    // same sample rate and voice limit.
+    void restore(const Snapshot& s);
+    // Bytes owned by the player, not counting the module it plays.
+    size_t memory_usage() const;
+    // The longest a tick can last, which is at the slowest tempo IT allows.
+    size_t max_tick_frames() const;
+    // True once the last tick of the last row in the order list has played.
+    bool finished() const { return player.loop_count > 0 && player.ticks_to_next_row == 0; }
+    int sample_rate() const { return _sample_rate; }
+
+private:
+    void update_channels();
+    // Starts the host channel's new note on a voice; false if there's nothing to play
+    bool start_note(size_t host_channel);
+    // Renders into out, or only moves on if out is null
+    void advance(StereoSample* out, size_t frames);
+    const int _sample_rate;
+    // Ticks last 2.5 * rate / tempo frames; carrying the remainder of that
+    // division over keeps tick boundaries exact over a whole song.
+    unsigned tick_remainder;
+    // Frames of the current tick that haven't been rendered yet
+    size_t tick_frames_left;
+    // The sample each host channel last played
+    std::array<const Sample*, 64> host_samples;
+    // The host channel and instrument that started each voice's note
+    std::array<uint8_t, VoicePool::max_voices> voice_channel;
+    std::array<uint8_t, VoicePool::max_voices> voice_instrument;
+};
+#endif
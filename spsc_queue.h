@@ -0,0 +1,78 @@
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// A fixed-size ring for handing items from one thread to exactly one other.
+// Both sides are wait-free: nothing locks, nothing allocates, and every call
+// finishes in a few steps however the other thread behaves, so it is safe to
+// use from an audio callback.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    SpscQueue()
+        : head(0)
+        , cached_tail(0)
+        , tail(0)
+        , cached_head(0)
+    {
+    }
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side. Returns false, dropping the item, if the queue is full.
+    bool push(const T& item)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head == Capacity) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head == Capacity) {
+                return false;
+            }
+        }
+        items[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. The oldest item, or nullptr if the queue is empty. It
+    // stays valid until pop().
+    const T* front()
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail) {
+                return nullptr;
+            }
+        }
+        return &items[h & (Capacity - 1)];
+    }
+    // Consumer side; only after front() returned an item.
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Either side; only a snapshot while the other side is running.
+    size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+    static size_t capacity() { return Capacity; }
+
+private:
+    static const size_t cache_line = 64;
+
+    // The indexes only ever grow; the slot is the index modulo Capacity.
+    // Each thread's index, and its copy of the other's, share a cache line
+    // apart from the other thread's.
+    std::atomic<size_t> head; // next item to read, written by the consumer
+    size_t cached_tail; // the consumer's last look at tail
+    char consumer_padding[cache_line - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    std::atomic<size_t> tail; // next slot to write, written by the producer
+    size_t cached_head; // the producer's last look at head
+    char producer_padding[cache_line - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    std::array<T, Capacity> items;
+};
+#endif
@@ -0,0 +1,97 @@
+#include "stem_render.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+
+std::vector<size_t> find_stems(const Module& mod, SongPlayer::StemKey key)
+{
+    std::vector<bool> used(SongPlayer::max_stems);
+    std::vector<bool> seen(mod.pattern_count());
+    for (uint8_t order : mod.orders) {
+        if (order >= seen.size() || seen[order]) {
+            continue;
+        }
+        seen[order] = true;
+        const auto pattern = mod.pattern(order);
+        for (size_t r = 0; r < pattern->row_count(); r++) {
+            const auto row = pattern->row(r);
+            for (size_t i = 0; i < row.size(); i++) {
+                const auto& entry = row[i];
+                if (key == SongPlayer::StemKey::channel) {
+                    if (entry.note.is_note()) {
+                        used[row.channel(i)] = true;
+                    }
+                } else if (!entry.inst.is_empty()) {
+                    // A note without an instrument plays the channel's last
+                    // one, which will have turned up on its own row
+                    used[static_cast<size_t>(entry.inst)] = true;
+                }
+            }
+        }
+    }
+    std::vector<size_t> stems;
+    for (size_t i = 0; i < used.size(); i++) {
+        if (used[i]) {
+            stems.push_back(i);
+        }
+    }
+    return stems;
+}
+
+std::string stem_path(const std::string& prefix, SongPlayer::StemKey key, size_t stem)
+{
+    char suffix[16];
+    if (key == SongPlayer::StemKey::channel) {
+        snprintf(suffix, sizeof suffix, ".ch%02zu.wav", stem + 1);
+    } else {
+        snprintf(suffix, sizeof suffix, ".ins%02zu.wav", stem);
+    }
+    return prefix + suffix;
+}
+
+RenderResult render_stems(const Module& mod, const std::vector<size_t>& stems,
+    const std::vector<std::string>& paths, const RenderOptions& options, SongPlayer::StemKey key)
+{
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+
+    SongPlayer song(&mod, options.sample_rate, options.voice_limit);
+    song.mixer.set_interpolation(options.interpolation);
+    const size_t tick_frames = song.max_tick_frames();
+
+    // One tick's worth of audio and a writer per stem. The rest of the
+    // stem table stays null, so their voices are only moved on.
+    std::vector<StereoSample> buffers(stems.size() * tick_frames);
+    std::vector<StereoSample*> outputs(SongPlayer::max_stems, nullptr);
+    std::vector<std::unique_ptr<AudioFileWriter>> writers(stems.size());
+    for (size_t i = 0; i < stems.size(); i++) {
+        outputs[stems[i]] = &buffers[i * tick_frames];
+        if (i < paths.size() && !paths[i].empty()) {
+            writers[i].reset(new AudioFileWriter(paths[i], file_type_for_path(paths[i]), options.format,
+                options.sample_rate));
+            set_up_master_bus(writers[i]->master_bus(), mod, options);
+        }
+    }
+    const auto max_frames = static_cast<size_t>(options.max_seconds * options.sample_rate);
+
+    RenderResult result;
+    while (!song.finished() && (max_frames == 0 || result.frames < max_frames)) {
+        const size_t frames = song.render_tick_stems(outputs.data(), key);
+        for (size_t i = 0; i < stems.size(); i++) {
+            if (writers[i]) {
+                writers[i]->write(outputs[stems[i]], frames);
+            }
+        }
+        result.frames += frames;
+    }
+    for (auto& writer : writers) {
+        if (writer) {
+            writer->close();
+        }
+    }
+
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    result.elapsed_seconds = elapsed.count();
+    result.audio_seconds = static_cast<double>(result.frames) / options.sample_rate;
+    return result;
+}
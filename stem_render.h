@@ -0,0 +1,30 @@
+#ifndef _STEM_RENDER_H_
+#define _STEM_RENDER_H_
+#include "offline_render.h"
+#include "song.h"
+#include <string>
+#include <vector>
+
+// Stems are a song rendered one pattern channel (or one instrument) at a
+// time, each to a file of its own. Added together, a song's stems make the
+// song.
+
+// The stems with something in them: the channels, or instruments, that play
+// notes in the patterns on the order list. Channels are numbered from 0 and
+// instruments from 1, as SongPlayer numbers stems.
+std::vector<size_t> find_stems(const Module& mod, SongPlayer::StemKey key);
+
+// Where a stem goes: <prefix>.ch01.wav for channel 0, <prefix>.ins01.wav for
+// instrument 1.
+std::string stem_path(const std::string& prefix, SongPlayer::StemKey key, size_t stem);
+
+// Plays the song through once and writes the given stems of it, each to the
+// path at the same index in paths; an empty path throws that stem away.
+// Files are written as the song plays, so only a tick of audio per stem is
+// held however long the song is. Voices of the other stems are moved on
+// without being mixed, so a song's stems can be split across calls on
+// several threads for little more work than rendering them in one. Throws
+// std::runtime_error if a file can't be written.
+RenderResult render_stems(const Module& mod, const std::vector<size_t>& stems,
+    const std::vector<std::string>& paths, const RenderOptions& options, SongPlayer::StemKey key);
+#endif
@@ -0,0 +1,182 @@
+#include "job_pool.h"
+#include "module_files.h"
+#include "stem_render.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static int usage()
+{
+    fprintf(stderr,
+        "usage: stems [options] <module.it|directory>...\n"
+        "  --out <dir>         write <dir>/<name>.ch01.wav and so on (default .)\n"
+        "  --by <what>         channel or instrument (default channel)\n"
+        "  --threads <n>       worker threads (default: one per core)\n"
+        "  --stems-per-job <n> stems one job renders; each job plays the whole song\n"
+        "                      (default: enough to spread each song over every thread)\n"
+        "  --rate <hz>         output sample rate (default 44100)\n"
+        "  --format <fmt>      s16, s24 or f32 (default s16)\n"
+        "  --clip <mode>       none, hard or soft: what happens past full scale\n"
+        "                      (default hard; none only matters for f32)\n"
+        "  --dither            add triangular dither when writing s16 or s24\n"
+        "  --interp <mode>     nearest, linear, cubic, sinc8 or sinc16 (default nearest)\n"
+        "  --voices <n>        most voices sounding at once, 1 to 256 (default 256)\n"
+        "  --seconds <n>       stop each song after n seconds\n"
+        "  --quiet             don't print a line per file\n");
+    return 2;
+}
+
+struct StemStats {
+    size_t modules = 0;
+    size_t stems = 0;
+    size_t failed = 0;
+    double audio_seconds = 0;
+};
+
+struct StemJobOptions {
+    RenderOptions render;
+    SongPlayer::StemKey key = SongPlayer::StemKey::channel;
+    std::string out_dir = ".";
+    size_t stems_per_job = 0;
+    bool verbose = true;
+};
+
+// Loads the module, then hands its stems out to the pool in groups. Each
+// group plays the song on its own, keeping the module alive until the last
+// one is done.
+static void submit_module(WorkStealingPool& pool, const std::string& path, const StemJobOptions& options,
+    StemStats& stats, std::mutex& stats_mutex)
+{
+    std::shared_ptr<const Module> mod;
+    std::vector<size_t> stems;
+    try {
+        std::shared_ptr<Module> loaded(new Module(load_module(path)));
+        loaded->load_all_patterns();
+        stems = find_stems(*loaded, options.key);
+        mod = loaded;
+    } catch (const std::runtime_error& e) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.failed++;
+        fprintf(stderr, "stems: %s\n", e.what());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.modules++;
+    }
+    size_t per_job = options.stems_per_job;
+    if (per_job == 0) {
+        per_job = (stems.size() + pool.thread_count() - 1) / pool.thread_count();
+    }
+    const std::string prefix = options.out_dir + "/" + module_basename(path);
+    for (size_t first = 0; first < stems.size(); first += per_job) {
+        const std::vector<size_t> group(stems.begin() + static_cast<std::ptrdiff_t>(first),
+            stems.begin() + static_cast<std::ptrdiff_t>(std::min(first + per_job, stems.size())));
+        pool.submit([&, mod, group, prefix, path] {
+            std::vector<std::string> paths;
+            for (size_t stem : group) {
+                paths.push_back(stem_path(prefix, options.key, stem));
+            }
+            try {
+                RenderResult result = render_stems(*mod, group, paths, options.render, options.key);
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats.stems += group.size();
+                stats.audio_seconds += result.audio_seconds * static_cast<double>(group.size());
+                if (options.verbose) {
+                    for (const auto& stem : paths) {
+                        printf("%s: %.1f s of audio\n", stem.c_str(), result.audio_seconds);
+                    }
+                }
+            } catch (const std::runtime_error& e) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats.failed++;
+                fprintf(stderr, "stems: %s: %s\n", path.c_str(), e.what());
+            }
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    StemJobOptions options;
+    size_t threads = hardware_threads();
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            options.out_dir = argv[++i];
+        } else if (strcmp(argv[i], "--by") == 0 && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (strcmp(name, "channel") == 0) {
+                options.key = SongPlayer::StemKey::channel;
+            } else if (strcmp(name, "instrument") == 0) {
+                options.key = SongPlayer::StemKey::instrument;
+            } else {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--stems-per-job") == 0 && i + 1 < argc) {
+            options.stems_per_job = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            options.render.sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!sample_format_from_name(argv[++i], options.render.format)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--clip") == 0 && i + 1 < argc) {
+            if (!clipping_from_name(argv[++i], options.render.clipping)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--dither") == 0) {
+            options.render.dither = true;
+        } else if (strcmp(argv[i], "--interp") == 0 && i + 1 < argc) {
+            if (!interpolation_from_name(argv[++i], options.render.interpolation)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--voices") == 0 && i + 1 < argc) {
+            const int voices = atoi(argv[++i]);
+            if (voices < 1 || voices > 256) {
+                return usage();
+            }
+            options.render.voice_limit = static_cast<size_t>(voices);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            options.render.max_seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            options.verbose = false;
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    const auto modules = find_modules(inputs);
+    if (modules.empty() || threads == 0 || options.render.sample_rate <= 0) {
+        return usage();
+    }
+
+    StemStats stats;
+    std::mutex stats_mutex;
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    {
+        WorkStealingPool pool(threads);
+        // Modules are loaded on the pool too, so loading overlaps with rendering
+        for (const auto& path : modules) {
+            pool.submit([&, path] { submit_module(pool, path, options, stats, stats_mutex); });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    printf("%zu threads: %zu stems of %zu modules (%zu failed), %.1f s of audio in %.3f s: %.1fx realtime\n",
+        threads, stats.stems, stats.modules, stats.failed, stats.audio_seconds, elapsed.count(),
+        stats.audio_seconds / elapsed.count());
+    return stats.failed ? 1 : 0;
+}
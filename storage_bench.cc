@@ -0,0 +1,117 @@
+#include "mixer.h"
+#include "synth_module.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+#define SAMPLE_RATE (44100)
+#define FRAMES_PER_BUFFER (1024)
+
+// Mixing from samples kept as floats, the way they used to be loaded,
+// against samples kept at their native 8 or 16 bits. Each voice plays a
+// different sample, so with enough of them the samples no longer fit in
+// cache and how many bytes each frame takes starts to show.
+
+static const size_t sample_count = 64;
+static const size_t sample_frames = SAMPLE_RATE * 2;
+
+struct Storage {
+    const char* name;
+    bool sixteen_bit;
+    bool native;
+};
+
+// Resident set size of the process, or 0 where /proc isn't there to ask
+static size_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if (!(statm >> pages >> resident)) {
+        return 0;
+    }
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static std::vector<Sample> make_samples(const Storage& storage)
+{
+    const float scale = 1.0f / (storage.sixteen_bit ? 32768.0f : 128.0f);
+    std::vector<Sample> samples(sample_count);
+    for (size_t i = 0; i < sample_count; i++) {
+        const auto wave = make_test_wave(sample_frames, i, storage.sixteen_bit);
+        auto& s = samples[i];
+        if (!storage.native) {
+            s.wavetable.resize(wave.size());
+            for (size_t f = 0; f < wave.size(); f++) {
+                s.wavetable[f] = static_cast<float>(wave[f]) * scale;
+            }
+        } else if (storage.sixteen_bit) {
+            s.set_pcm(std::vector<int16_t>(wave.begin(), wave.end()), false);
+        } else {
+            s.set_pcm(std::vector<int8_t>(wave.begin(), wave.end()), false);
+        }
+        s.loop = LoopParams(LoopType::forward, static_cast<uint32_t>(sample_frames / 2),
+            static_cast<uint32_t>(sample_frames));
+        s.prepare();
+    }
+    return samples;
+}
+
+template <typename RenderFunction>
+static double frames_per_second(RenderFunction render)
+{
+    using clock = std::chrono::steady_clock;
+    const size_t blocks = 500;
+    render(); // warm up
+    auto start = clock::now();
+    for (size_t i = 0; i < blocks; i++) {
+        render();
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    return static_cast<double>(blocks * FRAMES_PER_BUFFER) / elapsed.count();
+}
+
+int main()
+{
+    const Storage storages[] = {
+        { "float (8-bit)", false, false },
+        { "int8", false, true },
+        { "float (16-bit)", true, false },
+        { "int16", true, true },
+    };
+    const Interpolation modes[] = { Interpolation::nearest, Interpolation::linear, Interpolation::sinc16 };
+    const size_t voices = 64;
+    std::vector<StereoSample> out(FRAMES_PER_BUFFER);
+
+    printf("%zu samples of %zu frames, %zu voices, %s kernel\n", sample_count, sample_frames, voices,
+        mix_kernel_name(best_mix_kernel()));
+    printf("%-16s %12s %12s %-8s %16s %16s\n", "storage", "sample MB", "RSS +MB", "interp", "frames/s",
+        "ns/voice/frame");
+    for (const auto& storage : storages) {
+        const size_t resident_before = resident_bytes();
+        const auto samples = make_samples(storage);
+        const size_t resident_after = resident_bytes();
+        size_t bytes = 0;
+        for (const auto& s : samples) {
+            bytes += s.frame_bytes();
+        }
+        const double resident_mb = (static_cast<double>(resident_after) - static_cast<double>(resident_before)) / 1e6;
+
+        Mixer mix(voices, SAMPLE_RATE);
+        for (auto mode : modes) {
+            mix.set_interpolation(mode);
+            for (size_t i = 0; i < voices; i++) {
+                auto& channel = mix.channel(i);
+                channel.play(&samples[i % samples.size()]);
+                channel.set_volume(AudioChannel::volume_max / static_cast<float>(voices));
+                channel.set_playback_rate(22050.0f * (1.0f + static_cast<float>(i) * 0.01f));
+            }
+            const double rate = frames_per_second([&] { mix.render(&out[0], out.size()); });
+            printf("%-16s %12.1f %12.1f %-8s %16.0f %16.3f\n", storage.name, static_cast<double>(bytes) / 1e6,
+                resident_mb, interpolation_name(mode), rate, 1e9 / rate / static_cast<double>(voices));
+        }
+    }
+    return 0;
+}
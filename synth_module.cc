@@ -0,0 +1,341 @@
+#include "synth_module.h"
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace {
+const size_t header_size = 0xC0;
+const size_t sample_header_size = 0x50;
+const size_t pattern_header_size = 8;
+const size_t instrument_header_size = 0x22A;
+
+void put16(std::vector<uint8_t>& out, size_t offset, uint32_t value)
+{
+    out[offset] = static_cast<uint8_t>(value);
+    out[offset + 1] = static_cast<uint8_t>(value >> 8);
+}
+
+void put32(std::vector<uint8_t>& out, size_t offset, uint32_t value)
+{
+    put16(out, offset, value & 0xFFFF);
+    put16(out, offset + 2, value >> 16);
+}
+
+void put_string(std::vector<uint8_t>& out, size_t offset, const std::string& s)
+{
+    std::copy(s.begin(), s.end(), out.begin() + static_cast<std::ptrdiff_t>(offset));
+}
+
+std::vector<uint8_t> make_pattern(const SynthModuleParams& params, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_int_distribution<int> note(36, 84);
+    std::uniform_int_distribution<int> sample(1, static_cast<int>(params.samples));
+    std::uniform_int_distribution<int> volume(16, 64);
+
+    // Effect letter (A is 1) and parameter
+    static const uint8_t effects[][2] = {
+        { 4, 0x02 }, { 4, 0x30 }, { 5, 0x08 }, { 6, 0x08 }, { 7, 0x10 }, { 8, 0x48 },
+        { 9, 0x21 }, { 10, 0x37 }, { 11, 0x01 }, { 12, 0x10 }, { 14, 0x01 }, { 16, 0x02 },
+        { 17, 0x03 }, { 18, 0x44 }, { 21, 0x86 }, { 25, 0x44 }, { 23, 0x01 }, { 19, 0xC3 },
+    };
+    std::uniform_int_distribution<size_t> effect(0, sizeof effects / sizeof effects[0] - 1);
+
+    std::vector<uint8_t> packed;
+    for (size_t row = 0; row < params.rows; row++) {
+        for (size_t channel = 0; channel < params.channels; channel++) {
+            const bool has_note = chance(rng) < params.note_density;
+            const bool has_effect = params.effect_density > 0 && chance(rng) < params.effect_density;
+            if (!has_note && !has_effect) {
+                continue;
+            }
+            packed.push_back(static_cast<uint8_t>((channel + 1) | 128));
+            packed.push_back(static_cast<uint8_t>((has_note ? 1 | 2 | 4 : 0) | (has_effect ? 8 : 0)));
+            if (has_note) { // note, instrument and volume
+                packed.push_back(static_cast<uint8_t>(note(rng)));
+                packed.push_back(static_cast<uint8_t>(sample(rng)));
+                packed.push_back(static_cast<uint8_t>(volume(rng)));
+            }
+            if (has_effect) {
+                const size_t e = effect(rng);
+                packed.push_back(effects[e][0]);
+                packed.push_back(effects[e][1]);
+            }
+        }
+        packed.push_back(0); // end of row
+    }
+    return packed;
+}
+
+std::vector<uint8_t> make_sample_data(const SynthModuleParams& params, size_t index)
+{
+    const auto wave = make_test_wave(params.sample_length, index, params.sixteen_bit);
+    if (params.compressed) {
+        if (params.sixteen_bit) {
+            return compress_it_sample(wave.data(), wave.size(), params.it215);
+        }
+        std::vector<int8_t> narrow(wave.begin(), wave.end());
+        return compress_it_sample(narrow.data(), narrow.size(), params.it215);
+    }
+    std::vector<uint8_t> data;
+    for (auto value : wave) {
+        data.push_back(static_cast<uint8_t>(value & 0xFF));
+        if (params.sixteen_bit) {
+            data.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+        }
+    }
+    return data;
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& o)
+        : out(o)
+        , buffer(0)
+        , bits(0)
+    {
+    }
+    void write(uint32_t value, unsigned width)
+    {
+        buffer |= static_cast<uint64_t>(value & ((uint32_t(1) << width) - 1)) << bits;
+        bits += width;
+        while (bits >= 8) {
+            out.push_back(static_cast<uint8_t>(buffer & 0xFF));
+            buffer >>= 8;
+            bits -= 8;
+        }
+    }
+    void flush()
+    {
+        if (bits) {
+            out.push_back(static_cast<uint8_t>(buffer & 0xFF));
+        }
+        buffer = 0;
+        bits = 0;
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint64_t buffer;
+    unsigned bits;
+};
+
+// Mirrors the decoder in it_sample.cc: sample_bits is 8 or 16, and widths
+// run from 1 to sample_bits + 1.
+template <typename T>
+struct Compressor {
+    static const unsigned sample_bits = 8 * sizeof(T);
+    static const unsigned max_width = sample_bits + 1;
+    static const unsigned width_change_bits = sizeof(T) == 1 ? 3 : 4;
+    static const int32_t border_offset = sizeof(T) == 1 ? 4 : 8;
+    static const size_t block_samples = sizeof(T) == 1 ? 0x8000 : 0x4000;
+
+    // Whether delta can be written as a sample at this width without
+    // colliding with the width-change codes.
+    static bool fits(int32_t delta, unsigned width)
+    {
+        if (width == max_width) {
+            return true;
+        }
+        const int32_t half = int32_t(1) << (width - 1);
+        if (width < 7) {
+            return delta > -half && delta < half;
+        }
+        return delta >= -half + border_offset && delta <= half - 1 - border_offset;
+    }
+
+    static void change_width(BitWriter& bits, unsigned width, unsigned new_width)
+    {
+        const uint32_t code = new_width < width ? new_width : new_width - 1;
+        if (width < 7) {
+            bits.write(uint32_t(1) << (width - 1), width);
+            bits.write(code - 1, width_change_bits);
+        } else if (width < max_width) {
+            const uint32_t border = (((uint32_t(1) << sample_bits) - 1) >> (max_width - width)) - border_offset;
+            bits.write(border + code, width);
+        } else {
+            bits.write((uint32_t(1) << sample_bits) | (new_width - 1), width);
+        }
+    }
+
+    static std::vector<uint8_t> compress(const T* data, size_t count, bool it215)
+    {
+        std::vector<uint8_t> out;
+        for (size_t start = 0; start < count; start += block_samples) {
+            const size_t n = count - start < block_samples ? count - start : block_samples;
+            std::vector<uint8_t> block;
+            BitWriter bits(block);
+            unsigned width = max_width;
+            T previous = 0;
+            T previous_d1 = 0;
+            for (size_t i = 0; i < n; i++) {
+                const T d1 = static_cast<T>(data[start + i] - previous);
+                const T delta = it215 ? static_cast<T>(d1 - previous_d1) : d1;
+                previous = data[start + i];
+                previous_d1 = d1;
+
+                unsigned needed = 1;
+                while (!fits(delta, needed)) {
+                    needed++;
+                }
+                // Only narrow when it saves more than a bit, to avoid
+                // paying for a width change on every sample.
+                if (needed > width || needed + 1 < width) {
+                    change_width(bits, width, needed);
+                    width = needed;
+                }
+                bits.write(static_cast<uint32_t>(delta) & ((uint32_t(1) << (width < sample_bits ? width : sample_bits)) - 1), width);
+            }
+            bits.flush();
+            out.push_back(static_cast<uint8_t>(block.size() & 0xFF));
+            out.push_back(static_cast<uint8_t>(block.size() >> 8));
+            out.insert(out.end(), block.begin(), block.end());
+        }
+        return out;
+    }
+};
+}
+
+std::vector<int16_t> make_test_wave(size_t length, size_t index, bool sixteen_bit)
+{
+    const double amplitude = sixteen_bit ? 32767 : 127;
+    std::vector<int16_t> wave(length);
+    for (size_t i = 0; i < length; i++) {
+        const double phase = static_cast<double>(i) * 0.03 * static_cast<double>(index + 1);
+        const double value = std::sin(phase) * 0.6 + std::sin(phase * 2.01) * 0.2;
+        wave[i] = static_cast<int16_t>(value * amplitude);
+    }
+    return wave;
+}
+
+std::vector<uint8_t> compress_it_sample(const int8_t* data, size_t count, bool it215)
+{
+    return Compressor<int8_t>::compress(data, count, it215);
+}
+
+std::vector<uint8_t> compress_it_sample(const int16_t* data, size_t count, bool it215)
+{
+    return Compressor<int16_t>::compress(data, count, it215);
+}
+
+std::vector<uint8_t> make_synth_module(const SynthModuleParams& params)
+{
+    std::mt19937 rng(params.seed);
+    std::vector<uint8_t> orders;
+    for (size_t i = 0; i < params.patterns; i++) {
+        orders.push_back(static_cast<uint8_t>(i));
+    }
+    orders.push_back(255);
+
+    std::vector<std::vector<uint8_t>> patterns;
+    for (size_t i = 0; i < params.patterns; i++) {
+        patterns.push_back(make_pattern(params, rng));
+    }
+    std::vector<std::vector<uint8_t>> sample_data;
+    for (size_t i = 0; i < params.samples; i++) {
+        sample_data.push_back(make_sample_data(params, i));
+    }
+
+    // Layout: header, orders, offset tables, instruments, sample headers,
+    // patterns, sample data
+    const size_t instrument_count = params.instruments ? params.samples : 0;
+    size_t offset = header_size + orders.size() + 4 * (instrument_count + params.samples + params.patterns);
+    const size_t instruments_offset = offset;
+    offset += instrument_header_size * instrument_count;
+    const size_t sample_headers_offset = offset;
+    offset += sample_header_size * params.samples;
+    std::vector<size_t> pattern_offsets;
+    for (const auto& p : patterns) {
+        pattern_offsets.push_back(offset);
+        offset += pattern_header_size + p.size();
+    }
+    std::vector<size_t> sample_data_offsets;
+    for (const auto& d : sample_data) {
+        sample_data_offsets.push_back(offset);
+        offset += d.size();
+    }
+
+    std::vector<uint8_t> out(offset, 0);
+    put_string(out, 0x00, "IMPM");
+    put_string(out, 0x04, "synthetic");
+    put16(out, 0x20, static_cast<uint32_t>(orders.size()));
+    put16(out, 0x22, static_cast<uint32_t>(instrument_count));
+    put16(out, 0x24, static_cast<uint32_t>(params.samples));
+    put16(out, 0x26, static_cast<uint32_t>(params.patterns));
+    put16(out, 0x28, 0x0214); // created with
+    put16(out, 0x2A, 0x0214); // compatible with
+    put16(out, 0x2C, 1 | 8 | (params.instruments ? 4 : 0)); // stereo, linear slides, instruments
+    out[0x30] = 128; // global volume
+    out[0x31] = 48; // mix volume
+    out[0x32] = params.speed;
+    out[0x33] = params.tempo;
+    out[0x34] = 128; // panning separation
+    for (size_t c = 0; c < 64; c++) {
+        out[0x40 + c] = c < params.channels ? 32 : 32 | 128;
+        out[0x80 + c] = 64;
+    }
+    size_t cursor = header_size;
+    std::copy(orders.begin(), orders.end(), out.begin() + static_cast<std::ptrdiff_t>(cursor));
+    cursor += orders.size();
+    for (size_t i = 0; i < instrument_count; i++, cursor += 4) {
+        put32(out, cursor, static_cast<uint32_t>(instruments_offset + i * instrument_header_size));
+    }
+    for (size_t i = 0; i < params.samples; i++, cursor += 4) {
+        put32(out, cursor, static_cast<uint32_t>(sample_headers_offset + i * sample_header_size));
+    }
+    for (size_t i = 0; i < params.patterns; i++, cursor += 4) {
+        put32(out, cursor, static_cast<uint32_t>(pattern_offsets[i]));
+    }
+
+    for (size_t i = 0; i < instrument_count; i++) {
+        const size_t h = instruments_offset + i * instrument_header_size;
+        put_string(out, h, "IMPI");
+        out[h + 0x11] = params.new_note_action;
+        put16(out, h + 0x14, params.fadeout);
+        out[h + 0x18] = 128; // global volume
+        out[h + 0x19] = 32 | 128; // default panning, unused
+        put_string(out, h + 0x20, "instrument " + std::to_string(i + 1));
+        // Every note plays itself on the instrument's sample
+        for (size_t note = 0; note < 120; note++) {
+            out[h + 0x40 + 2 * note] = static_cast<uint8_t>(note);
+            out[h + 0x41 + 2 * note] = static_cast<uint8_t>(i + 1);
+        }
+    }
+    for (size_t i = 0; i < params.samples; i++) {
+        const size_t h = sample_headers_offset + i * sample_header_size;
+        put_string(out, h, "IMPS");
+        out[h + 0x11] = 64; // global volume
+        // Sample present and looped; every other sample loops ping-pong
+        out[h + 0x12] = static_cast<uint8_t>(1 | 16 | (params.sixteen_bit ? 2 : 0) | (params.compressed ? 8 : 0) | (i % 2 ? 64 : 0));
+        out[h + 0x13] = 64; // default volume
+        put_string(out, h + 0x14, "sample " + std::to_string(i + 1));
+        out[h + 0x2E] = params.compressed && params.it215 ? 1 | 4 : 1; // signed, and IT2.15 compression
+        const auto length = static_cast<uint32_t>(params.sample_length);
+        put32(out, h + 0x30, length);
+        put32(out, h + 0x34, length / 4); // loop begin
+        put32(out, h + 0x38, length); // loop end
+        put32(out, h + 0x3C, static_cast<uint32_t>(8363 + 1000 * i)); // C5 speed
+        put32(out, h + 0x48, static_cast<uint32_t>(sample_data_offsets[i]));
+        std::copy(sample_data[i].begin(), sample_data[i].end(),
+            out.begin() + static_cast<std::ptrdiff_t>(sample_data_offsets[i]));
+    }
+    for (size_t i = 0; i < params.patterns; i++) {
+        const size_t p = pattern_offsets[i];
+        put16(out, p, static_cast<uint32_t>(patterns[i].size()));
+        put16(out, p + 2, static_cast<uint32_t>(params.rows));
+        std::copy(patterns[i].begin(), patterns[i].end(),
+            out.begin() + static_cast<std::ptrdiff_t>(p + pattern_header_size));
+    }
+    return out;
+}
+
+void write_synth_module(const std::string& path, const SynthModuleParams& params)
+{
+    const auto bytes = make_synth_module(params);
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+        throw std::runtime_error("can't write " + path);
+    }
+}
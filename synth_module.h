@@ -0,0 +1,46 @@
+#ifndef _SYNTH_MODULE_H_
+#define _SYNTH_MODULE_H_
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Describes a made-up module for benchmarks: random notes over a handful of
+// looped sine-ish samples, generated deterministically from the seed.
+struct SynthModuleParams {
+    size_t patterns = 8;
+    size_t rows = 64;
+    size_t channels = 8;
+    size_t samples = 4;
+    size_t sample_length = 8000;
+    bool sixteen_bit = false;
+    bool compressed = false;
+    bool it215 = false; // IT2.15 compression rather than IT2.14
+    double note_density = 0.3; // chance of a note in each cell
+    // Chance of an effect in each cell: slides, vibrato, arpeggio, retrigger
+    // and the like, but nothing that changes the song's speed or order.
+    double effect_density = 0;
+    // One instrument per sample, with this New Note Action (0 cut, 1
+    // continue, 2 note off, 3 note fade) and fadeout. Without instruments
+    // notes always cut.
+    bool instruments = false;
+    uint8_t new_note_action = 0;
+    uint16_t fadeout = 0;
+    uint8_t speed = 6;
+    uint8_t tempo = 125;
+    uint32_t seed = 1;
+};
+
+// Builds the bytes of an .it file.
+std::vector<uint8_t> make_synth_module(const SynthModuleParams& params);
+// Throws std::runtime_error if the file can't be written.
+void write_synth_module(const std::string& path, const SynthModuleParams& params);
+
+// Compress one channel of sample data the way Impulse Tracker 2.14 (or 2.15)
+// does, for making test data. Bit widths are chosen greedily, so the output
+// is valid but not as small as the tracker's own.
+std::vector<uint8_t> compress_it_sample(const int8_t* data, size_t count, bool it215);
+std::vector<uint8_t> compress_it_sample(const int16_t* data, size_t count, bool it215);
+
+// A few seconds' worth of a looping two-tone wave, for tests and benchmarks.
+std::vector<int16_t> make_test_wave(size_t length, size_t index, bool sixteen_bit);
+#endif
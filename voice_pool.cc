@@ -0,0 +1,169 @@
+#include "voice_pool.h"
+
+static size_t clamp_limit(size_t voice_limit, size_t channels)
+{
+    const size_t most = VoicePool::max_voices < channels ? VoicePool::max_voices : channels;
+    return voice_limit < most ? voice_limit : most;
+}
+
+VoicePool::VoicePool(Mixer& m, size_t voice_limit, StealPolicy steal_policy)
+    : mixer(m)
+    , limit(clamp_limit(voice_limit, m.channels.size()))
+    , policy(steal_policy)
+{
+    state.foreground_voice.fill(static_cast<uint16_t>(no_voice));
+}
+
+AudioChannel& VoicePool::start_note(size_t host, NewNoteAction nna, uint16_t fadeout)
+{
+    size_t voice = state.foreground_voice[host];
+    if (voice != no_voice && nna == NewNoteAction::cut) {
+        // The new note simply takes over the old one's voice
+        mixer.channel(voice).disable();
+    } else {
+        if (voice != no_voice) {
+            release(voice, nna);
+        }
+        voice = allocate();
+    }
+
+    Voice& v = state.voices[voice];
+    v.host = static_cast<uint16_t>(host);
+    v.fading = false;
+    v.fade = fade_full;
+    v.fadeout = fadeout;
+    v.volume = 0;
+    v.started = state.notes_started++;
+    state.foreground_voice[host] = static_cast<uint16_t>(voice);
+    return mixer.channel(voice);
+}
+
+AudioChannel* VoicePool::foreground(size_t host)
+{
+    const size_t voice = state.foreground_voice[host];
+    if (voice == no_voice || !mixer.channel(voice).is_active) {
+        return nullptr;
+    }
+    return &mixer.channel(voice);
+}
+
+void VoicePool::set_volume(size_t host, float volume)
+{
+    const size_t voice = state.foreground_voice[host];
+    if (voice == no_voice) {
+        return;
+    }
+    state.voices[voice].volume = volume;
+    mixer.channel(voice).set_volume(volume * state.voices[voice].fade / fade_full);
+}
+
+void VoicePool::note_off(size_t host)
+{
+    const size_t voice = state.foreground_voice[host];
+    if (voice != no_voice) {
+        // Without envelopes, a released note fades
+        state.voices[voice].fading = true;
+    }
+}
+
+void VoicePool::note_cut(size_t host)
+{
+    const size_t voice = state.foreground_voice[host];
+    if (voice != no_voice) {
+        mixer.channel(voice).disable();
+    }
+}
+
+void VoicePool::tick()
+{
+    for (size_t i = 0; i < limit; i++) {
+        Voice& v = state.voices[i];
+        auto& channel = mixer.channel(i);
+        if (!v.fading || !channel.is_active) {
+            continue;
+        }
+        v.fade = v.fade > v.fadeout ? static_cast<uint16_t>(v.fade - v.fadeout) : 0;
+        if (v.fade == 0) {
+            channel.disable();
+        } else {
+            channel.set_volume(v.volume * v.fade / fade_full);
+        }
+    }
+}
+
+size_t VoicePool::voices_sounding() const
+{
+    return mixer.active_count();
+}
+
+// Moves a host channel's foreground voice to the background.
+void VoicePool::release(size_t voice, NewNoteAction action)
+{
+    Voice& v = state.voices[voice];
+    state.foreground_voice[v.host] = no_voice;
+    v.host = no_voice;
+    switch (action) {
+    case NewNoteAction::cut:
+        mixer.channel(voice).disable();
+        break;
+    case NewNoteAction::note_continue:
+        break;
+    case NewNoteAction::note_off:
+    case NewNoteAction::note_fade:
+        v.fading = true;
+        break;
+    }
+}
+
+size_t VoicePool::allocate()
+{
+    for (size_t i = 0; i < limit; i++) {
+        if (!mixer.channel(i).is_active) {
+            const uint16_t host = state.voices[i].host;
+            if (host != no_voice) {
+                // A foreground voice that ended by itself; its host no longer has one
+                state.foreground_voice[host] = no_voice;
+                state.voices[i].host = no_voice;
+            }
+            return i;
+        }
+    }
+    ++state.stolen;
+    return steal();
+}
+
+// Every voice is sounding. Takes the quietest or oldest background voice, or
+// if there are none (the limit is below the number of host channels) the
+// quietest or oldest of all.
+size_t VoicePool::steal()
+{
+    size_t best = limit;
+    bool best_background = false;
+    for (size_t i = 0; i < limit; i++) {
+        const bool background = state.voices[i].host == no_voice;
+        if (best_background && !background) {
+            continue;
+        }
+        bool better = best == limit || (background && !best_background);
+        if (!better) {
+            better = policy == StealPolicy::quietest ? loudness(i) < loudness(best)
+                                                     : state.voices[i].started < state.voices[best].started;
+        }
+        if (better) {
+            best = i;
+            best_background = background;
+        }
+    }
+    mixer.channel(best).disable();
+    const uint16_t host = state.voices[best].host;
+    if (host != no_voice) {
+        state.foreground_voice[host] = no_voice;
+        state.voices[best].host = no_voice;
+    }
+    return best;
+}
+
+float VoicePool::loudness(size_t voice) const
+{
+    return state.voices[voice].volume * state.voices[voice].fade;
+}
@@ -0,0 +1,84 @@
+#ifndef _VOICE_POOL_H_
+#define _VOICE_POOL_H_
+#include "mixer.h"
+#include "player.h"
+#include <array>
+
+// Hands out the mixer's channels as voices to the song's host channels.
+// Each host channel has at most one foreground voice, the note it's playing
+// now. When it plays another note the old voice is cut, or left sounding in
+// the background, following the instrument's New Note Action. Background
+// voices play on until their sample ends, they fade out or their voice is
+// stolen.
+//
+// At most voice_limit voices sound at once. When a note needs a voice and
+// none is free, the quietest (or oldest) background voice is stolen, so the
+// mixer's work is bounded by the limit whatever the song does. All state is
+// allocated up front.
+class VoicePool {
+public:
+    // As many voices as Impulse Tracker plays at once
+    static const size_t max_voices = 256;
+    static const size_t host_channels = 64;
+    static const uint16_t fade_full = 1024;
+    static const uint16_t no_voice = 0xFFFF;
+
+    enum class StealPolicy {
+        quietest,
+        oldest,
+    };
+
+    struct Voice {
+        uint16_t host = no_voice; // the host channel it's the foreground voice of, if any
+        bool fading = false;
+        uint16_t fade = fade_full; // out of fade_full
+        uint16_t fadeout = 0; // per tick
+        float volume = 0; // before fading
+        uint64_t started = 0; // note counter when the voice started, for picking the oldest
+    };
+    // Everything about the voices apart from the mixer channels themselves,
+    // so a song's position can be saved and restored.
+    struct State {
+        std::array<Voice, max_voices> voices;
+        std::array<uint16_t, host_channels> foreground_voice;
+        uint64_t notes_started = 0;
+        size_t stolen = 0;
+    };
+
+    // mixer must have at least voice_limit channels, and voice_limit is
+    // clamped to max_voices.
+    VoicePool(Mixer& mixer, size_t voice_limit = max_voices, StealPolicy policy = StealPolicy::quietest);
+
+    // Starts a note on host channel `host`, first dealing with the note
+    // already playing there per nna. Returns the voice to set the new note
+    // up on; it has been stopped. Always finds one, stealing if it has to.
+    AudioChannel& start_note(size_t host, NewNoteAction nna, uint16_t fadeout);
+    // The host channel's foreground voice, or nullptr if it has none sounding.
+    AudioChannel* foreground(size_t host);
+    // Sets the foreground voice's volume before fading.
+    void set_volume(size_t host, float volume);
+    void note_off(size_t host);
+    void note_cut(size_t host);
+    // Advances fades by one tick; voices that have faded out stop.
+    void tick();
+
+    size_t voice_limit() const { return limit; }
+    size_t voices_sounding() const;
+    size_t voices_stolen() const { return state.stolen; }
+
+    // Only together with the mixer channels the state was saved with
+    const State& save() const { return state; }
+    void restore(const State& saved) { state = saved; }
+
+private:
+    void release(size_t voice, NewNoteAction action);
+    size_t allocate();
+    size_t steal();
+    float loudness(size_t voice) const;
+
+    Mixer& mixer;
+    const size_t limit;
+    const StealPolicy policy;
+    State state;
+};
+#endif